@@ -0,0 +1,273 @@
+#include "benchclient.h"
+
+#include "fakerfbserver.h"
+
+#include <QWebSocket>
+#include <QWebSocketHandshakeOptions>
+#include <QtEndian>
+
+#include <cstring>
+#include <zlib.h>
+
+BenchClient::BenchClient(const QNetworkRequest &request, bool deflate, QObject *parent)
+    : QObject(parent)
+    , m_request(request)
+    , m_deflate(deflate)
+    , m_ws(new QWebSocket(QString(), QWebSocketProtocol::VersionLatest, this))
+{
+    connect(m_ws, &QWebSocket::connected, this, [this] {
+        if (m_ws->subprotocol() == u"binary.deflate") {
+            m_inflate = new z_stream{};
+            inflateInit(m_inflate);
+        }
+    });
+    connect(m_ws, &QWebSocket::binaryMessageReceived, this, &BenchClient::message);
+    connect(m_ws, &QWebSocket::disconnected, this, [this] {
+        if (!m_stopped) {
+            fail(QStringLiteral("Closed by server: %1").arg(m_ws->closeReason()));
+        }
+    });
+    connect(m_ws, &QWebSocket::errorOccurred, this, [this] {
+        if (!m_stopped) {
+            fail(m_ws->errorString());
+        }
+    });
+}
+
+BenchClient::~BenchClient()
+{
+    if (m_inflate) {
+        inflateEnd(m_inflate);
+        delete m_inflate;
+    }
+}
+
+void BenchClient::start()
+{
+    QWebSocketHandshakeOptions options;
+    if (m_deflate) {
+        options.setSubprotocols({QStringLiteral("binary.deflate"), QStringLiteral("binary")});
+    } else {
+        options.setSubprotocols({QStringLiteral("binary")});
+    }
+    m_ws->open(m_request, options);
+}
+
+void BenchClient::stop()
+{
+    m_stopped = true;
+    m_ws->close();
+}
+
+void BenchClient::reset()
+{
+    m_rfbBytes  = 0;
+    m_wireBytes = 0;
+    m_latencies.clear();
+}
+
+void BenchClient::message(const QByteArray &message)
+{
+    m_wireBytes += message.size();
+
+    QByteArray data;
+    if (!m_inflate) {
+        data = message;
+    } else if (message.startsWith('\x01')) {
+        data.resize(message.size() * 8);
+        auto in             = const_cast<char *>(message.constData() + 1);
+        m_inflate->next_in  = reinterpret_cast<Bytef *>(in);
+        m_inflate->avail_in = uInt(message.size() - 1);
+        qsizetype used      = 0;
+        do {
+            if (used == data.size()) {
+                data.resize(data.size() * 2);
+            }
+            m_inflate->next_out  = reinterpret_cast<Bytef *>(data.data() + used);
+            m_inflate->avail_out = uInt(data.size() - used);
+            const int ret        = inflate(m_inflate, Z_SYNC_FLUSH);
+            if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                fail(QStringLiteral("Inflate failed: %1").arg(ret));
+                return;
+            }
+            used = data.size() - m_inflate->avail_out;
+        } while (m_inflate->avail_out == 0);
+        data.resize(used);
+    } else {
+        data = message.mid(1);
+    }
+
+    m_rfbBytes += data.size();
+    m_buf.append(data);
+    while (m_state != Failed && parse()) {
+    }
+}
+
+bool BenchClient::parse()
+{
+    switch (m_state) {
+    case Version:
+        if (m_buf.size() < 12) {
+            return false;
+        }
+        m_buf.remove(0, 12);
+        m_ws->sendBinaryMessage(QByteArrayLiteral("RFB 003.008\n"));
+        m_state = SecurityTypes;
+        return true;
+    case SecurityTypes:
+        if (m_buf.isEmpty() || m_buf.size() < 1 + quint8(m_buf[0])) {
+            return false;
+        }
+        if (!m_buf.mid(1, quint8(m_buf[0])).contains('\x01')) {
+            fail(QStringLiteral("Console doesn't offer None security"));
+            return false;
+        }
+        m_buf.remove(0, 1 + quint8(m_buf[0]));
+        m_ws->sendBinaryMessage(QByteArray(1, '\x01'));
+        m_state = SecurityResult;
+        return true;
+    case SecurityResult:
+        if (m_buf.size() < 4) {
+            return false;
+        }
+        if (qFromBigEndian<quint32>(m_buf.constData()) != 0) {
+            fail(QStringLiteral("Security handshake failed"));
+            return false;
+        }
+        m_buf.remove(0, 4);
+        // Shared, the relay may have other viewers
+        m_ws->sendBinaryMessage(QByteArray(1, '\x01'));
+        m_state = ServerInit;
+        return true;
+    case ServerInit: {
+        if (m_buf.size() < 24) {
+            return false;
+        }
+        const qsizetype size = 24 + qFromBigEndian<quint32>(m_buf.constData() + 20);
+        if (m_buf.size() < size) {
+            return false;
+        }
+        m_width  = qFromBigEndian<quint16>(m_buf.constData());
+        m_height = qFromBigEndian<quint16>(m_buf.constData() + 2);
+        m_buf.remove(0, size);
+
+        // Raw only
+        QByteArray encodings(8, '\0');
+        encodings[0] = 2;
+        qToBigEndian<quint16>(1, encodings.data() + 2);
+        m_ws->sendBinaryMessage(encodings);
+        requestUpdate(false);
+
+        m_state = Live;
+        Q_EMIT live();
+        return true;
+    }
+    case Live:
+        if (m_buf.isEmpty()) {
+            return false;
+        }
+        switch (quint8(m_buf[0])) {
+        case 0:
+            m_state = UpdateHeader;
+            return true;
+        case 2: // Bell
+            m_buf.remove(0, 1);
+            return true;
+        case 3:
+            if (m_buf.size() < 8 ||
+                m_buf.size() < 8 + qFromBigEndian<quint32>(m_buf.constData() + 4)) {
+                return false;
+            }
+            m_buf.remove(0, 8 + qFromBigEndian<quint32>(m_buf.constData() + 4));
+            return true;
+        }
+        fail(QStringLiteral("Unexpected server message %1").arg(quint8(m_buf[0])));
+        return false;
+    case UpdateHeader:
+        if (m_buf.size() < 4) {
+            return false;
+        }
+        m_rects = qFromBigEndian<quint16>(m_buf.constData() + 2);
+        m_buf.remove(0, 4);
+        m_state = RectHeader;
+        return true;
+    case RectHeader: {
+        if (m_rects == 0) {
+            // Empty update or one that ended with a pseudo encoding
+            requestUpdate(true);
+            m_state = Live;
+            return true;
+        }
+        if (m_buf.size() < 12) {
+            return false;
+        }
+        const quint16 width   = qFromBigEndian<quint16>(m_buf.constData() + 4);
+        const quint16 height  = qFromBigEndian<quint16>(m_buf.constData() + 6);
+        const qint32 encoding = qFromBigEndian<qint32>(m_buf.constData() + 8);
+        m_buf.remove(0, 12);
+        --m_rects;
+
+        if (encoding == -223) {
+            // DesktopSize, no payload
+            return true;
+        }
+        if (encoding != 0) {
+            fail(QStringLiteral("Unexpected encoding %1").arg(encoding));
+            return false;
+        }
+        m_need   = qint64(width) * height * 4;
+        m_sentAt = 0;
+        m_state  = Pixels;
+        return true;
+    }
+    case Pixels: {
+        if (m_sentAt == 0 && m_need >= 8) {
+            if (m_buf.size() < 8) {
+                return false;
+            }
+            memcpy(&m_sentAt, m_buf.constData(), sizeof(m_sentAt));
+        }
+
+        const qint64 size = qMin<qint64>(m_need, m_buf.size());
+        m_buf.remove(0, size);
+        m_need -= size;
+        if (m_need > 0) {
+            return false;
+        }
+
+        if (m_rects > 0) {
+            m_state = RectHeader;
+            return true;
+        }
+
+        if (m_sentAt > 0) {
+            m_latencies.append((FakeRfbServer::now() - m_sentAt) / 1000);
+        }
+        requestUpdate(true);
+        m_state = Live;
+        return true;
+    }
+    case Failed:
+        break;
+    }
+    return false;
+}
+
+void BenchClient::requestUpdate(bool incremental)
+{
+    // Incremental requests are answered with the next synthetic rect
+    QByteArray request(10, '\0');
+    request[0] = 3;
+    request[1] = incremental ? 1 : 0;
+    qToBigEndian<quint16>(m_width, request.data() + 6);
+    qToBigEndian<quint16>(m_height, request.data() + 8);
+    m_ws->sendBinaryMessage(request);
+}
+
+void BenchClient::fail(const QString &error)
+{
+    m_state   = Failed;
+    m_stopped = true;
+    m_ws->abort();
+    Q_EMIT failed(error);
+}
@@ -0,0 +1,71 @@
+#ifndef BENCHCLIENT_H
+#define BENCHCLIENT_H
+
+#include <QNetworkRequest>
+#include <QObject>
+#include <QVector>
+
+class QWebSocket;
+struct z_stream_s;
+
+// RFB client talking to a console through the Ws relay. It announces
+// Raw only and asks for the next update as soon as one is complete.
+class BenchClient : public QObject
+{
+    Q_OBJECT
+public:
+    BenchClient(const QNetworkRequest &request, bool deflate, QObject *parent = nullptr);
+    ~BenchClient() override;
+
+    void start();
+    void stop();
+    // Drops what was counted before the measured run
+    void reset();
+
+    bool isLive() const { return m_state == Live; }
+
+    qint64 rfbBytes() const { return m_rfbBytes; }
+    qint64 wireBytes() const { return m_wireBytes; }
+    // Send to receive time of every complete update, in µs
+    const QVector<qint64> &latencies() const { return m_latencies; }
+
+Q_SIGNALS:
+    void live();
+    void failed(const QString &error);
+
+private:
+    enum State {
+        Version,
+        SecurityTypes,
+        SecurityResult,
+        ServerInit,
+        Live,
+        UpdateHeader,
+        RectHeader,
+        Pixels,
+        Failed,
+    };
+
+    void message(const QByteArray &message);
+    bool parse();
+    void requestUpdate(bool incremental);
+    void fail(const QString &error);
+
+    QNetworkRequest m_request;
+    bool m_deflate;
+    QWebSocket *m_ws;
+    z_stream_s *m_inflate = nullptr;
+    QByteArray m_buf;
+    QVector<qint64> m_latencies;
+    State m_state      = Version;
+    qint64 m_rfbBytes  = 0;
+    qint64 m_wireBytes = 0;
+    qint64 m_need      = 0;
+    qint64 m_sentAt    = 0;
+    int m_rects        = 0;
+    quint16 m_width    = 0;
+    quint16 m_height   = 0;
+    bool m_stopped     = false;
+};
+
+#endif // BENCHCLIENT_H
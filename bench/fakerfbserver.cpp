@@ -0,0 +1,217 @@
+#include "fakerfbserver.h"
+
+#include <QDebug>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QtEndian>
+
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+enum State {
+    Version,
+    Choice,
+    ClientInit,
+    Messages,
+};
+
+QByteArray serverInit(quint16 width, quint16 height)
+{
+    QByteArray ret(24, '\0');
+    qToBigEndian<quint16>(width, ret.data());
+    qToBigEndian<quint16>(height, ret.data() + 2);
+    // 32bpp, depth 24, little endian true colour 8:8:8
+    ret[4] = 32;
+    ret[5] = 24;
+    ret[6] = 0;
+    ret[7] = 1;
+    qToBigEndian<quint16>(255, ret.data() + 8);
+    qToBigEndian<quint16>(255, ret.data() + 10);
+    qToBigEndian<quint16>(255, ret.data() + 12);
+    ret[14] = 16;
+    ret[15] = 8;
+    ret[16] = 0;
+
+    const QByteArray name = QByteArrayLiteral("virtlyst-bench");
+    qToBigEndian<quint32>(name.size(), ret.data() + 20);
+    return ret + name;
+}
+
+} // namespace
+
+FakeRfbServer::FakeRfbServer(const Options &options, QObject *parent)
+    : QTcpServer(parent)
+    , m_options(options)
+{
+    m_options.rectWidth  = qMin(m_options.rectWidth, m_options.width);
+    m_options.rectHeight = qMin(m_options.rectHeight, m_options.height);
+
+    // Twice an update so that each one can start at another offset,
+    // smooth gradients with noisy low bits compress about as badly
+    // as a real desktop does
+    const qsizetype size = qsizetype(m_options.rectWidth) * m_options.rectHeight * 4 * 2;
+    m_pixels.resize(size);
+    quint32 seed = 1;
+    for (qsizetype i = 0; i < size; ++i) {
+        seed        = seed * 1103515245 + 12345;
+        m_pixels[i] = char(((i / 4) % m_options.rectWidth) ^ ((seed >> 16) & 0x0f));
+    }
+}
+
+qint64 FakeRfbServer::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void FakeRfbServer::incomingConnection(qintptr socketDescriptor)
+{
+    auto client  = new Client;
+    client->sock = new QTcpSocket(this);
+    client->sock->setSocketDescriptor(socketDescriptor);
+    client->sock->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+
+    if (m_options.fps > 0) {
+        client->pace = new QTimer(client->sock);
+        client->pace->setInterval(1000 / m_options.fps);
+        connect(client->pace, &QTimer::timeout, this, [this, client] {
+            if (client->requested) {
+                sendUpdate(client);
+            }
+        });
+        client->pace->start();
+    }
+
+    connect(client->sock, &QTcpSocket::readyRead, this, [this, client] { readClient(client); });
+    connect(client->sock, &QTcpSocket::disconnected, this, [client] {
+        if (client->pace) {
+            client->pace->stop();
+        }
+        client->sock->deleteLater();
+        delete client;
+    });
+
+    client->sock->write("RFB 003.008\n");
+}
+
+void FakeRfbServer::readClient(Client *client)
+{
+    client->buf.append(client->sock->readAll());
+    while (parseMessage(client)) {
+    }
+}
+
+bool FakeRfbServer::parseMessage(Client *client)
+{
+    QByteArray &buf = client->buf;
+    switch (client->state) {
+    case Version:
+        if (buf.size() < 12) {
+            return false;
+        }
+        buf.remove(0, 12);
+        client->sock->write(QByteArray("\x01\x01", 2));
+        client->state = Choice;
+        return true;
+    case Choice:
+        if (buf.isEmpty()) {
+            return false;
+        }
+        buf.remove(0, 1);
+        client->sock->write(QByteArray(4, '\0'));
+        client->state = ClientInit;
+        return true;
+    case ClientInit:
+        if (buf.isEmpty()) {
+            return false;
+        }
+        buf.remove(0, 1);
+        client->sock->write(serverInit(m_options.width, m_options.height));
+        client->state = Messages;
+        return true;
+    }
+
+    if (buf.isEmpty()) {
+        return false;
+    }
+
+    qsizetype size = 0;
+    switch (quint8(buf[0])) {
+    case 0: // SetPixelFormat
+        size = 20;
+        break;
+    case 2: // SetEncodings
+        if (buf.size() < 4) {
+            return false;
+        }
+        size = 4 + 4 * qFromBigEndian<quint16>(buf.constData() + 2);
+        break;
+    case 3: // FramebufferUpdateRequest
+        size = 10;
+        break;
+    case 4: // KeyEvent
+        size = 8;
+        break;
+    case 5: // PointerEvent
+        size = 6;
+        break;
+    case 6: // ClientCutText
+        if (buf.size() < 8) {
+            return false;
+        }
+        size = 8 + qFromBigEndian<quint32>(buf.constData() + 4);
+        break;
+    case 255: // QEMU extended key event
+        size = 12;
+        break;
+    default:
+        qWarning() << "Unknown client message" << quint8(buf[0]);
+        client->sock->abort();
+        return false;
+    }
+
+    if (buf.size() < size) {
+        return false;
+    }
+
+    const bool request = buf[0] == 3;
+    buf.remove(0, size);
+    if (request) {
+        client->requested = true;
+        if (!client->pace) {
+            sendUpdate(client);
+        }
+    }
+    return true;
+}
+
+void FakeRfbServer::sendUpdate(Client *client)
+{
+    client->requested = false;
+
+    const qsizetype size = qsizetype(m_options.rectWidth) * m_options.rectHeight * 4;
+    const int columns    = m_options.width / m_options.rectWidth;
+    const int rows       = m_options.height / m_options.rectHeight;
+    const int tile       = client->offset % (columns * rows);
+
+    QByteArray update(4 + 12 + size, Qt::Uninitialized);
+    char *data = update.data();
+    data[0]    = 0;
+    data[1]    = 0;
+    qToBigEndian<quint16>(1, data + 2);
+    qToBigEndian<quint16>((tile % columns) * m_options.rectWidth, data + 4);
+    qToBigEndian<quint16>((tile / columns) * m_options.rectHeight, data + 6);
+    qToBigEndian<quint16>(m_options.rectWidth, data + 8);
+    qToBigEndian<quint16>(m_options.rectHeight, data + 10);
+    qToBigEndian<qint32>(0, data + 12);
+
+    memcpy(data + 16, m_pixels.constData() + (qsizetype(client->offset) * 4 * 7) % size, size);
+    const qint64 sent = now();
+    memcpy(data + 16, &sent, sizeof(sent));
+    ++client->offset;
+
+    client->sock->write(update);
+}
@@ -0,0 +1,50 @@
+#ifndef FAKERFBSERVER_H
+#define FAKERFBSERVER_H
+
+#include <QTcpServer>
+
+class QTcpSocket;
+class QTimer;
+
+// Stand-in for a VNC server: None auth, 32bpp true colour and one Raw
+// rectangle per FramebufferUpdateRequest. The first 8 pixel bytes of
+// every update carry the steady clock time it was sent at, in ns.
+class FakeRfbServer : public QTcpServer
+{
+    Q_OBJECT
+public:
+    struct Options {
+        quint16 width      = 1024;
+        quint16 height     = 768;
+        quint16 rectWidth  = 256;
+        quint16 rectHeight = 256;
+        // Updates per second per client, 0 answers requests at once
+        int fps            = 0;
+    };
+
+    explicit FakeRfbServer(const Options &options, QObject *parent = nullptr);
+
+    static qint64 now();
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    struct Client {
+        QTcpSocket *sock = nullptr;
+        QTimer *pace     = nullptr;
+        QByteArray buf;
+        int state        = 0;
+        int offset       = 0;
+        bool requested   = false;
+    };
+
+    void readClient(Client *client);
+    bool parseMessage(Client *client);
+    void sendUpdate(Client *client);
+
+    Options m_options;
+    QByteArray m_pixels;
+};
+
+#endif // FAKERFBSERVER_H
@@ -0,0 +1,347 @@
+#include "benchclient.h"
+#include "fakerfbserver.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QNetworkAccessManager>
+#include <QNetworkCookie>
+#include <QNetworkCookieJar>
+#include <QNetworkReply>
+#include <QSysInfo>
+#include <QTimer>
+#include <QUrlQuery>
+
+#include <libvirt/libvirt.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+
+namespace {
+
+struct ProcessSample {
+    double cpuSeconds = 0;
+    qint64 rssKiB     = 0;
+    qint64 hwmKiB     = 0;
+    bool valid        = false;
+};
+
+// CPU time and memory of the Virtlyst process from procfs
+ProcessSample sampleProcess(qint64 pid)
+{
+    ProcessSample ret;
+    if (pid <= 0) {
+        return ret;
+    }
+
+    QFile stat(QStringLiteral("/proc/%1/stat").arg(pid));
+    if (!stat.open(QIODevice::ReadOnly)) {
+        return ret;
+    }
+    // Fields after the command name, utime and stime are 14 and 15
+    const QByteArray line          = stat.readAll();
+    const QList<QByteArray> fields = line.mid(line.lastIndexOf(')') + 2).split(' ');
+    if (fields.size() < 13) {
+        return ret;
+    }
+    const qint64 ticks = fields[11].toLongLong() + fields[12].toLongLong();
+    ret.cpuSeconds     = double(ticks) / sysconf(_SC_CLK_TCK);
+
+    QFile status(QStringLiteral("/proc/%1/status").arg(pid));
+    if (status.open(QIODevice::ReadOnly)) {
+        const QList<QByteArray> lines = status.readAll().split('\n');
+        for (const QByteArray &line : lines) {
+            if (line.startsWith("VmRSS:")) {
+                ret.rssKiB = line.mid(6).trimmed().split(' ').value(0).toLongLong();
+            } else if (line.startsWith("VmHWM:")) {
+                ret.hwmKiB = line.mid(6).trimmed().split(' ').value(0).toLongLong();
+            }
+        }
+    }
+    ret.valid = true;
+    return ret;
+}
+
+QString libvirtArch()
+{
+    const QString arch = QSysInfo::currentCpuArchitecture();
+    if (arch == u"arm64") {
+        return QStringLiteral("aarch64");
+    }
+    return arch;
+}
+
+// Never started, Virtlyst only reads the graphics port from its XML
+QByteArray domainXml(const QString &name, quint16 port)
+{
+    return QStringLiteral(R"(<domain type='qemu'>
+  <name>%1</name>
+  <memory unit='MiB'>64</memory>
+  <os><type arch='%2'>hvm</type></os>
+  <devices>
+    <graphics type='vnc' port='%3' autoport='no' listen='127.0.0.1'/>
+  </devices>
+</domain>)")
+        .arg(name, libvirtArch())
+        .arg(port)
+        .toUtf8();
+}
+
+double percentile(const QVector<qint64> &sorted, double p)
+{
+    if (sorted.isEmpty()) {
+        return 0;
+    }
+    const qsizetype index = qMin(sorted.size() - 1, qsizetype(p * sorted.size()));
+    return sorted[index] / 1000.0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName(QStringLiteral("virtlyst-console-bench"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        QStringLiteral("Measures the Virtlyst console relay against a local RFB stand-in"));
+    parser.addHelpOption();
+    const QCommandLineOption urlOpt(QStringLiteral("url"),
+                                    QStringLiteral("Virtlyst base URL"),
+                                    QStringLiteral("url"),
+                                    QStringLiteral("http://localhost:3000"));
+    const QCommandLineOption userOpt(QStringLiteral("user"),
+                                     QStringLiteral("Login"),
+                                     QStringLiteral("name"),
+                                     QStringLiteral("admin"));
+    const QCommandLineOption passwordOpt(QStringLiteral("password"),
+                                         QStringLiteral("Password"),
+                                         QStringLiteral("password"),
+                                         QStringLiteral("admin"));
+    const QCommandLineOption hostIdOpt(QStringLiteral("host-id"),
+                                       QStringLiteral("Virtlyst server id of the libvirt URI"),
+                                       QStringLiteral("id"),
+                                       QStringLiteral("1"));
+    const QCommandLineOption libvirtOpt(QStringLiteral("libvirt"),
+                                        QStringLiteral("URI the bench domains are defined on"),
+                                        QStringLiteral("uri"),
+                                        QStringLiteral("qemu:///system"));
+    const QCommandLineOption sessionsOpt(QStringLiteral("sessions"),
+                                         QStringLiteral("Concurrent console sessions"),
+                                         QStringLiteral("n"),
+                                         QStringLiteral("1"));
+    const QCommandLineOption durationOpt(QStringLiteral("duration"),
+                                         QStringLiteral("Measured seconds"),
+                                         QStringLiteral("s"),
+                                         QStringLiteral("10"));
+    const QCommandLineOption rectOpt(QStringLiteral("rect"),
+                                     QStringLiteral("Size of each update"),
+                                     QStringLiteral("WxH"),
+                                     QStringLiteral("256x256"));
+    const QCommandLineOption fpsOpt(QStringLiteral("fps"),
+                                    QStringLiteral("Updates per second per session, 0 unpaced"),
+                                    QStringLiteral("n"),
+                                    QStringLiteral("0"));
+    const QCommandLineOption sharedOpt(
+        QStringLiteral("shared"), QStringLiteral("All sessions open the same console"));
+    const QCommandLineOption deflateOpt(QStringLiteral("deflate"),
+                                        QStringLiteral("Offer the binary.deflate subprotocol"));
+    const QCommandLineOption pidOpt(QStringLiteral("pid"),
+                                    QStringLiteral("Virtlyst process for CPU and memory figures"),
+                                    QStringLiteral("pid"));
+    parser.addOptions({urlOpt,
+                       userOpt,
+                       passwordOpt,
+                       hostIdOpt,
+                       libvirtOpt,
+                       sessionsOpt,
+                       durationOpt,
+                       rectOpt,
+                       fpsOpt,
+                       sharedOpt,
+                       deflateOpt,
+                       pidOpt});
+    parser.process(app);
+
+    const QUrl baseUrl     = QUrl(parser.value(urlOpt));
+    const int sessionCount = qMax(1, parser.value(sessionsOpt).toInt());
+    const int duration     = qMax(1, parser.value(durationOpt).toInt());
+    const qint64 pid       = parser.value(pidOpt).toLongLong();
+    const QStringList rect = parser.value(rectOpt).split(u'x');
+
+    FakeRfbServer::Options rfb;
+    rfb.rectWidth  = quint16(rect.value(0).toUInt());
+    rfb.rectHeight = quint16(rect.value(1).toUInt());
+    rfb.fps        = parser.value(fpsOpt).toInt();
+    if (rfb.rectWidth == 0 || rfb.rectHeight == 0) {
+        fprintf(stderr, "Invalid --rect\n");
+        return 1;
+    }
+
+    virConnectPtr conn = virConnectOpen(parser.value(libvirtOpt).toUtf8().constData());
+    if (!conn) {
+        fprintf(stderr, "Cannot connect to libvirt\n");
+        return 1;
+    }
+
+    // One stand-in server and inactive domain per console
+    QVector<virDomainPtr> domains;
+    QStringList uuids;
+    const int consoles = parser.isSet(sharedOpt) ? 1 : sessionCount;
+    for (int i = 0; i < consoles; ++i) {
+        auto server = new FakeRfbServer(rfb, &app);
+        if (!server->listen(QHostAddress::LocalHost)) {
+            fprintf(stderr, "Cannot listen: %s\n", qPrintable(server->errorString()));
+            break;
+        }
+
+        const QString name =
+            QStringLiteral("virtlyst-bench-%1-%2").arg(QCoreApplication::applicationPid()).arg(i);
+        virDomainPtr dom =
+            virDomainDefineXML(conn, domainXml(name, server->serverPort()).constData());
+        if (!dom) {
+            fprintf(stderr, "Cannot define %s\n", qPrintable(name));
+            break;
+        }
+        domains.append(dom);
+
+        char uuid[VIR_UUID_STRING_BUFLEN];
+        virDomainGetUUIDString(dom, uuid);
+        uuids.append(QString::fromLatin1(uuid));
+    }
+
+    auto cleanup = [&] {
+        for (virDomainPtr dom : std::as_const(domains)) {
+            virDomainUndefine(dom);
+            virDomainFree(dom);
+        }
+        virConnectClose(conn);
+    };
+    if (uuids.size() != consoles) {
+        cleanup();
+        return 1;
+    }
+
+    // Log in for the session cookie
+    QNetworkAccessManager nam;
+    QUrlQuery form;
+    form.addQueryItem(QStringLiteral("username"), parser.value(userOpt));
+    form.addQueryItem(QStringLiteral("password"), parser.value(passwordOpt));
+    QNetworkRequest loginRequest(baseUrl.resolved(QUrl(QStringLiteral("login"))));
+    loginRequest.setHeader(QNetworkRequest::ContentTypeHeader,
+                           QStringLiteral("application/x-www-form-urlencoded"));
+    loginRequest.setAttribute(QNetworkRequest::RedirectPolicyAttribute,
+                              QNetworkRequest::ManualRedirectPolicy);
+    QNetworkReply *login = nam.post(loginRequest, form.query(QUrl::FullyEncoded).toLatin1());
+    QObject::connect(login, &QNetworkReply::finished, &app, [&] { app.exit(); });
+    app.exec();
+    login->deleteLater();
+    if (login->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 302) {
+        fprintf(stderr, "Login failed: %s\n", qPrintable(login->errorString()));
+        cleanup();
+        return 1;
+    }
+
+    QByteArray cookies;
+    const QList<QNetworkCookie> jar = nam.cookieJar()->cookiesForUrl(baseUrl);
+    for (const QNetworkCookie &cookie : jar) {
+        cookies += cookie.toRawForm(QNetworkCookie::NameAndValueOnly) + "; ";
+    }
+
+    QVector<BenchClient *> clients;
+    int live   = 0;
+    int failed = 0;
+    QTimer run;
+    run.setSingleShot(true);
+    QTimer sampler;
+    ProcessSample first;
+    qint64 peakRss = 0;
+
+    auto startRun = [&] {
+        if (live + failed < sessionCount || run.isActive()) {
+            return;
+        }
+        if (live == 0) {
+            app.exit(1);
+            return;
+        }
+        // Counting starts once every session is past its handshake
+        for (BenchClient *client : std::as_const(clients)) {
+            client->reset();
+        }
+        first = sampleProcess(pid);
+        sampler.start(250);
+        run.start(duration * 1000);
+    };
+
+    for (int i = 0; i < sessionCount; ++i) {
+        QUrl url = baseUrl.resolved(QUrl(
+            QStringLiteral("ws/%1/%2").arg(parser.value(hostIdOpt), uuids[i % consoles])));
+        url.setScheme(baseUrl.scheme() == u"https" ? QStringLiteral("wss") : QStringLiteral("ws"));
+        QNetworkRequest request(url);
+        request.setRawHeader("Cookie", cookies);
+
+        auto client = new BenchClient(request, parser.isSet(deflateOpt), &app);
+        QObject::connect(client, &BenchClient::live, &app, [&] {
+            ++live;
+            startRun();
+        });
+        QObject::connect(client, &BenchClient::failed, &app, [&](const QString &error) {
+            fprintf(stderr, "Session failed: %s\n", qPrintable(error));
+            ++failed;
+            startRun();
+        });
+        clients.append(client);
+        client->start();
+    }
+
+    QObject::connect(&sampler, &QTimer::timeout, &app, [&] {
+        peakRss = qMax(peakRss, sampleProcess(pid).rssKiB);
+    });
+    QObject::connect(&run, &QTimer::timeout, &app, [&] { app.exit(0); });
+
+    const int ret = app.exec();
+    sampler.stop();
+    const ProcessSample last = sampleProcess(pid);
+
+    QVector<qint64> latencies;
+    qint64 rfbBytes  = 0;
+    qint64 wireBytes = 0;
+    for (BenchClient *client : std::as_const(clients)) {
+        client->stop();
+        rfbBytes += client->rfbBytes();
+        wireBytes += client->wireBytes();
+        latencies.append(client->latencies());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    cleanup();
+
+    if (ret != 0) {
+        fprintf(stderr, "No session got past the RFB handshake\n");
+        return ret;
+    }
+
+    const double mb = rfbBytes / 1e6;
+    printf("sessions     %d live, %d failed, %d consoles\n", live, failed, consoles);
+    printf("updates      %lld\n", qint64(latencies.size()));
+    printf("throughput   %.1f MB/s rfb, %.1f MB/s wire\n",
+           mb / duration,
+           wireBytes / 1e6 / duration);
+    printf("latency      p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+           percentile(latencies, 0.50),
+           percentile(latencies, 0.95),
+           percentile(latencies, 0.99),
+           latencies.isEmpty() ? 0.0 : latencies.last() / 1000.0);
+    if (first.valid && last.valid) {
+        const double cpu = last.cpuSeconds - first.cpuSeconds;
+        printf("relay cpu    %.2f s, %.2f ms/MB\n", cpu, mb > 0 ? cpu * 1000 / mb : 0.0);
+        printf("relay memory peak %.1f MiB rss, %.1f MiB hwm\n",
+               qMax(peakRss, last.rssKiB) / 1024.0,
+               last.hwmKiB / 1024.0);
+    } else {
+        printf("relay cpu    n/a, pass --pid\n");
+    }
+    return failed > 0 ? 1 : 0;
+}
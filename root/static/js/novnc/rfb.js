@@ -301,8 +301,8 @@ function connect() {
         uri += rfb_host + ":" + rfb_port + "/" + rfb_path;
     }
     Util.Info("connecting to " + uri);
-    // TODO: make protocols a configurable
-    ws.open(uri, ['binary', 'base64']);
+    // Defaults prefer binary.deflate when jsunzip is loaded
+    ws.open(uri);
 
     Util.Debug("<< RFB.connect");
 }
@@ -52,7 +52,8 @@ function Websock() {
 
 var api = {},         // Public API
     websocket = null, // WebSocket object
-    mode = 'base64',  // Current WebSocket mode: 'binary', 'base64'
+    mode = 'base64',  // Current WebSocket mode: 'binary.deflate', 'binary', 'base64'
+    inflater = null,  // Persistent zlib stream for 'binary.deflate'
     rQ = [],          // Receive queue
     rQi = 0,          // Receive queue index
     rQmax = 10000,    // Max receive queue size before compacting
@@ -159,7 +160,7 @@ function rQwait(msg, num, goback) {
 //
 
 function encode_message() {
-    if (mode === 'binary') {
+    if (mode !== 'base64') {
         // Put in a binary arraybuffer
         return (new Uint8Array(sQ)).buffer;
     } else {
@@ -170,10 +171,27 @@ function encode_message() {
 
 function decode_message(data) {
     //Util.Debug(">> decode_message: " + data);
-    if (mode === 'binary') {
+    var i, u8;
+    if (mode === 'binary.deflate') {
+        // First byte flags a message deflated on the server zlib stream
+        u8 = new Uint8Array(data);
+        if (u8[0] === 1) {
+            var result = inflater.uncompress(u8, 1);
+            if (result.status !== inflater.OK) {
+                throw("Failed to inflate WebSocket message");
+            }
+            for (i = 0; i < result.data.length; i++) {
+                rQ.push(result.data[i]);
+            }
+        } else {
+            for (i = 1; i < u8.length; i++) {
+                rQ.push(u8[i]);
+            }
+        }
+    } else if (mode === 'binary') {
         // push arraybuffer values onto the end
-        var u8 = new Uint8Array(data);
-        for (var i = 0; i < u8.length; i++) {
+        u8 = new Uint8Array(data);
+        for (i = 0; i < u8.length; i++) {
             rQ.push(u8[i]);
         }
     } else {
@@ -292,7 +310,9 @@ function init(protocols) {
 
     // Default protocols if not specified
     if (typeof(protocols) === "undefined") {
-        if (wsbt) {
+        if (wsbt && typeof(TINF) !== "undefined") {
+            protocols = ['binary.deflate', 'binary', 'base64'];
+        } else if (wsbt) {
             protocols = ['binary', 'base64'];
         } else {
             protocols = 'base64';
@@ -307,7 +327,7 @@ function init(protocols) {
         if (typeof(protocols) === "object") {
             var new_protocols = [];
             for (var i = 0; i < protocols.length; i++) {
-                if (protocols[i] === 'binary') {
+                if (protocols[i] === 'binary' || protocols[i] === 'binary.deflate') {
                     Util.Error("Skipping unsupported WebSocket binary sub-protocol");
                 } else {
                     new_protocols.push(protocols[i]);
@@ -331,7 +351,8 @@ function open(uri, protocols) {
         websocket = {};
     } else {
         websocket = new WebSocket(uri, protocols);
-        if (protocols.indexOf('binary') >= 0) {
+        if (protocols.indexOf('binary') >= 0 ||
+            protocols.indexOf('binary.deflate') >= 0) {
             websocket.binaryType = 'arraybuffer';
         }
     }
@@ -341,6 +362,10 @@ function open(uri, protocols) {
         Util.Debug(">> WebSock.onopen");
         if (websocket.protocol) {
             mode = websocket.protocol;
+            if (mode === 'binary.deflate') {
+                inflater = new TINF();
+                inflater.init();
+            }
             Util.Info("Server chose sub-protocol: " + websocket.protocol);
         } else {
             mode = 'base64';
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "clonejob.h"
+
+#include "lib/connection.h"
+#include "lib/domain.h"
+#include "lib/storagepool.h"
+#include "lib/storagevol.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonArray>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QThreadPool>
+
+#include <memory>
+
+Q_LOGGING_CATEGORY(V_CLONE, "virtlyst.clone")
+
+namespace {
+
+struct Job {
+    QUrl url;
+    QString hostName;
+    QString hostId;
+    QString source;
+    QString name;
+    QStringList macs;
+    QVector<CloneJob::Disk> disks;
+    QString error;
+    CloneJob::State state = CloneJob::Running;
+    int perPool           = 1;
+    int pending           = 0;
+    qint64 elapsedMs      = 0;
+    QElapsedTimer timer;
+};
+
+// Shared by all worker threads, finished jobs are kept
+// until the next clone of the same source replaces them
+QMutex jobsMutex;
+QHash<QString, std::shared_ptr<Job>> jobs;
+QHash<QString, int> poolRunning;
+
+QThreadPool *clonePool()
+{
+    static QThreadPool *pool = [] {
+        auto pool = new QThreadPool;
+        // Threads mostly wait for libvirtd to copy
+        pool->setMaxThreadCount(16);
+        return pool;
+    }();
+    return pool;
+}
+
+QString jobKey(const QString &hostId, const QString &name)
+{
+    return hostId + QLatin1Char('/') + name;
+}
+
+void finish(const std::shared_ptr<Job> &job, Connection &conn)
+{
+    QString error;
+    QStringList cloned;
+    QHash<QString, QString> paths;
+    {
+        QMutexLocker locker(&jobsMutex);
+        error = job->error;
+        for (const CloneJob::Disk &disk : std::as_const(job->disks)) {
+            if (disk.state == CloneJob::Done) {
+                paths.insert(disk.dev, disk.path);
+                cloned.append(disk.path);
+            }
+        }
+    }
+
+    if (error.isEmpty()) {
+        Domain *dom = conn.getDomainByName(job->source, &conn);
+        const QString xml = dom ? dom->cloneXml(job->name, job->macs, paths) : QString();
+        if (!dom) {
+            error = QStringLiteral("Domain not found: %1").arg(job->source);
+        } else if (xml.isEmpty()) {
+            error = QStringLiteral("Not every disk of %1 was cloned").arg(job->source);
+        } else if (!conn.domainDefineXml(xml)) {
+            error = conn.lastError();
+        }
+    }
+
+    if (!error.isEmpty()) {
+        // Don't leave orphan volumes behind
+        for (const QString &path : std::as_const(cloned)) {
+            StorageVol *vol = conn.getStorageVolByPath(path, &conn);
+            if (vol) {
+                vol->undefine();
+            }
+        }
+    }
+
+    QMutexLocker locker(&jobsMutex);
+    job->error     = error;
+    job->state     = error.isEmpty() ? CloneJob::Done : CloneJob::Failed;
+    job->elapsedMs = job->timer.elapsed();
+    qCInfo(V_CLONE) << "Clone of" << job->source << "to" << job->name << "finished in"
+                    << job->elapsedMs << "ms" << error;
+}
+
+void schedule();
+
+void cloneDisk(const std::shared_ptr<Job> &job, int index)
+{
+    CloneJob::Disk disk;
+    {
+        QMutexLocker locker(&jobsMutex);
+        disk = job->disks.at(index);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QString path;
+    QString error;
+    Connection conn(job->url, job->hostName);
+    if (conn.isAlive()) {
+        StorageVol *vol = conn.getStorageVolByPath(disk.source, &conn);
+        if (vol) {
+            const quint64 total = vol->allocation();
+            {
+                QMutexLocker locker(&jobsMutex);
+                job->disks[index].total = total;
+            }
+
+            StorageVol *cloned = vol->clone(disk.target,
+                                            disk.format,
+                                            disk.metadata ? VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA
+                                                          : 0,
+                                            StorageVol::CloneReflink);
+            if (cloned) {
+                path = cloned->path();
+            } else {
+                error = conn.lastError();
+            }
+        } else {
+            error = QStringLiteral("Volume not found: %1").arg(disk.source);
+        }
+    } else {
+        error = QStringLiteral("Host not available");
+    }
+
+    bool last;
+    {
+        QMutexLocker locker(&jobsMutex);
+        CloneJob::Disk &done = job->disks[index];
+        done.path            = path;
+        done.elapsedMs       = timer.elapsed();
+        done.state           = error.isEmpty() ? CloneJob::Done : CloneJob::Failed;
+        if (!error.isEmpty() && job->error.isEmpty()) {
+            job->error = disk.dev + QLatin1String(": ") + error;
+        }
+
+        --poolRunning[jobKey(job->hostId, disk.pool)];
+        last = --job->pending == 0;
+        schedule();
+    }
+    qCDebug(V_CLONE) << "Cloned" << disk.source << "to" << path << "in" << timer.elapsed() << "ms"
+                     << error;
+
+    if (last) {
+        finish(job, conn);
+    }
+}
+
+// Starts queued disks while their pool has free slots,
+// must be called with jobsMutex locked
+void schedule()
+{
+    for (const std::shared_ptr<Job> &job : std::as_const(jobs)) {
+        for (int i = 0; i < job->disks.size(); ++i) {
+            CloneJob::Disk &disk = job->disks[i];
+            if (disk.state != CloneJob::Queued) {
+                continue;
+            }
+
+            int &running = poolRunning[jobKey(job->hostId, disk.pool)];
+            if (running >= job->perPool) {
+                continue;
+            }
+
+            ++running;
+            disk.state = CloneJob::Running;
+            clonePool()->start([job, i] { cloneDisk(job, i); });
+        }
+    }
+}
+
+} // namespace
+
+bool CloneJob::start(const QUrl &url,
+                     const QString &hostName,
+                     const QString &hostId,
+                     const QString &source,
+                     const QString &name,
+                     const QStringList &macs,
+                     const QVector<Disk> &disks,
+                     int perPool,
+                     QString *error)
+{
+    auto job      = std::make_shared<Job>();
+    job->url      = url;
+    job->hostName = hostName;
+    job->hostId   = hostId;
+    job->source   = source;
+    job->name     = name;
+    job->macs     = macs;
+    job->disks    = disks;
+    job->perPool  = qMax(1, perPool);
+    job->pending  = disks.size();
+    job->timer.start();
+
+    QMutexLocker locker(&jobsMutex);
+    const QString key = jobKey(hostId, source);
+    auto it           = jobs.constFind(key);
+    if (it != jobs.constEnd() && it.value()->state == CloneJob::Running) {
+        *error = QStringLiteral("A clone of this instance is already running");
+        return false;
+    }
+    jobs.insert(key, job);
+
+    if (disks.isEmpty()) {
+        clonePool()->start([job] {
+            Connection conn(job->url, job->hostName);
+            finish(job, conn);
+        });
+    } else {
+        schedule();
+    }
+
+    return true;
+}
+
+QJsonObject CloneJob::progress(const QString &hostId, const QString &source, Connection *conn)
+{
+    std::shared_ptr<Job> job;
+    QVector<Disk> disks;
+    QString error;
+    State state;
+    qint64 elapsedMs;
+    {
+        QMutexLocker locker(&jobsMutex);
+        job = jobs.value(jobKey(hostId, source));
+        if (!job) {
+            return QJsonObject();
+        }
+        disks     = job->disks;
+        error     = job->error;
+        state     = job->state;
+        elapsedMs = state == Running ? job->timer.elapsed() : job->elapsedMs;
+    }
+
+    QJsonArray array;
+    for (const Disk &disk : disks) {
+        int percent = 0;
+        if (disk.state == Done) {
+            percent = 100;
+        } else if (disk.state == Running && disk.total) {
+            // The copy is done by libvirtd, the target
+            // allocation is the best estimate we have
+            StoragePool *pool = conn->getStoragePool(disk.pool, conn);
+            StorageVol *vol   = pool ? pool->getVolume(disk.target) : nullptr;
+            if (vol) {
+                percent = int(qMin<quint64>(99, vol->allocation() * 100 / disk.total));
+            }
+        }
+
+        array.append(QJsonObject{
+            {QStringLiteral("dev"), disk.dev},
+            {QStringLiteral("target"), disk.target},
+            {QStringLiteral("state"), disk.state},
+            {QStringLiteral("percent"), percent},
+            {QStringLiteral("elapsed"), disk.elapsedMs},
+        });
+    }
+
+    return QJsonObject{
+        {QStringLiteral("name"), job->name},
+        {QStringLiteral("state"), state},
+        {QStringLiteral("error"), error},
+        {QStringLiteral("elapsed"), elapsedMs},
+        {QStringLiteral("disks"), array},
+    };
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CLONEJOB_H
+#define CLONEJOB_H
+
+#include <QJsonObject>
+#include <QStringList>
+#include <QUrl>
+#include <QVector>
+
+class Connection;
+class CloneJob
+{
+public:
+    enum State {
+        Queued,
+        Running,
+        Done,
+        Failed,
+    };
+
+    struct Disk {
+        QString dev;
+        QString source;
+        QString pool;
+        QString target;
+        QString format;
+        bool metadata = false;
+
+        // Filled by the job
+        QString path;
+        State state      = Queued;
+        quint64 total    = 0;
+        qint64 elapsedMs = 0;
+    };
+
+    // Clones every disk concurrently, at most perPool at a time on the same
+    // storage pool, and defines the new domain once all of them are done
+    static bool start(const QUrl &url,
+                      const QString &hostName,
+                      const QString &hostId,
+                      const QString &source,
+                      const QString &name,
+                      const QStringList &macs,
+                      const QVector<Disk> &disks,
+                      int perPool,
+                      QString *error);
+
+    static QJsonObject progress(const QString &hostId, const QString &source, Connection *conn);
+};
+
+#endif // CLONEJOB_H
@@ -70,3 +70,32 @@ void Console::index(Context *c, const QString &hostId, const QString &uuid)
     const QString path = QLatin1String("ws/") + hostId + QLatin1Char('/') + uuid;
     c->setStash(QStringLiteral("ws_path"), path);
 }
+
+void Console::serial(Context *c, const QString &hostId, const QString &uuid)
+{
+    c->setStash(QStringLiteral("host_id"), hostId);
+
+    Connection *conn = m_virtlyst->connection(hostId, c);
+    if (conn == nullptr) {
+        qCWarning(V_CONSOLE) << "Host id not found or connection not active";
+        c->response()->redirect(c->uriForAction(QStringLiteral("/index")));
+        return;
+    }
+
+    Domain *dom = conn->getDomainByUuid(uuid, c);
+    if (!dom) {
+        c->setStash(
+            QStringLiteral("errors"),
+            QStringList{
+                QStringLiteral("Domain not found: no domain with matching name '%1'").arg(uuid)});
+        return;
+    }
+
+    const QUrl uri = c->request()->uri();
+    c->setStash(QStringLiteral("template"), QStringLiteral("console-serial.html"));
+    c->setStash(QStringLiteral("domain"), QVariant::fromValue(dom));
+    c->setStash(QStringLiteral("ws_host"), uri.host());
+    c->setStash(QStringLiteral("ws_port"), uri.port(c->request()->secure() ? 443 : 80));
+    const QString path = QLatin1String("ws/serial/") + hostId + QLatin1Char('/') + uuid;
+    c->setStash(QStringLiteral("ws_path"), path);
+}
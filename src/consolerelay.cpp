@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "consolerelay.h"
+
+#include "consoleshaper.h"
+
+#include <QCoreApplication>
+#include <QLocalSocket>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QTcpSocket>
+#include <QThread>
+#include <QVector>
+
+Q_LOGGING_CATEGORY(V_RELAY, "virtlyst.relay")
+
+namespace {
+
+// Console traffic runs on its own threads so busy
+// consoles don't delay pages on the worker threads
+QMutex poolMutex;
+QVector<QThread *> threads;
+QVector<int> load;
+
+void stopThreads()
+{
+    QMutexLocker locker(&poolMutex);
+    for (QThread *thread : std::as_const(threads)) {
+        thread->quit();
+        thread->wait();
+        delete thread;
+    }
+    threads.clear();
+}
+
+int pickThread(int count)
+{
+    QMutexLocker locker(&poolMutex);
+    if (threads.isEmpty()) {
+        count = qMax(1, count);
+        for (int i = 0; i < count; ++i) {
+            auto thread = new QThread;
+            thread->setObjectName(QStringLiteral("console-relay-%1").arg(i));
+            thread->start();
+            threads.append(thread);
+            load.append(0);
+        }
+        qAddPostRoutine(stopThreads);
+        qCDebug(V_RELAY) << "Started" << count << "console relay threads";
+    }
+
+    int best = 0;
+    for (int i = 1; i < load.size(); ++i) {
+        if (load[i] < load[best]) {
+            best = i;
+        }
+    }
+    ++load[best];
+    return best;
+}
+
+} // namespace
+
+ConsoleRelay *ConsoleRelay::create(int threadCount, qint64 chunkSize)
+{
+    const int index = pickThread(threadCount);
+
+    auto relay = new ConsoleRelay(index, chunkSize);
+    QMutexLocker locker(&poolMutex);
+    relay->moveToThread(threads.at(index));
+    return relay;
+}
+
+ConsoleRelay::ConsoleRelay(int threadIndex, qint64 chunkSize)
+    : m_chunkSize(chunkSize)
+    , m_threadIndex(threadIndex)
+{
+    if (ConsoleShaper::enabled()) {
+        m_flow = ConsoleShaper::add(this);
+    }
+}
+
+ConsoleRelay::~ConsoleRelay()
+{
+    if (m_flow) {
+        ConsoleShaper::remove(m_flow);
+    }
+
+    QMutexLocker locker(&poolMutex);
+    --load[m_threadIndex];
+}
+
+int ConsoleRelay::threadIndex() const
+{
+    return m_threadIndex;
+}
+
+void ConsoleRelay::open(const QString &host, quint16 port)
+{
+    QMetaObject::invokeMethod(this, [this, host, port] { doOpen(host, port); });
+}
+
+void ConsoleRelay::openFd(int fd)
+{
+    QMetaObject::invokeMethod(this, [this, fd] { doOpenFd(fd); });
+}
+
+void ConsoleRelay::write(const QByteArray &data)
+{
+    upstreamQueued += data.size();
+    QMetaObject::invokeMethod(this, [this, data] { doWrite(data); });
+}
+
+void ConsoleRelay::setPaused(bool paused)
+{
+    QMetaObject::invokeMethod(this, [this, paused] { doSetPaused(paused); });
+}
+
+void ConsoleRelay::close()
+{
+    QMetaObject::invokeMethod(this, [this] { doClose(); });
+}
+
+void ConsoleRelay::wake()
+{
+    QMetaObject::invokeMethod(this, [this] {
+        if (m_sock) {
+            readUpstream();
+        }
+    });
+}
+
+void ConsoleRelay::doOpen(const QString &host, quint16 port)
+{
+    auto sock = new QTcpSocket(this);
+    // Once the read buffer is full Qt stops reading the socket,
+    // so a paused relay pushes back on the console server
+    sock->setReadBufferSize(m_chunkSize);
+
+    connect(sock, &QTcpSocket::connected, this, &ConsoleRelay::connected);
+    connect(sock, &QTcpSocket::errorOccurred, this, [this, sock] {
+        qCWarning(V_RELAY) << "Console Proxy error:" << sock->error() << sock->errorString();
+        doClose();
+    });
+    connect(sock, &QTcpSocket::disconnected, this, &ConsoleRelay::doClose);
+    setDevice(sock);
+
+    sock->connectToHost(host, port);
+}
+
+void ConsoleRelay::doOpenFd(int fd)
+{
+    // QLocalSocket works on any connected stream socket, not only named ones
+    auto sock = new QLocalSocket(this);
+    sock->setReadBufferSize(m_chunkSize);
+
+    connect(sock, &QLocalSocket::errorOccurred, this, [this, sock] {
+        qCWarning(V_RELAY) << "Console Proxy error:" << sock->error() << sock->errorString();
+        doClose();
+    });
+    connect(sock, &QLocalSocket::disconnected, this, &ConsoleRelay::doClose);
+    setDevice(sock);
+
+    if (!sock->setSocketDescriptor(fd)) {
+        qCWarning(V_RELAY) << "Console Proxy cannot use fd" << fd << sock->errorString();
+        doClose();
+        return;
+    }
+    Q_EMIT connected();
+}
+
+void ConsoleRelay::setDevice(QIODevice *sock)
+{
+    m_sock = sock;
+    connect(m_sock, &QIODevice::readyRead, this, &ConsoleRelay::readUpstream);
+    connect(m_sock, &QIODevice::bytesWritten, this, [this](qint64 bytes) {
+        upstreamQueued -= bytes;
+    });
+}
+
+void ConsoleRelay::doWrite(const QByteArray &data)
+{
+    if (!m_sock || m_closed) {
+        upstreamQueued -= data.size();
+        return;
+    }
+    m_sock->write(data);
+}
+
+void ConsoleRelay::doSetPaused(bool paused)
+{
+    m_paused = paused;
+    if (!m_paused && m_sock) {
+        // readyRead isn't emitted again for data already buffered
+        readUpstream();
+    }
+}
+
+void ConsoleRelay::doClose()
+{
+    if (m_closed) {
+        return;
+    }
+    m_closed = true;
+
+    QString reason;
+    if (m_sock) {
+        reason = m_sock->errorString();
+        if (auto tcp = qobject_cast<QTcpSocket *>(m_sock)) {
+            tcp->abort();
+        } else if (auto local = qobject_cast<QLocalSocket *>(m_sock)) {
+            local->abort();
+        }
+    }
+    Q_EMIT closed(reason);
+}
+
+void ConsoleRelay::readUpstream()
+{
+    // Coalesce reads into large chunks, each chunk costs
+    // one WebSocket message on the session thread
+    while (!m_paused && !m_closed && m_sock->bytesAvailable() > 0) {
+        qint64 size = qMin(m_chunkSize, m_sock->bytesAvailable());
+        if (m_flow) {
+            // Unread data stays in the socket, pushing back on the console
+            size = ConsoleShaper::acquire(m_flow, size);
+            if (size == 0) {
+                return;
+            }
+        }
+        Q_EMIT data(m_sock->read(size));
+    }
+}
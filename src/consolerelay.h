@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CONSOLERELAY_H
+#define CONSOLERELAY_H
+
+#include <QObject>
+
+#include <atomic>
+
+class QIODevice;
+class ConsoleRelay : public QObject
+{
+    Q_OBJECT
+public:
+    // Creates a relay living in the least loaded relay thread,
+    // the pool is started with the first call
+    static ConsoleRelay *create(int threadCount, qint64 chunkSize);
+
+    ~ConsoleRelay() override;
+
+    int threadIndex() const;
+
+    // Thread safe, these are queued to the relay thread
+    void open(const QString &host, quint16 port);
+    // Takes ownership of an already connected stream socket
+    void openFd(int fd);
+    void write(const QByteArray &data);
+    void setPaused(bool paused);
+    void close();
+    // Used by the shaper once the relay has credit again
+    void wake();
+
+    // Bytes waiting to be written to the console
+    std::atomic<qint64> upstreamQueued{0};
+
+Q_SIGNALS:
+    void connected();
+    void data(const QByteArray &data);
+    void closed(const QString &reason);
+
+private:
+    ConsoleRelay(int threadIndex, qint64 chunkSize);
+
+    void doOpen(const QString &host, quint16 port);
+    void doOpenFd(int fd);
+    void setDevice(QIODevice *sock);
+    void doWrite(const QByteArray &data);
+    void doSetPaused(bool paused);
+    void doClose();
+    void readUpstream();
+
+    QIODevice *m_sock = nullptr;
+    qint64 m_chunkSize;
+    quint64 m_flow = 0;
+    int m_threadIndex;
+    bool m_paused = false;
+    bool m_closed = false;
+};
+
+#endif // CONSOLERELAY_H
@@ -0,0 +1,521 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "consolesession.h"
+
+#include "consolerelay.h"
+#include "rfbbroker.h"
+
+#include <Cutelyst/Context>
+#include <Cutelyst/Request>
+
+#include <QHash>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QTimer>
+#include <QtEndian>
+
+Q_LOGGING_CATEGORY(V_CONSOLE_SESSION, "virtlyst.console.session")
+
+using namespace Cutelyst;
+
+struct HostTotals {
+    QString name;
+    QHash<QString, qint64> closes;
+    qint64 sessions     = 0;
+    qint64 active       = 0;
+    qint64 sent         = 0;
+    qint64 received     = 0;
+    qint64 framesOut    = 0;
+    qint64 framesIn     = 0;
+    qint64 connects     = 0;
+    qint64 connectMs    = 0;
+    qint64 connectMsMax = 0;
+    qint64 tunnels      = 0;
+    qint64 tunnelMs     = 0;
+    qint64 tunnelMsMax  = 0;
+    qint64 inFlightPeak = 0;
+    qint64 upstreamPeak = 0;
+
+    QJsonObject toJson() const
+    {
+        QJsonObject closed;
+        for (auto it = closes.cbegin(); it != closes.cend(); ++it) {
+            closed.insert(it.key(), it.value());
+        }
+
+        return {
+            {QStringLiteral("name"), name},
+            {QStringLiteral("sessions"), sessions},
+            {QStringLiteral("active"), active},
+            {QStringLiteral("sent"), sent},
+            {QStringLiteral("received"), received},
+            {QStringLiteral("frames_out"), framesOut},
+            {QStringLiteral("frames_in"), framesIn},
+            {QStringLiteral("connect_ms_avg"), connects ? connectMs / connects : 0},
+            {QStringLiteral("connect_ms_max"), connectMsMax},
+            {QStringLiteral("tunnel_ms_avg"), tunnels ? tunnelMs / tunnels : 0},
+            {QStringLiteral("tunnel_ms_max"), tunnelMsMax},
+            {QStringLiteral("in_flight_peak"), inFlightPeak},
+            {QStringLiteral("upstream_peak"), upstreamPeak},
+            {QStringLiteral("closed"), closed},
+        };
+    }
+};
+
+namespace {
+
+struct Viewer {
+    QString hostId;
+    QString hostName;
+    QString label;
+    QElapsedTimer age;
+    const ConsoleSession::ViewerCounters *counters;
+
+    void addTo(HostTotals &totals) const
+    {
+        totals.name = hostName;
+        ++totals.sessions;
+        totals.sent += counters->sent;
+        totals.received += counters->received;
+        totals.framesOut += counters->framesOut;
+        totals.framesIn += counters->framesIn;
+    }
+};
+
+// Sessions of all worker threads, for the stats endpoint
+QMutex sessionsMutex;
+QHash<quint64, ConsoleSession *> registry;
+QHash<quint64, Viewer> viewers;
+QHash<QString, HostTotals> hostTotals;
+quint64 lastId = 0;
+
+} // namespace
+
+ConsoleSession::ConsoleSession(Context *c,
+                               const QString &hostId,
+                               const QString &hostName,
+                               const QString &label,
+                               const Limits &limits,
+                               const QString &shareKey)
+    : QObject(c)
+    , m_c(c)
+    , m_relay(ConsoleRelay::create(limits.relayThreads, limits.chunkSize))
+    , m_ackTimer(new QTimer(this))
+    , m_rateTimer(new QTimer(this))
+    , m_hostId(hostId)
+    , m_hostName(hostName)
+    , m_label(label)
+    , m_limits(limits)
+{
+    m_age.start();
+    m_nextAck = m_limits.ackInterval;
+    if (m_limits.deflate) {
+        m_deflate = std::make_unique<WsDeflate>(m_limits.deflateOptions);
+    }
+
+    if (!shareKey.isEmpty()) {
+        m_broker = RfbBroker::create(shareKey, this);
+        if (m_broker) {
+            connect(m_broker, &RfbBroker::inject, this, [this](const QByteArray &data) {
+                m_relay->write(data);
+            });
+        } else {
+            qCDebug(V_CONSOLE_SESSION) << "Console already shared by another session" << shareKey;
+        }
+    }
+
+    {
+        QMutexLocker locker(&sessionsMutex);
+        m_id = ++lastId;
+        registry.insert(m_id, this);
+    }
+
+    m_ackTimer->setSingleShot(true);
+    m_ackTimer->setInterval(m_limits.ackTimeoutMs);
+    connect(m_ackTimer, &QTimer::timeout, this, &ConsoleSession::ackTimeout);
+
+    m_rateTimer->setInterval(1000);
+    connect(m_rateTimer, &QTimer::timeout, this, &ConsoleSession::sampleRates);
+    m_rateTimer->start();
+
+    // The relay reads the console on its own thread, the
+    // WebSocket must be written from the Context thread
+    connect(m_relay, &ConsoleRelay::data, this, &ConsoleSession::upstreamData);
+    connect(m_relay, &ConsoleRelay::closed, this, &ConsoleSession::upstreamClosed);
+    connect(m_relay, &ConsoleRelay::connected, this, [this] {
+        qCDebug(V_CONSOLE_SESSION) << "Console Proxy socket connected" << m_label;
+        m_connected   = true;
+        m_connectTime = m_connectTimer.elapsed();
+        if (!m_preconnect.isEmpty()) {
+            m_relay->write(m_preconnect);
+            m_preconnect.clear();
+            m_preconnectQueued = 0;
+        }
+    });
+    connect(c->request(), &Request::webSocketBinaryFrame, this, &ConsoleSession::clientFrame);
+    connect(c->request(), &Request::webSocketPong, this, &ConsoleSession::pong);
+    connect(c->request(), &Request::webSocketClosed, this, [this] {
+        if (!m_closed) {
+            m_closed = true;
+            m_cause  = CloseCause::Client;
+        }
+        m_relay->close();
+    });
+}
+
+ConsoleSession::~ConsoleSession()
+{
+    m_relay->close();
+    m_relay->deleteLater();
+
+    QMutexLocker locker(&sessionsMutex);
+    registry.remove(m_id);
+
+    HostTotals &totals = hostTotals[m_hostId];
+    addTo(totals);
+    ++totals.closes[causeName(m_cause)];
+}
+
+void ConsoleSession::open(const QString &host, quint16 port)
+{
+    if (m_closed) {
+        return;
+    }
+    qCDebug(V_CONSOLE_SESSION) << "Connecting TCP socket to" << host << port;
+    m_connectTimer.start();
+    m_relay->open(host, port);
+}
+
+void ConsoleSession::openFd(int fd)
+{
+    // The relay owns the fd from now on, even if we are closed
+    qCDebug(V_CONSOLE_SESSION) << "Connecting to graphics fd" << fd;
+    m_connectTimer.start();
+    m_relay->openFd(fd);
+}
+
+void ConsoleSession::fail(const QString &reason)
+{
+    qCWarning(V_CONSOLE_SESSION) << "Console Proxy cannot connect" << m_label << reason;
+    close(Response::CloseCodeAbnormalDisconnection, reason, CloseCause::Setup);
+}
+
+void ConsoleSession::setTunnelTime(qint64 msecs)
+{
+    m_tunnelTime = msecs;
+}
+
+quint64 ConsoleSession::registerViewer(const QString &hostId,
+                                       const QString &hostName,
+                                       const QString &label,
+                                       const ViewerCounters *counters)
+{
+    Viewer viewer{hostId, hostName, label, {}, counters};
+    viewer.age.start();
+
+    QMutexLocker locker(&sessionsMutex);
+    viewers.insert(++lastId, viewer);
+    return lastId;
+}
+
+void ConsoleSession::unregisterViewer(quint64 id, CloseCause cause)
+{
+    QMutexLocker locker(&sessionsMutex);
+    auto it = viewers.find(id);
+    if (it == viewers.end()) {
+        return;
+    }
+
+    HostTotals &totals = hostTotals[it->hostId];
+    it->addTo(totals);
+    ++totals.closes[causeName(cause)];
+    viewers.erase(it);
+}
+
+QJsonArray ConsoleSession::sessions()
+{
+    QJsonArray ret;
+
+    QMutexLocker locker(&sessionsMutex);
+    for (ConsoleSession *session : std::as_const(registry)) {
+        const qint64 sent  = session->m_sent;
+        const qint64 acked = session->m_acked;
+        ret.append(QJsonObject{
+            {QStringLiteral("id"), qint64(session->m_id)},
+            {QStringLiteral("host"), session->m_hostId},
+            {QStringLiteral("label"), session->m_label},
+            {QStringLiteral("age"), session->m_age.elapsed()},
+            {QStringLiteral("sent"), sent},
+            {QStringLiteral("acked"), acked},
+            {QStringLiteral("in_flight"), sent - acked},
+            {QStringLiteral("wire"), qint64(session->m_wire)},
+            {QStringLiteral("deflate"), session->m_limits.deflate},
+            {QStringLiteral("received"), qint64(session->m_received)},
+            {QStringLiteral("rate_down"), qint64(session->m_rateDown)},
+            {QStringLiteral("rate_up"), qint64(session->m_rateUp)},
+            {QStringLiteral("frames_out"), qint64(session->m_framesOut)},
+            {QStringLiteral("frames_in"), qint64(session->m_framesIn)},
+            {QStringLiteral("connect_ms"), qint64(session->m_connectTime)},
+            {QStringLiteral("tunnel_ms"), qint64(session->m_tunnelTime)},
+            {QStringLiteral("in_flight_peak"), qint64(session->m_inFlightPeak)},
+            {QStringLiteral("upstream_peak"), qint64(session->m_upstreamPeak)},
+            {QStringLiteral("upstream_queued"), qint64(session->m_relay->upstreamQueued)},
+            {QStringLiteral("preconnect_queued"), qint64(session->m_preconnectQueued)},
+            {QStringLiteral("pauses"), int(session->m_pauses)},
+            {QStringLiteral("stalled"), bool(session->m_stalled)},
+            {QStringLiteral("relay_thread"), session->m_relay->threadIndex()},
+            {QStringLiteral("viewers"), session->m_broker ? session->m_broker->viewers() : 0},
+        });
+    }
+
+    // Viewers only relay the owner's console, no flow control or upstream
+    for (auto it = viewers.cbegin(); it != viewers.cend(); ++it) {
+        ret.append(QJsonObject{
+            {QStringLiteral("id"), qint64(it.key())},
+            {QStringLiteral("host"), it->hostId},
+            {QStringLiteral("label"), it->label},
+            {QStringLiteral("age"), it->age.elapsed()},
+            {QStringLiteral("sent"), qint64(it->counters->sent)},
+            {QStringLiteral("wire"), qint64(it->counters->wire)},
+            {QStringLiteral("received"), qint64(it->counters->received)},
+            {QStringLiteral("frames_out"), qint64(it->counters->framesOut)},
+            {QStringLiteral("frames_in"), qint64(it->counters->framesIn)},
+            {QStringLiteral("viewer"), true},
+        });
+    }
+
+    return ret;
+}
+
+QJsonObject ConsoleSession::hosts()
+{
+    QMutexLocker locker(&sessionsMutex);
+    QHash<QString, HostTotals> totals = hostTotals;
+    for (ConsoleSession *session : std::as_const(registry)) {
+        HostTotals &host = totals[session->m_hostId];
+        session->addTo(host);
+        ++host.active;
+    }
+    for (const Viewer &viewer : std::as_const(viewers)) {
+        HostTotals &host = totals[viewer.hostId];
+        viewer.addTo(host);
+        ++host.active;
+    }
+
+    QJsonObject ret;
+    for (auto it = totals.cbegin(); it != totals.cend(); ++it) {
+        ret.insert(it.key(), it->toJson());
+    }
+    return ret;
+}
+
+void ConsoleSession::upstreamData(const QByteArray &data)
+{
+    if (m_closed) {
+        return;
+    }
+
+    // Flow control counts console bytes, compressed or not
+    const QByteArray message = m_deflate ? m_deflate->encode(data) : data;
+    m_c->response()->webSocketBinaryMessage(message);
+    m_sent += data.size();
+    m_wire += message.size();
+    ++m_framesOut;
+    m_inFlightPeak = qMax<qint64>(m_inFlightPeak, m_sent - m_acked);
+
+    if (m_broker) {
+        m_broker->fromServer(data);
+    }
+
+    if (!m_flowControl) {
+        return;
+    }
+
+    if (!m_paused && m_sent - m_acked >= m_limits.highWatermark) {
+        m_paused  = true;
+        m_stalled = true;
+        ++m_pauses;
+        m_relay->setPaused(true);
+        requestAck();
+        m_ackTimer->start();
+        qCDebug(V_CONSOLE_SESSION)
+            << "Console Proxy paused" << m_label << "in flight" << m_sent - m_acked;
+    } else if (m_sent >= m_nextAck) {
+        requestAck();
+    }
+}
+
+void ConsoleSession::upstreamClosed(const QString &reason)
+{
+    qCWarning(V_CONSOLE_SESSION) << "Console Proxy socket disconnected" << m_label << reason;
+    close(Response::CloseCodeAbnormalDisconnection,
+          reason,
+          m_connected ? CloseCause::Upstream : CloseCause::Connect);
+}
+
+void ConsoleSession::clientFrame(const QByteArray &frame)
+{
+    m_received += frame.size();
+    ++m_framesIn;
+    const QByteArray message = m_broker ? m_broker->fromClient(frame) : frame;
+
+    if (!m_connected) {
+        if (m_preconnect.size() + message.size() > m_limits.preconnectLimit) {
+            close(Response::CloseCodeTooMuchData,
+                  QStringLiteral("Too much data before the console was connected"),
+                  CloseCause::InputOverflow);
+            return;
+        }
+        m_preconnect.append(message);
+        m_preconnectQueued = m_preconnect.size();
+        m_upstreamPeak     = qMax<qint64>(m_upstreamPeak, m_preconnect.size());
+        return;
+    }
+
+    // The WebSocket can't be paused, so a console that
+    // doesn't read its input ends the session instead
+    const qint64 queued = m_relay->upstreamQueued + message.size();
+    if (queued > m_limits.upstreamLimit) {
+        close(Response::CloseCodeTooMuchData,
+              QStringLiteral("Console is not reading input"),
+              CloseCause::InputOverflow);
+        return;
+    }
+    m_upstreamPeak = qMax<qint64>(m_upstreamPeak, queued);
+
+    m_relay->write(message);
+}
+
+void ConsoleSession::pong(const QByteArray &payload)
+{
+    if (payload.size() != sizeof(qint64)) {
+        return;
+    }
+
+    // Browsers answer pings in order, after the data sent before them
+    const qint64 offset = qFromBigEndian<qint64>(payload.constData());
+    const bool progress = offset > m_acked && offset <= m_sent;
+    if (progress) {
+        m_acked = offset;
+    }
+    m_gotPong = true;
+
+    if (m_paused && m_sent - m_acked <= m_limits.lowWatermark) {
+        m_paused  = false;
+        m_stalled = false;
+        m_ackTimer->stop();
+        m_relay->setPaused(false);
+        qCDebug(V_CONSOLE_SESSION) << "Console Proxy resumed" << m_label;
+    } else if (m_paused && progress) {
+        // A slow client that still drains gets the whole timeout again
+        m_ackTimer->start();
+    }
+}
+
+void ConsoleSession::ackTimeout()
+{
+    if (!m_gotPong) {
+        // Something in between eats our pings, don't stall the session forever
+        qCWarning(V_CONSOLE_SESSION)
+            << "Console Proxy client never answered pings, flow control disabled" << m_label;
+        m_flowControl = false;
+        m_paused      = false;
+        m_stalled     = false;
+        m_relay->setPaused(false);
+        return;
+    }
+
+    qCWarning(V_CONSOLE_SESSION) << "Console Proxy client stopped acknowledging data" << m_label
+                                 << "in flight" << m_sent - m_acked;
+    close(Response::CloseCodeGoingAway, QStringLiteral("Client too slow"), CloseCause::SlowClient);
+}
+
+void ConsoleSession::sampleRates()
+{
+    // Bytes per second, smoothed over the last few seconds
+    const qint64 sent     = m_sent;
+    const qint64 received = m_received;
+    m_rateDown            = (m_rateDown * 3 + sent - m_lastSent) / 4;
+    m_rateUp              = (m_rateUp * 3 + received - m_lastRecv) / 4;
+    m_lastSent            = sent;
+    m_lastRecv            = received;
+}
+
+void ConsoleSession::requestAck()
+{
+    QByteArray payload(sizeof(qint64), Qt::Uninitialized);
+    qToBigEndian<qint64>(m_sent, payload.data());
+    m_c->response()->webSocketPing(payload);
+    m_nextAck = m_sent + m_limits.ackInterval;
+}
+
+void ConsoleSession::close(Response::CloseCode code, const QString &reason, CloseCause cause)
+{
+    if (m_closed) {
+        return;
+    }
+    m_closed = true;
+    m_cause  = cause;
+
+    qCWarning(V_CONSOLE_SESSION) << "Console Proxy closing" << m_label << reason;
+    m_c->response()->webSocketClose(code, reason);
+    m_relay->close();
+}
+
+QString ConsoleSession::causeName(CloseCause cause)
+{
+    switch (cause) {
+    case CloseCause::None:
+        break;
+    case CloseCause::Client:
+        return QStringLiteral("client");
+    case CloseCause::Connect:
+        return QStringLiteral("connect");
+    case CloseCause::Upstream:
+        return QStringLiteral("upstream");
+    case CloseCause::Setup:
+        return QStringLiteral("setup");
+    case CloseCause::SlowClient:
+        return QStringLiteral("slow_client");
+    case CloseCause::InputOverflow:
+        return QStringLiteral("input_overflow");
+    }
+    return QStringLiteral("other");
+}
+
+void ConsoleSession::addTo(HostTotals &totals) const
+{
+    totals.name = m_hostName;
+    ++totals.sessions;
+    totals.sent += m_sent;
+    totals.received += m_received;
+    totals.framesOut += m_framesOut;
+    totals.framesIn += m_framesIn;
+    if (m_connectTime >= 0) {
+        ++totals.connects;
+        totals.connectMs += m_connectTime;
+        totals.connectMsMax = qMax<qint64>(totals.connectMsMax, m_connectTime);
+    }
+    if (m_tunnelTime >= 0) {
+        ++totals.tunnels;
+        totals.tunnelMs += m_tunnelTime;
+        totals.tunnelMsMax = qMax<qint64>(totals.tunnelMsMax, m_tunnelTime);
+    }
+    totals.inFlightPeak = qMax<qint64>(totals.inFlightPeak, m_inFlightPeak);
+    totals.upstreamPeak = qMax<qint64>(totals.upstreamPeak, m_upstreamPeak);
+}
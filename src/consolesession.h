@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CONSOLESESSION_H
+#define CONSOLESESSION_H
+
+#include "wsdeflate.h"
+
+#include <Cutelyst/Response>
+
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QObject>
+
+#include <atomic>
+#include <memory>
+
+namespace Cutelyst {
+class Context;
+}
+
+class ConsoleRelay;
+class RfbBroker;
+struct HostTotals;
+class QTimer;
+class ConsoleSession : public QObject
+{
+    Q_OBJECT
+public:
+    struct Limits {
+        // Bytes sent to the browser but not yet acknowledged
+        qint64 highWatermark   = 1024 * 1024;
+        qint64 lowWatermark    = 256 * 1024;
+        qint64 ackInterval     = 64 * 1024;
+        // Longest wait for an acknowledgement while paused
+        int ackTimeoutMs       = 15000;
+        // Browser input queued before or towards the console
+        qint64 preconnectLimit = 256 * 1024;
+        qint64 upstreamLimit   = 1024 * 1024;
+        // Console sockets are read on these threads
+        int relayThreads       = 2;
+        qint64 chunkSize       = 64 * 1024;
+        // Set when the browser negotiated WsDeflate::Protocol
+        bool deflate           = false;
+        WsDeflate::Options deflateOptions;
+    };
+
+    // A non empty shareKey lets read-only viewers join this RFB console,
+    // counters are aggregated under hostId once the session ends
+    ConsoleSession(Cutelyst::Context *c,
+                   const QString &hostId,
+                   const QString &hostName,
+                   const QString &label,
+                   const Limits &limits,
+                   const QString &shareKey = {});
+    ~ConsoleSession() override;
+
+    // Browser input is buffered until the console is connected
+    void open(const QString &host, quint16 port);
+    void openFd(int fd);
+    void fail(const QString &reason);
+    // Time spent setting up an ssh tunnel before open()
+    void setTunnelTime(qint64 msecs);
+
+    enum class CloseCause {
+        None,
+        Client,
+        Connect,
+        Upstream,
+        Setup,
+        SlowClient,
+        InputOverflow,
+    };
+
+    // Traffic of a read-only viewer of a shared console, written by its thread
+    struct ViewerCounters {
+        std::atomic<qint64> sent{0};
+        std::atomic<qint64> wire{0};
+        std::atomic<qint64> received{0};
+        std::atomic<qint64> framesOut{0};
+        std::atomic<qint64> framesIn{0};
+    };
+
+    // Viewers are listed and counted under their host like the sessions,
+    // counters must stay alive until unregisterViewer()
+    static quint64 registerViewer(const QString &hostId,
+                                  const QString &hostName,
+                                  const QString &label,
+                                  const ViewerCounters *counters);
+    static void unregisterViewer(quint64 id, CloseCause cause);
+
+    static QJsonArray sessions();
+    // Totals per host of ended and live sessions and viewers
+    static QJsonObject hosts();
+
+private:
+
+    void upstreamData(const QByteArray &data);
+    void upstreamClosed(const QString &reason);
+    void clientFrame(const QByteArray &frame);
+    void pong(const QByteArray &payload);
+    void ackTimeout();
+    void sampleRates();
+    void requestAck();
+    void close(Cutelyst::Response::CloseCode code, const QString &reason, CloseCause cause);
+    static QString causeName(CloseCause cause);
+    void addTo(HostTotals &totals) const;
+
+    Cutelyst::Context *m_c;
+    ConsoleRelay *m_relay;
+    RfbBroker *m_broker = nullptr;
+    std::unique_ptr<WsDeflate> m_deflate;
+    QTimer *m_ackTimer;
+    QTimer *m_rateTimer;
+    QByteArray m_preconnect;
+    QString m_hostId;
+    QString m_hostName;
+    QString m_label;
+    Limits m_limits;
+    QElapsedTimer m_age;
+    QElapsedTimer m_connectTimer;
+    quint64 m_id;
+    qint64 m_nextAck   = 0;
+    qint64 m_lastSent  = 0;
+    qint64 m_lastRecv  = 0;
+    bool m_connected   = false;
+    bool m_paused      = false;
+    bool m_flowControl = true;
+    bool m_gotPong     = false;
+    bool m_closed      = false;
+    CloseCause m_cause = CloseCause::None;
+
+    // Read by sessions() from other threads
+    std::atomic<qint64> m_sent{0};
+    std::atomic<qint64> m_acked{0};
+    std::atomic<qint64> m_received{0};
+    std::atomic<qint64> m_wire{0};
+    std::atomic<qint64> m_preconnectQueued{0};
+    std::atomic<qint64> m_rateDown{0};
+    std::atomic<qint64> m_rateUp{0};
+    std::atomic<qint64> m_framesOut{0};
+    std::atomic<qint64> m_framesIn{0};
+    std::atomic<qint64> m_connectTime{-1};
+    std::atomic<qint64> m_tunnelTime{-1};
+    std::atomic<qint64> m_inFlightPeak{0};
+    std::atomic<qint64> m_upstreamPeak{0};
+    std::atomic<int> m_pauses{0};
+    std::atomic<bool> m_stalled{false};
+};
+
+#endif // CONSOLESESSION_H
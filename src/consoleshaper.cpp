@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "consoleshaper.h"
+
+#include "consolerelay.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QThread>
+#include <QTimer>
+
+Q_LOGGING_CATEGORY(V_SHAPER, "virtlyst.shaper")
+
+namespace {
+
+// Credit handed to a waiting session per round
+constexpr qint64 Quantum = 16 * 1024;
+constexpr int TickMs     = 10;
+
+struct Flow {
+    ConsoleRelay *relay = nullptr;
+    double tokens       = 0;
+    qint64 want         = 0;
+    qint64 credit       = 0;
+    qint64 deficit      = 0;
+    bool waiting        = false;
+};
+
+QMutex shaperMutex;
+ConsoleShaper::Limits limits;
+QHash<quint64, Flow> flows;
+// Sessions waiting for credit, in round robin order
+QList<quint64> waiting;
+quint64 lastFlow    = 0;
+double globalTokens = 0;
+QElapsedTimer clock;
+qint64 lastRefill   = 0;
+QThread *tickThread = nullptr;
+
+void refill()
+{
+    const qint64 now = clock.nsecsElapsed();
+    const double dt  = (now - lastRefill) / 1e9;
+    lastRefill       = now;
+
+    if (limits.globalRate) {
+        globalTokens = qMin<double>(limits.globalBurst, globalTokens + limits.globalRate * dt);
+    }
+    if (limits.sessionRate) {
+        for (Flow &flow : flows) {
+            flow.tokens =
+                qMin<double>(limits.sessionBurst, flow.tokens + limits.sessionRate * dt);
+        }
+    }
+}
+
+qint64 available(const Flow &flow, qint64 wanted)
+{
+    qint64 ret = wanted;
+    if (limits.sessionRate) {
+        ret = qMin(ret, qint64(flow.tokens));
+    }
+    if (limits.globalRate) {
+        ret = qMin(ret, qint64(globalTokens));
+    }
+    return qMax<qint64>(0, ret);
+}
+
+void take(Flow &flow, qint64 bytes)
+{
+    flow.tokens -= bytes;
+    globalTokens -= bytes;
+}
+
+// Deficit round robin, a busy session can't take the
+// credit of the others no matter how much it asks for
+void tick()
+{
+    QMutexLocker locker(&shaperMutex);
+    if (waiting.isEmpty()) {
+        return;
+    }
+    refill();
+
+    QList<quint64> granted;
+    bool progress = true;
+    while (progress && !waiting.isEmpty()) {
+        progress = false;
+
+        const QList<quint64> round = std::exchange(waiting, {});
+        for (quint64 id : round) {
+            Flow &flow = flows[id];
+            const qint64 missing = flow.want - flow.credit;
+            flow.deficit         = qMin(flow.deficit + Quantum, qMax(missing, Quantum));
+
+            const qint64 grant = available(flow, qMin(flow.deficit, missing));
+            if (grant > 0) {
+                take(flow, grant);
+                flow.credit += grant;
+                flow.deficit -= grant;
+                progress = true;
+                if (!granted.contains(id)) {
+                    granted.append(id);
+                }
+            }
+
+            if (flow.credit >= flow.want) {
+                flow.waiting = false;
+                flow.deficit = 0;
+            } else {
+                waiting.append(id);
+            }
+        }
+    }
+
+    // Under the mutex, so the relays can't be gone
+    for (quint64 id : std::as_const(granted)) {
+        flows[id].relay->wake();
+    }
+}
+
+void stopTicks()
+{
+    tickThread->quit();
+    tickThread->wait();
+    delete tickThread;
+}
+
+// Started by the first shaped session, a thread started before the
+// fork would not exist in the workers
+void startTicks()
+{
+    if (tickThread || (!limits.sessionRate && !limits.globalRate)) {
+        return;
+    }
+
+    clock.start();
+    lastRefill   = 0;
+    globalTokens = limits.globalBurst;
+
+    tickThread = new QThread;
+    tickThread->setObjectName(QStringLiteral("console-shaper"));
+    auto timer = new QTimer;
+    timer->setInterval(TickMs);
+    timer->moveToThread(tickThread);
+    QObject::connect(timer, &QTimer::timeout, timer, &tick);
+    QObject::connect(tickThread, &QThread::started, timer, qOverload<>(&QTimer::start));
+    QObject::connect(tickThread, &QThread::finished, timer, &QObject::deleteLater);
+    tickThread->start();
+    qAddPostRoutine(stopTicks);
+
+    qCDebug(V_SHAPER) << "Console shaping per session" << limits.sessionRate << "global"
+                      << limits.globalRate << "bytes/s";
+}
+
+} // namespace
+
+void ConsoleShaper::configure(const Limits &newLimits)
+{
+    QMutexLocker locker(&shaperMutex);
+    limits = newLimits;
+    if (limits.sessionRate && limits.sessionBurst <= 0) {
+        limits.sessionBurst = qMax<qint64>(limits.sessionRate / 10, Quantum);
+    }
+    if (limits.globalRate && limits.globalBurst <= 0) {
+        limits.globalBurst = qMax<qint64>(limits.globalRate / 10, Quantum);
+    }
+}
+
+bool ConsoleShaper::enabled()
+{
+    QMutexLocker locker(&shaperMutex);
+    return limits.sessionRate || limits.globalRate;
+}
+
+quint64 ConsoleShaper::add(ConsoleRelay *relay)
+{
+    QMutexLocker locker(&shaperMutex);
+    startTicks();
+
+    Flow flow;
+    flow.relay  = relay;
+    flow.tokens = limits.sessionBurst;
+
+    flows.insert(++lastFlow, flow);
+    return lastFlow;
+}
+
+void ConsoleShaper::remove(quint64 flow)
+{
+    QMutexLocker locker(&shaperMutex);
+    flows.remove(flow);
+    waiting.removeOne(flow);
+}
+
+qint64 ConsoleShaper::acquire(quint64 id, qint64 wanted)
+{
+    QMutexLocker locker(&shaperMutex);
+    auto it = flows.find(id);
+    if (it == flows.end()) {
+        return wanted;
+    }
+
+    if (it->credit > 0) {
+        const qint64 ret = qMin(it->credit, wanted);
+        it->credit -= ret;
+        return ret;
+    }
+
+    // Nobody queued ahead of us, no need to wait for a tick
+    if (!it->waiting && (waiting.isEmpty() || !limits.globalRate)) {
+        refill();
+        const qint64 ret = available(it.value(), wanted);
+        if (ret > 0) {
+            take(it.value(), ret);
+            return ret;
+        }
+    }
+
+    it->want = wanted;
+    if (!it->waiting) {
+        it->waiting = true;
+        waiting.append(id);
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CONSOLESHAPER_H
+#define CONSOLESHAPER_H
+
+#include <QtGlobal>
+
+class ConsoleRelay;
+class ConsoleShaper
+{
+public:
+    struct Limits {
+        // Bytes per second towards the browsers, 0 is unlimited
+        qint64 sessionRate  = 0;
+        qint64 sessionBurst = 0;
+        qint64 globalRate   = 0;
+        qint64 globalBurst  = 0;
+    };
+
+    // Thread safe, every worker configures the same limits. Only
+    // stores them, so it may run before the fork.
+    static void configure(const Limits &limits);
+    static bool enabled();
+
+    static quint64 add(ConsoleRelay *relay);
+    static void remove(quint64 flow);
+
+    // Bytes the flow may read now, when 0 the relay
+    // is woken up once it has credit again
+    static qint64 acquire(quint64 flow, qint64 wanted);
+};
+
+#endif // CONSOLESHAPER_H
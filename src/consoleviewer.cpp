@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "consoleviewer.h"
+
+#include "rfbbroker.h"
+
+#include <Cutelyst/Context>
+#include <Cutelyst/Request>
+
+#include <QLoggingCategory>
+#include <QtEndian>
+
+Q_LOGGING_CATEGORY(V_VIEWER, "virtlyst.viewer")
+
+using namespace Cutelyst;
+
+ConsoleViewer::ConsoleViewer(Context *c,
+                             RfbBroker *broker,
+                             const QString &hostId,
+                             const QString &hostName,
+                             const QString &label,
+                             const ConsoleSession::Limits &limits)
+    : QObject(c)
+    , m_c(c)
+    , m_serverInit(broker->serverInit())
+    , m_label(label)
+    , m_id(ConsoleSession::registerViewer(hostId, hostName, label, &m_counters))
+    , m_limit(limits.highWatermark * 4)
+    , m_ackInterval(limits.ackInterval)
+{
+    m_nextAck = m_ackInterval;
+    if (limits.deflate) {
+        m_deflate = std::make_unique<WsDeflate>(limits.deflateOptions);
+    }
+
+    // Queued both ways, the broker lives in the thread of the owning session
+    connect(broker, &RfbBroker::viewerData, this, &ConsoleViewer::brokerData);
+    connect(broker, &RfbBroker::closed, this, [this] {
+        close(Response::CloseCodeNormal,
+              QStringLiteral("Console is no longer shared"),
+              ConsoleSession::CloseCause::Upstream);
+    });
+    connect(broker, &QObject::destroyed, this, [this] {
+        close(Response::CloseCodeNormal,
+              QStringLiteral("Console owner left"),
+              ConsoleSession::CloseCause::Upstream);
+    });
+    connect(this, &ConsoleViewer::refreshRequested, broker, &RfbBroker::refresh);
+    broker->addViewer(this);
+
+    connect(c->request(), &Request::webSocketBinaryFrame, this, &ConsoleViewer::clientFrame);
+    connect(c->request(), &Request::webSocketPong, this, &ConsoleViewer::pong);
+    connect(c->request(), &Request::webSocketClosed, this, [this] { m_closed = true; });
+
+    qCDebug(V_VIEWER) << "Console viewer joined" << m_label;
+    send("RFB 003.008\n"_qba);
+}
+
+ConsoleViewer::~ConsoleViewer()
+{
+    ConsoleSession::unregisterViewer(m_id, m_cause);
+}
+
+void ConsoleViewer::clientFrame(const QByteArray &message)
+{
+    m_counters.received += message.size();
+    ++m_counters.framesIn;
+    if (m_state == State::Live) {
+        // Read-only, input is dropped
+        return;
+    }
+
+    m_buf.append(message);
+    while (!m_closed && m_state != State::Live) {
+        if (m_state == State::Version) {
+            if (m_buf.size() < 12) {
+                return;
+            }
+            m_minor = m_buf.mid(8, 3).toInt();
+            m_buf.remove(0, 12);
+
+            if (m_minor >= 7) {
+                // Only None, the owner session did the authentication
+                send("\x01\x01"_qba);
+                m_state = State::Choice;
+            } else {
+                send(QByteArray("\0\0\0\x01", 4));
+                m_state = State::ClientInit;
+            }
+        } else if (m_state == State::Choice) {
+            if (m_buf.isEmpty()) {
+                return;
+            }
+            const char choice = m_buf.at(0);
+            m_buf.remove(0, 1);
+            if (choice != 1) {
+                close(Response::CloseCodeProtocolError,
+                      QStringLiteral("Unsupported security"),
+                      ConsoleSession::CloseCause::Setup);
+                return;
+            }
+            if (m_minor >= 8) {
+                send(QByteArray(4, '\0'));
+            }
+            m_state = State::ClientInit;
+        } else if (m_state == State::ClientInit) {
+            if (m_buf.isEmpty()) {
+                return;
+            }
+            m_buf.clear();
+            m_state = State::Live;
+
+            send(m_serverInit);
+            Q_EMIT refreshRequested();
+        }
+    }
+}
+
+void ConsoleViewer::brokerData(const QByteArray &data, qsizetype boundary)
+{
+    if (m_closed || m_state != State::Live) {
+        return;
+    }
+
+    QByteArray chunk = data;
+    if (!m_synced) {
+        // Start with a whole message, the requested full update follows
+        if (boundary < 0) {
+            return;
+        }
+        chunk    = data.mid(boundary);
+        m_synced = true;
+    }
+
+    send(chunk);
+    const qint64 sent = m_counters.sent += chunk.size();
+
+    // The shared console can't wait for one viewer
+    if (m_gotPong && sent - m_acked > m_limit) {
+        close(Response::CloseCodeGoingAway,
+              QStringLiteral("Viewer too slow"),
+              ConsoleSession::CloseCause::SlowClient);
+        return;
+    }
+
+    if (sent >= m_nextAck) {
+        QByteArray payload(sizeof(qint64), Qt::Uninitialized);
+        qToBigEndian<qint64>(sent, payload.data());
+        m_c->response()->webSocketPing(payload);
+        m_nextAck = sent + m_ackInterval;
+    }
+}
+
+void ConsoleViewer::send(const QByteArray &data)
+{
+    const QByteArray message = m_deflate ? m_deflate->encode(data) : data;
+    m_c->response()->webSocketBinaryMessage(message);
+    m_counters.wire += message.size();
+    ++m_counters.framesOut;
+}
+
+void ConsoleViewer::pong(const QByteArray &payload)
+{
+    if (payload.size() != sizeof(qint64)) {
+        return;
+    }
+
+    const qint64 offset = qFromBigEndian<qint64>(payload.constData());
+    if (offset > m_acked && offset <= m_counters.sent) {
+        m_acked = offset;
+    }
+    m_gotPong = true;
+}
+
+void ConsoleViewer::close(Response::CloseCode code,
+                          const QString &reason,
+                          ConsoleSession::CloseCause cause)
+{
+    if (m_closed) {
+        return;
+    }
+    m_closed = true;
+    m_cause  = cause;
+
+    qCDebug(V_VIEWER) << "Console viewer closing" << m_label << reason;
+    m_c->response()->webSocketClose(code, reason);
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CONSOLEVIEWER_H
+#define CONSOLEVIEWER_H
+
+#include "consolesession.h"
+
+#include <QObject>
+
+class RfbBroker;
+class ConsoleViewer : public QObject
+{
+    Q_OBJECT
+public:
+    // Read-only RFB client of a console shared by another session,
+    // created under RfbBroker::join() so that broker is alive. Counted
+    // under hostId with the console sessions.
+    ConsoleViewer(Cutelyst::Context *c,
+                  RfbBroker *broker,
+                  const QString &hostId,
+                  const QString &hostName,
+                  const QString &label,
+                  const ConsoleSession::Limits &limits);
+    ~ConsoleViewer() override;
+
+Q_SIGNALS:
+    void refreshRequested();
+
+private:
+    enum class State {
+        Version,
+        Choice,
+        ClientInit,
+        Live,
+    };
+
+    void clientFrame(const QByteArray &message);
+    void brokerData(const QByteArray &data, qsizetype boundary);
+    void pong(const QByteArray &payload);
+    void close(Cutelyst::Response::CloseCode code,
+               const QString &reason,
+               ConsoleSession::CloseCause cause);
+
+    void send(const QByteArray &data);
+
+    Cutelyst::Context *m_c;
+    std::unique_ptr<WsDeflate> m_deflate;
+    QByteArray m_serverInit;
+    QByteArray m_buf;
+    QString m_label;
+    ConsoleSession::ViewerCounters m_counters;
+    quint64 m_id;
+    qint64 m_limit;
+    qint64 m_acked                     = 0;
+    qint64 m_nextAck                   = 0;
+    qint64 m_ackInterval;
+    int m_minor                        = 8;
+    State m_state                      = State::Version;
+    ConsoleSession::CloseCause m_cause = ConsoleSession::CloseCause::Client;
+    bool m_synced                      = false;
+    bool m_gotPong                     = false;
+    bool m_closed                      = false;
+};
+
+#endif // CONSOLEVIEWER_H
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cpuheatmap.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+
+#include <algorithm>
+
+namespace {
+
+struct Ring {
+    // Times of the previous round, empty after the host was down
+    QVector<Connection::CpuTime> last;
+    int cpus = 0;
+    // Next row to write and rows written, up to Rounds
+    int head = 0;
+    int size = 0;
+    QVector<qint64> timestamps;
+    QVector<quint8> usage;
+};
+
+QMutex ringsMutex;
+QHash<QString, Ring> rings;
+
+quint8 usage(const Connection::CpuTime &last, const Connection::CpuTime &now)
+{
+    if (now.utilization >= 0) {
+        return quint8(qRound(qBound(0.0, now.utilization, 100.0)));
+    }
+    // Offline CPUs report nothing, and one that was replugged starts over
+    if (last.total < 0 || now.total <= last.total || now.busy < last.busy) {
+        return CpuHeatmap::Unknown;
+    }
+    const double busy = (now.busy - last.busy) / (now.total - last.total) * 100;
+    return quint8(qRound(qBound(0.0, busy, 100.0)));
+}
+
+} // namespace
+
+CpuHeatmap *CpuHeatmap::instance()
+{
+    static CpuHeatmap heatmap;
+    return &heatmap;
+}
+
+void CpuHeatmap::start()
+{
+    QMutexLocker locker(&ringsMutex);
+    if (m_started) {
+        return;
+    }
+    m_started = true;
+
+    QObject::connect(
+        Sampler::instance(),
+        &Sampler::sampled,
+        Sampler::instance(),
+        [this](const QSharedPointer<const Sampler::Snapshot> &snapshot) { add(*snapshot); },
+        Qt::DirectConnection);
+}
+
+CpuHeatmap::Heatmap CpuHeatmap::heatmap(const QString &hostId, int rounds)
+{
+    QMutexLocker locker(&ringsMutex);
+    Heatmap ret;
+    auto it = rings.constFind(hostId);
+    if (it == rings.constEnd()) {
+        return ret;
+    }
+
+    const Ring &ring = it.value();
+    const int size   = qBound(0, rounds, ring.size);
+    ret.cpus         = ring.cpus;
+    ret.timestamps.reserve(size);
+    ret.usage.resize(qsizetype(size) * ring.cpus);
+    for (int i = 0; i < size; ++i) {
+        const int row = (ring.head - size + i + Rounds) % Rounds;
+        ret.timestamps.append(ring.timestamps[row]);
+        std::copy_n(ring.usage.constData() + qsizetype(row) * ring.cpus,
+                    ring.cpus,
+                    ret.usage.data() + qsizetype(i) * ring.cpus);
+    }
+    return ret;
+}
+
+void CpuHeatmap::add(const Sampler::Snapshot &snapshot)
+{
+    QMutexLocker locker(&ringsMutex);
+
+    QSet<QString> hosts;
+    for (const Sampler::Host &host : snapshot) {
+        hosts.insert(host.id);
+        if (!host.up || host.cpus.isEmpty()) {
+            // A delta across the downtime would be an average of it
+            auto it = rings.find(host.id);
+            if (it != rings.end()) {
+                it->last.clear();
+            }
+            continue;
+        }
+
+        Ring &ring     = rings[host.id];
+        const int cpus = int(host.cpus.size());
+        if (ring.cpus != cpus) {
+            // CPUs were hot plugged, the old rows don't line up anymore
+            ring      = Ring();
+            ring.cpus = cpus;
+            ring.timestamps.resize(Rounds);
+            ring.usage.fill(Unknown, qsizetype(Rounds) * cpus);
+        }
+
+        if (!ring.last.isEmpty()) {
+            quint8 *row = ring.usage.data() + qsizetype(ring.head) * cpus;
+            for (int i = 0; i < cpus; ++i) {
+                row[i] = usage(ring.last[i], host.cpus[i]);
+            }
+            ring.timestamps[ring.head] = host.timestamp;
+            ring.head                  = (ring.head + 1) % Rounds;
+            ring.size                  = qMin(ring.size + 1, Rounds);
+        }
+        ring.last = host.cpus;
+    }
+
+    rings.removeIf([&hosts](const auto &it) { return !hosts.contains(it.key()); });
+}
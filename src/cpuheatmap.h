@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CPUHEATMAP_H
+#define CPUHEATMAP_H
+
+#include "sampler.h"
+
+#include <QVector>
+
+// Utilisation of every CPU of every host over the last sampler rounds,
+// from the deltas of their times. Each host keeps a ring of rounds with
+// a byte per CPU, so rendering a heatmap costs no libvirt call.
+class CpuHeatmap
+{
+public:
+    // An hour at the default sampling interval
+    static constexpr int Rounds     = 240;
+    static constexpr quint8 Unknown = 255;
+
+    struct Heatmap {
+        int cpus = 0;
+        // Oldest first, ms since the epoch
+        QVector<qint64> timestamps;
+        // % busy of every CPU by round, row-major, Unknown for offline CPUs
+        QVector<quint8> usage;
+    };
+
+    static CpuHeatmap *instance();
+
+    // Starts following the sampler, only the first call does anything
+    void start();
+
+    // Copy of the last rounds of host, at most Rounds
+    static Heatmap heatmap(const QString &hostId, int rounds = Rounds);
+
+private:
+    CpuHeatmap() = default;
+
+    void add(const Sampler::Snapshot &snapshot);
+
+    bool m_started = false;
+};
+
+#endif // CPUHEATMAP_H
@@ -22,14 +22,22 @@
 #include "lib/storagepool.h"
 #include "lib/storagevol.h"
 #include "virtlyst.h"
+#include "warmpool.h"
 
 #include <Cutelyst/Plugins/StatusMessage>
 #include <Cutelyst/Plugins/Utils/Sql>
 
+#include <QAtomicInt>
 #include <QDomDocument>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonObject>
 #include <QLoggingCategory>
+#include <QRegularExpression>
+#include <QSet>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QThreadPool>
 #include <QUuid>
 
 using namespace Cutelyst;
@@ -83,6 +91,27 @@ void Create::index(Context *c, const QString &hostId)
             if (!query.exec()) {
                 qWarning() << "Failed to delete flavor" << id << query.lastError().databaseText();
             }
+        } else if (params.contains(QStringLiteral("create_warm_pool"))) {
+            const QString templ = params.value(u"template"_qs);
+            const int size      = params.value(u"size"_qs).toInt();
+            // Creating an instance only claims from the template's own pool
+            StorageVol *vol     = templ.isEmpty() ? nullptr : conn->getStorageVolByPath(templ, c);
+            const QString pool  = vol ? vol->pool()->name() : QString();
+            if (pool.isEmpty() || size < 1) {
+                errors.append(QStringLiteral("Warm pool needs a template and a size"));
+            } else if (WarmPool::addPool(hostId, templ, pool, size)) {
+                m_virtlyst->warmPool()->refill(hostId);
+            } else {
+                errors.append(QStringLiteral("Failed to create warm pool"));
+            }
+        } else if (params.contains(QStringLiteral("delete_warm_pool"))) {
+            const QStringList paths = WarmPool::removePool(hostId, params.value(u"warm_pool"_qs));
+            for (const QString &path : paths) {
+                StorageVol *vol = conn->getStorageVolByPath(path, c);
+                if (vol) {
+                    vol->undefine();
+                }
+            }
         } else if (params.contains(QStringLiteral("create_xml"))) {
             const QString xml = params.value(u"from_xml"_qs);
             QDomDocument xmlDoc;
@@ -128,7 +157,11 @@ void Create::index(Context *c, const QString &hostId)
                 flags = VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA;
             }
 
+            QString status;
             QVector<StorageVol *> volumes;
+            StorageVol *warmVol = nullptr;
+            QString warmTemplate;
+            QString warmPool;
             if (params.contains(QStringLiteral("hdd_size"))) {
                 const QString storageName = params.value(u"storage"_qs);
                 const QString hddSize     = params.value(u"hdd_size"_qs);
@@ -149,8 +182,41 @@ void Create::index(Context *c, const QString &hostId)
                 const QString templ = params.value(u"template"_qs);
                 StorageVol *vol     = conn->getStorageVolByPath(templ, c);
                 if (vol) {
-                    // This is SLOW and will block clients
-                    StorageVol *cloned = vol->clone(name, vol->type(), flags);
+                    const bool linked  = params.contains(QStringLiteral("linked_clone"));
+                    StorageVol *cloned = nullptr;
+                    if (linked) {
+                        cloned = vol->linkedClone(name);
+                    } else if (flags == 0) {
+                        // libvirt can't rename volumes so the claimed
+                        // one keeps its "-warm-" name
+                        const QString pool = vol->pool()->name();
+                        const QString warm = m_virtlyst->warmPool()->claim(hostId, templ, pool);
+                        if (!warm.isEmpty()) {
+                            cloned = conn->getStorageVolByPath(warm, c);
+                            if (cloned) {
+                                status = QStringLiteral("Using pre-cloned volume %1")
+                                             .arg(cloned->name());
+                                warmVol      = cloned;
+                                warmTemplate = templ;
+                                warmPool     = pool;
+                            }
+                        }
+                    }
+
+                    if (!cloned && !linked) {
+                        // This is SLOW and will block clients
+                        StorageVol::CloneStats stats;
+                        cloned = vol->clone(name,
+                                            vol->type(),
+                                            flags,
+                                            params.contains(QStringLiteral("reflink"))
+                                                ? StorageVol::CloneReflink
+                                                : StorageVol::CloneCopy,
+                                            &stats);
+                        if (cloned) {
+                            status = StorageVol::cloneSummary(cloned->name(), stats);
+                        }
+                    }
                     if (cloned) {
                         volumes << cloned;
                     } else {
@@ -180,13 +246,23 @@ void Create::index(Context *c, const QString &hostId)
                                        networks,
                                        virtio,
                                        consoleType)) {
+                    ParamsMultiMap query;
+                    if (!status.isEmpty()) {
+                        query = StatusMessage::statusQuery(c, status);
+                    }
                     c->response()->redirect(
-                        c->uriFor(QStringLiteral("/instances"), QStringList{hostId, name}));
+                        c->uriFor(QStringLiteral("/instances"), QStringList{hostId, name}, query));
                     return;
                 } else {
                     errors.append(conn->lastError());
                 }
             }
+
+            // Nothing uses the claimed volume, hand it back or drop it
+            if (warmVol &&
+                !m_virtlyst->warmPool()->release(hostId, warmTemplate, warmPool, warmVol->path())) {
+                warmVol->undefine();
+            }
         }
 
         c->response()->redirect(
@@ -205,9 +281,216 @@ void Create::index(Context *c, const QString &hostId)
     c->setStash(QStringLiteral("get_images"), QVariant::fromValue(conn->getStorageImages(c)));
     c->setStash(QStringLiteral("cache_modes"), QVariant::fromValue(conn->getCacheModes()));
 
+    c->setStash(QStringLiteral("warm_pools"), WarmPool::pools(hostId));
+
     QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT * FROM create_flavor"),
                                                    QStringLiteral("virtlyst"));
     if (query.exec()) {
         c->setStash(QStringLiteral("flavors"), Sql::queryToHashList(query));
     }
 }
+
+namespace {
+
+struct BatchResult {
+    QString name;
+    QString error;
+    bool created = false;
+};
+
+} // namespace
+
+void Create::batch(Context *c, const QString &hostId)
+{
+    Connection *conn   = m_virtlyst->connection(hostId, c);
+    ServerConn *server = m_virtlyst->server(hostId);
+    if (conn == nullptr || server == nullptr) {
+        qWarning() << "Host id not found or connection not active";
+        c->response()->redirect(c->uriForAction(QStringLiteral("/index")));
+        return;
+    }
+
+    if (!c->request()->isPost()) {
+        c->response()->redirect(
+            c->uriFor(CActionFor(u"index"), QStringList(), QStringList{hostId}));
+        return;
+    }
+
+    const ParamsMultiMap params = c->request()->bodyParameters();
+    const QString flavorId      = params.value(u"flavor"_qs);
+    const QString pattern       = params.value(u"pattern"_qs);
+    const QString storageName   = params.value(u"storage"_qs);
+    const QString cacheMode     = params.value(u"cache_mode"_qs);
+    const QStringList networks  = params.values(QStringLiteral("networks"));
+    const bool hostModel        = params.contains(QStringLiteral("host_model"));
+    const bool virtio           = params.contains(QStringLiteral("virtio"));
+    const int count             = params.value(u"count"_qs).toInt();
+
+    const int maxCount    = m_virtlyst->config(QStringLiteral("BatchMaxCount"), 50).toInt();
+    const int concurrency = m_virtlyst->config(QStringLiteral("BatchConcurrency"), 4).toInt();
+
+    int flags = 0;
+    if (params.contains(QStringLiteral("meta_prealloc"))) {
+        flags = VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA;
+    }
+
+    // "{n}" is replaced by the instance number, or "-n" is appended
+    static const QRegularExpression namePattern(
+        QStringLiteral("^[a-zA-Z0-9._-]*(\\{n\\})?[a-zA-Z0-9._-]*$"));
+
+    QString error;
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(
+        QStringLiteral("SELECT memory, vcpu, disk FROM create_flavor WHERE id = :id"),
+        QStringLiteral("virtlyst"));
+    query.bindValue(QStringLiteral(":id"), flavorId);
+    StoragePool *storage = conn->getStoragePool(storageName, c);
+    if (!query.exec() || !query.next()) {
+        error = QStringLiteral("Flavor not found");
+    } else if (!storage) {
+        error = QStringLiteral("Could not find storage");
+    } else if (count < 1 || count > maxCount) {
+        error = QStringLiteral("Count must be between 1 and %1").arg(maxCount);
+    } else if (pattern.isEmpty() || !namePattern.match(pattern).hasMatch()) {
+        error = QStringLiteral("Invalid name pattern");
+    }
+
+    if (!error.isEmpty()) {
+        c->response()->redirect(c->uriFor(CActionFor(u"index"),
+                                          QStringList(),
+                                          QStringList{hostId},
+                                          StatusMessage::errorQuery(c, error)));
+        return;
+    }
+
+    const QString memory = query.value(0).toString();
+    const QString vcpu   = query.value(1).toString();
+    const qint64 disk    = query.value(2).toLongLong();
+
+    QSet<QString> existing;
+    const QVector<Domain *> domains =
+        conn->domains(VIR_CONNECT_LIST_DOMAINS_ACTIVE | VIR_CONNECT_LIST_DOMAINS_INACTIVE, c);
+    for (Domain *dom : domains) {
+        existing.insert(dom->name());
+    }
+
+    QVector<BatchResult> results(count);
+    for (int i = 0; i < count; ++i) {
+        const QString n     = QString::number(i + 1);
+        BatchResult &result = results[i];
+        if (pattern.contains(QLatin1String("{n}"))) {
+            result.name = QString(pattern).replace(QLatin1String("{n}"), n);
+        } else {
+            result.name = pattern + QLatin1Char('-') + n;
+        }
+
+        if (existing.contains(result.name)) {
+            result.error = QStringLiteral("A virtual machine with this name already exists");
+        }
+    }
+
+    // The XML is built once, each instance only
+    // replaces its name, UUID and disk path
+    const QString nameToken = QStringLiteral("@VIRTLYST_NAME@");
+    const QString uuidToken = QStringLiteral("@VIRTLYST_UUID@");
+    const QString pathToken = QStringLiteral("@VIRTLYST_PATH@");
+    const QString diskType  = storage->type() == QLatin1String("rbd") ? QStringLiteral("rbd")
+                                                                      : QStringLiteral("qcow2");
+    const QString skeleton  = conn->domainXml(nameToken,
+                                              memory,
+                                              vcpu,
+                                              hostModel,
+                                              uuidToken,
+                                              {{pathToken, diskType}},
+                                              cacheMode,
+                                              networks,
+                                              virtio,
+                                              QStringLiteral("spice"));
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Each worker owns a connection and takes the next pending instance
+    QAtomicInt next;
+    BatchResult *data      = results.data();
+    const QUrl url         = server->url;
+    const QString hostName = server->name;
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, concurrency));
+    for (int w = 0; w < qMin(pool.maxThreadCount(), count); ++w) {
+        pool.start([&] {
+            Connection workerConn(url, hostName);
+            StoragePool *workerStorage = workerConn.getStoragePool(storageName, &workerConn);
+
+            int i;
+            while ((i = next.fetchAndAddRelaxed(1)) < count) {
+                BatchResult &result = data[i];
+                if (!result.error.isEmpty()) {
+                    continue;
+                }
+
+                if (!workerStorage) {
+                    result.error = QStringLiteral("Could not find storage");
+                    continue;
+                }
+
+                StorageVol *vol = workerStorage->createStorageVolume(
+                    result.name, QStringLiteral("qcow2"), disk, flags);
+                if (!vol) {
+                    result.error = workerConn.lastError();
+                    continue;
+                }
+
+                QString xml = skeleton;
+                xml.replace(nameToken, result.name.toHtmlEscaped())
+                    .replace(uuidToken, QUuid::createUuid().toString(QUuid::WithoutBraces))
+                    .replace(pathToken, vol->path().toHtmlEscaped());
+                if (workerConn.domainDefineXml(xml)) {
+                    result.created = true;
+                } else {
+                    result.error = workerConn.lastError();
+                    vol->undefine();
+                }
+            }
+        });
+    }
+    pool.waitForDone();
+
+    int created = 0;
+    QStringList errors;
+    QJsonArray instances;
+    for (const BatchResult &result : std::as_const(results)) {
+        if (result.created) {
+            ++created;
+        } else {
+            errors.append(result.name + QLatin1String(": ") + result.error);
+        }
+        instances.append(QJsonObject{
+            {QStringLiteral("name"), result.name},
+            {QStringLiteral("created"), result.created},
+            {QStringLiteral("error"), result.error},
+        });
+    }
+
+    const QString status = QStringLiteral("Created %1 of %2 instances in %3 ms")
+                               .arg(QString::number(created),
+                                    QString::number(count),
+                                    QString::number(timer.elapsed()));
+    qInfo() << status;
+
+    if (c->request()->header("Accept").contains("application/json")) {
+        c->response()->setJsonObjectBody({
+            {QStringLiteral("created"), created},
+            {QStringLiteral("elapsed"), timer.elapsed()},
+            {QStringLiteral("instances"), instances},
+        });
+        return;
+    }
+
+    ParamsMultiMap redirectQuery = StatusMessage::statusQuery(c, status);
+    if (!errors.isEmpty()) {
+        redirectQuery =
+            StatusMessage::errorQuery(c, errors.join(QLatin1String("\n")), redirectQuery);
+    }
+    c->response()->redirect(
+        c->uriFor(CActionFor(u"index"), QStringList(), QStringList{hostId}, redirectQuery));
+}
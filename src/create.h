@@ -31,6 +31,9 @@ public:
     C_ATTR(index, :Path :AutoArgs)
     void index(Context *c, const QString &hostId);
 
+    C_ATTR(batch, :Local :AutoArgs)
+    void batch(Context *c, const QString &hostId);
+
 private:
     Virtlyst *m_virtlyst;
 };
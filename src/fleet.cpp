@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fleet.h"
+
+#include <QMutex>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace {
+
+constexpr float Unknown = std::numeric_limits<float>::quiet_NaN();
+
+const char *const MetricNames[Fleet::MetricCount] = {
+    "cpu",
+    "disk_read",
+    "disk_write",
+    "net_rx",
+    "net_tx",
+    "memory",
+    "cache_misses",
+    "cycles",
+    "instructions",
+    "cmt",
+    "mbmt",
+};
+
+QMutex tableMutex;
+QSharedPointer<const Fleet::Table> lastTable;
+
+double sum(const Connection::StatsRecord &record, const char *group, const char *field)
+{
+    double ret       = 0;
+    const int count  = int(record.values.value(QByteArray(group) + ".count"));
+    const auto begin = QByteArray(group) + '.';
+    for (int i = 0; i < count; ++i) {
+        ret += record.values.value(begin + QByteArray::number(i) + '.' + field);
+    }
+    return ret;
+}
+
+} // namespace
+
+QVector<int> Fleet::Table::top(Metric metric, int n, int host) const
+{
+    const QVector<float> &column = columns[metric];
+    QVector<int> ret;
+    ret.reserve(column.size());
+    for (int i = 0; i < column.size(); ++i) {
+        if (this->host[i] >= 0 && (host < 0 || this->host[i] == host) && !std::isnan(column[i])) {
+            ret.append(i);
+        }
+    }
+
+    const int size = qBound(0, n, int(ret.size()));
+    std::partial_sort(ret.begin(), ret.begin() + size, ret.end(), [&column](int a, int b) {
+        return column[a] > column[b];
+    });
+    ret.resize(size);
+    return ret;
+}
+
+QVector<float>
+    Fleet::Table::percentiles(Metric metric, std::initializer_list<double> ps, int host) const
+{
+    const QVector<float> &column = columns[metric];
+    std::vector<float> values;
+    values.reserve(size_t(column.size()));
+    for (int i = 0; i < column.size(); ++i) {
+        if (this->host[i] >= 0 && (host < 0 || this->host[i] == host) && !std::isnan(column[i])) {
+            values.push_back(column[i]);
+        }
+    }
+
+    QVector<float> ret;
+    ret.reserve(qsizetype(ps.size()));
+    // Each selection leaves the greater values after it for the next one
+    auto begin = values.begin();
+    for (double p : ps) {
+        if (values.empty()) {
+            ret.append(Unknown);
+            continue;
+        }
+        auto nth = values.begin() + qsizetype(std::llround(p * double(values.size() - 1)));
+        if (nth < begin) {
+            nth = begin;
+        }
+        std::nth_element(begin, nth, values.end());
+        ret.append(*nth);
+        begin = nth;
+    }
+    return ret;
+}
+
+qsizetype Fleet::Table::count(Metric metric, int host) const
+{
+    const QVector<float> &column = columns[metric];
+    qsizetype ret                = 0;
+    for (int i = 0; i < column.size(); ++i) {
+        if (this->host[i] >= 0 && (host < 0 || this->host[i] == host) && !std::isnan(column[i])) {
+            ++ret;
+        }
+    }
+    return ret;
+}
+
+Fleet *Fleet::instance()
+{
+    static Fleet fleet;
+    return &fleet;
+}
+
+void Fleet::start()
+{
+    QMutexLocker locker(&tableMutex);
+    if (m_started) {
+        return;
+    }
+    m_started = true;
+
+    QObject::connect(
+        Sampler::instance(),
+        &Sampler::sampled,
+        Sampler::instance(),
+        [this](const QSharedPointer<const Sampler::Snapshot> &snapshot) { add(*snapshot); },
+        Qt::DirectConnection);
+}
+
+QSharedPointer<const Fleet::Table> Fleet::table()
+{
+    QMutexLocker locker(&tableMutex);
+    return lastTable;
+}
+
+int Fleet::metric(QStringView name)
+{
+    for (int i = 0; i < MetricCount; ++i) {
+        if (name == QLatin1String(MetricNames[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+QString Fleet::metricName(Metric metric)
+{
+    return QString::fromLatin1(MetricNames[metric]);
+}
+
+void Fleet::add(const Sampler::Snapshot &snapshot)
+{
+    ++m_round;
+
+    struct Row {
+        int id;
+        int host;
+        const Connection::StatsRecord *record;
+        qint64 time;
+    };
+    QVector<Row> rows;
+
+    auto table = QSharedPointer<Table>::create();
+    for (const Sampler::Host &host : snapshot) {
+        table->hostIds.append(host.id);
+        table->hostNames.append(host.name);
+        table->timestamp = qMax(table->timestamp, host.timestamp);
+        for (const Connection::StatsRecord &record : host.domains) {
+            rows.append({id(host.id + u'/' + record.uuid),
+                         int(table->hostIds.size() - 1),
+                         &record,
+                         host.timestamp});
+        }
+    }
+
+    const qsizetype size = m_time.size();
+    table->host.fill(-1, size);
+    table->uuid.resize(size);
+    table->name.resize(size);
+    for (QVector<float> &column : table->columns) {
+        column.fill(Unknown, size);
+    }
+
+    for (const Row &row : rows) {
+        const Connection::StatsRecord &record = *row.record;
+        table->host[row.id]                   = row.host;
+        table->uuid[row.id]                   = record.uuid;
+        table->name[row.id]                   = record.name;
+
+        double counters[CounterCount];
+        counters[CpuTime]          = record.values.value("cpu.time", -1);
+        counters[ReadBytes]        = sum(record, "block", "rd.bytes");
+        counters[WriteBytes]       = sum(record, "block", "wr.bytes");
+        counters[RxBytes]          = sum(record, "net", "rx.bytes");
+        counters[TxBytes]          = sum(record, "net", "tx.bytes");
+        // Perf events are only reported while enabled on the domain
+        counters[CacheMissCount]   = record.values.value("perf.cache_misses", -1);
+        counters[CycleCount]       = record.values.value("perf.cycles", -1);
+        counters[InstructionCount] = record.values.value("perf.instructions", -1);
+
+        // Rates need the previous round, and a restart resets the counters
+        const double elapsed = double(row.time - m_time[row.id]) / 1000;
+        if (m_time[row.id] > 0 && elapsed > 0) {
+            const auto rate = [&](Counter counter, double scale) {
+                const double last = m_counters[counter][row.id];
+                if (counters[counter] < 0 || last < 0 || counters[counter] < last) {
+                    return Unknown;
+                }
+                return float((counters[counter] - last) / elapsed * scale);
+            };
+            // ns per s spread over the vCPUs, to %
+            const double vcpus                   = qMax(1.0, record.values.value("vcpu.current"));
+            table->columns[Cpu][row.id]          = rate(CpuTime, 1e-7 / vcpus);
+            table->columns[DiskRead][row.id]     = rate(ReadBytes, 1.0 / (1024 * 1024));
+            table->columns[DiskWrite][row.id]    = rate(WriteBytes, 1.0 / (1024 * 1024));
+            table->columns[NetRx][row.id]        = rate(RxBytes, 1.0 / (1024 * 1024));
+            table->columns[NetTx][row.id]        = rate(TxBytes, 1.0 / (1024 * 1024));
+            table->columns[CacheMisses][row.id]  = rate(CacheMissCount, 1e-6);
+            table->columns[Cycles][row.id]       = rate(CycleCount, 1e-6);
+            table->columns[Instructions][row.id] = rate(InstructionCount, 1e-6);
+        }
+
+        auto balloon = record.values.constFind("balloon.current");
+        if (balloon != record.values.cend()) {
+            table->columns[Memory][row.id] = float(*balloon / 1024);
+        }
+        auto cmt = record.values.constFind("perf.cmt");
+        if (cmt != record.values.cend()) {
+            table->columns[CacheOccupancy][row.id] = float(*cmt / (1024 * 1024));
+        }
+        auto mbmt = record.values.constFind("perf.mbmt");
+        if (mbmt != record.values.cend()) {
+            table->columns[MemoryBandwidth][row.id] = float(*mbmt / (1024 * 1024));
+        }
+
+        m_time[row.id] = row.time;
+        for (int i = 0; i < CounterCount; ++i) {
+            m_counters[i][row.id] = counters[i];
+        }
+    }
+
+    // Ids of domains that are gone, or whose host is down, are reused
+    for (auto it = m_ids.begin(); it != m_ids.end();) {
+        if (m_seen[it.value()] != m_round) {
+            m_free.append(it.value());
+            it = m_ids.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    QMutexLocker locker(&tableMutex);
+    lastTable = table;
+}
+
+int Fleet::id(const QString &key)
+{
+    auto it = m_ids.constFind(key);
+    int ret;
+    if (it != m_ids.constEnd()) {
+        ret = it.value();
+    } else {
+        if (m_free.isEmpty()) {
+            ret = int(m_time.size());
+            m_time.append(0);
+            m_seen.append(0);
+            for (QVector<double> &counter : m_counters) {
+                counter.append(-1);
+            }
+        } else {
+            ret         = m_free.takeLast();
+            m_time[ret] = 0;
+        }
+        m_ids.insert(key, ret);
+    }
+    m_seen[ret] = m_round;
+    return ret;
+}
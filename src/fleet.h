@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FLEET_H
+#define FLEET_H
+
+#include "sampler.h"
+
+#include <QHash>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
+
+// Latest usage of every domain of every host, to rank the heaviest
+// ones. Each sampler round becomes a new immutable table with one
+// contiguous column per metric, indexed by a dense id that a domain
+// keeps for as long as it's sampled.
+class Fleet
+{
+public:
+    enum Metric {
+        Cpu,
+        DiskRead,
+        DiskWrite,
+        NetRx,
+        NetTx,
+        Memory,
+        CacheMisses,
+        Cycles,
+        Instructions,
+        CacheOccupancy,
+        MemoryBandwidth,
+        MetricCount,
+    };
+
+    struct Table {
+        qint64 timestamp = 0;
+        QStringList hostIds;
+        QStringList hostNames;
+        // Index in hostIds, -1 for ids of gone domains
+        QVector<int> host;
+        QVector<QString> uuid;
+        QVector<QString> name;
+        // CPU in %, I/O in MiB/s, memory in MiB, perf events in millions
+        // per second and cache occupancy and bandwidth in MiB and MiB/s,
+        // NaN until known and for perf events the domain doesn't count
+        QVector<float> columns[MetricCount];
+
+        // Ids of the n domains using the most of metric, on host or on all of them
+        QVector<int> top(Metric metric, int n, int host = -1) const;
+        // Percentiles of metric for each of ps, which must be ascending in [0, 1]
+        QVector<float>
+            percentiles(Metric metric, std::initializer_list<double> ps, int host = -1) const;
+        // Domains with a known value of metric
+        qsizetype count(Metric metric, int host = -1) const;
+    };
+
+    static Fleet *instance();
+
+    // Starts following the sampler, only the first call does anything
+    void start();
+
+    static QSharedPointer<const Table> table();
+
+    // e.g. "cpu" or "disk_read", -1 if unknown
+    static int metric(QStringView name);
+    static QString metricName(Metric metric);
+
+private:
+    enum Counter {
+        CpuTime,
+        ReadBytes,
+        WriteBytes,
+        RxBytes,
+        TxBytes,
+        CacheMissCount,
+        CycleCount,
+        InstructionCount,
+        CounterCount,
+    };
+
+    Fleet() = default;
+
+    void add(const Sampler::Snapshot &snapshot);
+    int id(const QString &key);
+
+    bool m_started = false;
+    quint32 m_round = 0;
+    // "<host id>/<uuid>" to dense id
+    QHash<QString, int> m_ids;
+    QVector<int> m_free;
+    // Counters of the previous round by id, to derive rates
+    QVector<qint64> m_time;
+    QVector<quint32> m_seen;
+    QVector<double> m_counters[CounterCount];
+};
+
+#endif // FLEET_H
@@ -16,19 +16,253 @@
  */
 #include "info.h"
 
+#include "clonejob.h"
+#include "cpuheatmap.h"
+#include "fleet.h"
 #include "lib/connection.h"
 #include "lib/domain.h"
+#include "metricsstore.h"
+#include "sampler.h"
 #include "virtlyst.h"
 
 #include <libvirt/libvirt.h>
 
+#include <QDateTime>
 #include <QDebug>
 #include <QJsonArray>
 #include <QJsonObject>
-#include <QNetworkCookie>
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
 
 using namespace Cutelyst;
 
+namespace {
+
+struct ChartSeries {
+    QJsonArray labels;
+    // One per series asked, all sharing the labels
+    QVector<QJsonArray> values;
+};
+
+struct ChartQuery {
+    qint64 range;
+    int points;
+};
+
+// Seconds of history asked by ?range=, an hour by default, and the
+// most points a chart gets by ?points=
+ChartQuery chartQuery(Context *c)
+{
+    const qint64 range = c->request()->queryParam(QStringLiteral("range")).toLongLong();
+    const int points   = c->request()->queryParam(QStringLiteral("points")).toInt();
+    return {
+        range > 0 ? qMin<qint64>(range, 30 * 24 * 3600) : 3600,
+        points > 0 ? qBound(3, points, 2000) : 300,
+    };
+}
+
+ChartSeries chartSeries(const ChartQuery &query, const QVector<QByteArray> &keys)
+{
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    QVector<QVector<MetricsStore::Point>> series;
+    series.reserve(qsizetype(keys.size()));
+    qsizetype size = std::numeric_limits<qsizetype>::max();
+    for (const QByteArray &key : keys) {
+        series.append(MetricsStore::instance()->range(key, now - query.range, now));
+        if (!series.constLast().isEmpty()) {
+            size = qMin(size, series.constLast().size());
+        }
+    }
+    // Sampled together, only one that started later can be shorter,
+    // and one that is never reported stays empty
+    QVector<QVector<MetricsStore::Point>> present;
+    for (QVector<MetricsStore::Point> &points : series) {
+        if (!points.isEmpty()) {
+            points.remove(0, points.size() - size);
+            present.append(points);
+        }
+    }
+
+    const QString format =
+        query.range > 24 * 3600 ? QStringLiteral("ddd HH:mm") : QStringLiteral("HH:mm:ss");
+
+    ChartSeries ret;
+    ret.values.resize(series.size());
+    const QVector<qsizetype> indices = MetricsStore::downsample(present, query.points);
+    for (qsizetype i : indices) {
+        const quint32 time = present.constFirst()[i].time;
+        ret.labels.append(QDateTime::fromSecsSinceEpoch(time).toString(format));
+        for (int j = 0; j < series.size(); ++j) {
+            if (!series[j].isEmpty()) {
+                ret.values[j].append(qRound64(series[j][i].value * 100) / 100.0);
+            }
+        }
+    }
+    return ret;
+}
+
+constexpr const char *VcpuColors[] = {
+    "241,72,70",
+    "249,134,33",
+    "83,191,189",
+    "151,187,205",
+    "120,180,80",
+    "160,110,200",
+    "230,200,60",
+    "110,110,110",
+};
+
+// Chart.js line chart of series that share the labels, one rgb colour
+// like "241,72,70" each and optionally a legend label
+QJsonObject lineChart(const ChartSeries &series,
+                      const QVector<const char *> &colors,
+                      const QStringList &labels = {})
+{
+    QJsonArray datasets;
+    int i = 0;
+    for (const char *rgb : colors) {
+        // Left out while the series has no points at all
+        if (series.values[i].size() != series.labels.size()) {
+            ++i;
+            continue;
+        }
+        const QString color = QString::fromLatin1(rgb);
+        datasets.append(QJsonObject{
+            {QStringLiteral("fillColor"), QStringLiteral("rgba(%1,0.5)").arg(color)},
+            {QStringLiteral("strokeColor"), QStringLiteral("rgba(%1,1)").arg(color)},
+            {QStringLiteral("pointColor"), QStringLiteral("rgba(%1,1)").arg(color)},
+            {QStringLiteral("pointStrokeColor"), QStringLiteral("#fff")},
+            {QStringLiteral("label"), labels.value(i)},
+            {QStringLiteral("data"), series.values[i]},
+        });
+        ++i;
+    }
+    return {
+        {QStringLiteral("labels"), series.labels},
+        {QStringLiteral("datasets"), datasets},
+    };
+}
+
+// How much the running guests were promised against what they take, in MiB
+QJsonObject overcommit(const QString &hostId)
+{
+    const QSharedPointer<const Sampler::Snapshot> snapshot = Sampler::snapshot();
+    if (!snapshot) {
+        return {};
+    }
+
+    for (const Sampler::Host &host : *snapshot) {
+        if (host.id != hostId || !host.up) {
+            continue;
+        }
+
+        double committed = 0;
+        double rss       = 0;
+        for (const Connection::StatsRecord &record : host.domains) {
+            if (int(record.values.value("state.state")) == VIR_DOMAIN_RUNNING) {
+                committed += record.values.value("balloon.maximum") / 1024;
+                rss += record.values.value("balloon.rss") / 1024;
+            }
+        }
+        const double total = host.node.value("memory.total") / 1024;
+        return {
+            {QStringLiteral("total"), qRound64(total)},
+            {QStringLiteral("committed"), qRound64(committed)},
+            {QStringLiteral("rss"), qRound64(rss)},
+            {QStringLiteral("headroom"), qRound64(total - rss)},
+            {QStringLiteral("ratio"), total > 0 ? qRound64(committed / total * 100) / 100.0 : 0},
+        };
+    }
+    return {};
+}
+
+// Free memory and pages of every NUMA cell and the KSM counters
+QJsonObject hostMemory(const QString &hostId)
+{
+    const QSharedPointer<const Sampler::Snapshot> snapshot = Sampler::snapshot();
+    if (!snapshot) {
+        return {};
+    }
+
+    for (const Sampler::Host &host : *snapshot) {
+        if (host.id != hostId || !host.up) {
+            continue;
+        }
+
+        const QHash<QByteArray, double> &node = host.node;
+        QJsonArray cells;
+        // The base pages, what KSM merges
+        double pageSize = 0;
+        const int count = int(node.value("numa.count"));
+        for (int i = 0; i < count; ++i) {
+            const QByteArray prefix = "numa." + QByteArray::number(i);
+            if (!node.contains(prefix + ".total")) {
+                continue;
+            }
+
+            // e.g. "numa.0.pages.2048.total", in size order
+            QVector<uint> sizes;
+            for (auto it = node.cbegin(); it != node.cend(); ++it) {
+                if (it.key().startsWith(prefix + ".pages.") && it.key().endsWith(".total")) {
+                    sizes.append(it.key().split('.').value(3).toUInt());
+                }
+            }
+            std::sort(sizes.begin(), sizes.end());
+
+            QJsonArray pages;
+            for (uint size : sizes) {
+                const QByteArray pagePrefix = prefix + ".pages." + QByteArray::number(size);
+                auto free                   = node.constFind(pagePrefix + ".free");
+                pages.append(QJsonObject{
+                    {QStringLiteral("size"), qint64(size)},
+                    {QStringLiteral("total"), node.value(pagePrefix + ".total")},
+                    {QStringLiteral("free"),
+                     free != node.cend() ? QJsonValue(*free) : QJsonValue()},
+                });
+            }
+            if (!sizes.isEmpty() && (pageSize == 0 || sizes.constFirst() < pageSize)) {
+                pageSize = sizes.constFirst();
+            }
+
+            auto free = node.constFind(prefix + ".free");
+            cells.append(QJsonObject{
+                {QStringLiteral("id"), i},
+                {QStringLiteral("total"), qRound64(node.value(prefix + ".total") / 1024)},
+                {QStringLiteral("free"),
+                 free != node.cend() ? QJsonValue(qRound64(*free / 1024)) : QJsonValue()},
+                {QStringLiteral("pages"), pages},
+            });
+        }
+
+        QJsonObject ret{
+            {QStringLiteral("cells"), cells},
+        };
+        auto sharing = node.constFind("ksm.pages_sharing");
+        if (sharing != node.cend()) {
+            // Pages sharing a merged one are what KSM saves
+            const double saved = *sharing * (pageSize > 0 ? pageSize : 4) / 1024;
+            ret.insert(QStringLiteral("ksm"),
+                       QJsonObject{
+                           {QStringLiteral("shared"), node.value("ksm.pages_shared")},
+                           {QStringLiteral("sharing"), *sharing},
+                           {QStringLiteral("unshared"), node.value("ksm.pages_unshared")},
+                           {QStringLiteral("volatile"), node.value("ksm.pages_volatile")},
+                           {QStringLiteral("full_scans"), node.value("ksm.full_scans")},
+                           {QStringLiteral("merge_across_nodes"),
+                            node.value("ksm.merge_across_nodes") > 0},
+                           {QStringLiteral("saved"), qRound64(saved)},
+                       });
+        }
+        return ret;
+    }
+    return {};
+}
+
+} // namespace
+
 Info::Info(Virtlyst *parent)
     : Controller(parent)
     , m_virtlyst(parent)
@@ -44,59 +278,75 @@ void Info::hostusage(Context *c, const QString &hostId)
         return;
     }
 
-    int points = 5;
-    QStringList timerArray =
-        QString::fromLatin1(c->request()->cookie("timer")).split(u' ', Qt::SkipEmptyParts);
-    QStringList cpuArray =
-        QString::fromLatin1(c->request()->cookie("cpu")).split(u' ', Qt::SkipEmptyParts);
-    QStringList memArray =
-        QString::fromLatin1(c->request()->cookie("mem")).split(u' ', Qt::SkipEmptyParts);
-
-    timerArray.append(QTime::currentTime().toString());
-    cpuArray.append(QString::number(conn->allCpusUsage()));
-    memArray.append(QString::number(conn->usedMemoryKiB() / 1024));
-
-    if (timerArray.size() > points) {
-        timerArray = timerArray.mid(timerArray.size() - points);
-    }
-    if (cpuArray.size() > points) {
-        cpuArray = cpuArray.mid(cpuArray.size() - points);
-    }
-    if (memArray.size() > points) {
-        memArray = memArray.mid(memArray.size() - points);
-    }
-
-    QJsonObject cpu{
-        {QStringLiteral("labels"), QJsonArray::fromStringList(timerArray)},
+    const ChartQuery query = chartQuery(c);
+    const ChartSeries cpu  = chartSeries(query, {MetricsStore::hostSeries(hostId, "cpu")});
+    const ChartSeries mem  = chartSeries(query, {MetricsStore::hostSeries(hostId, "mem")});
+    const ChartSeries guests =
+        chartSeries(query,
+                    {MetricsStore::hostSeries(hostId, "guests.actual"),
+                     MetricsStore::hostSeries(hostId, "guests.used"),
+                     MetricsStore::hostSeries(hostId, "guests.rss")});
+
+    QJsonObject cpuChart{
+        {QStringLiteral("labels"), cpu.labels},
         {QStringLiteral("datasets"),
          QJsonArray{QJsonObject{
              {QStringLiteral("fillColor"), QStringLiteral("rgba(241,72,70,0.5)")},
              {QStringLiteral("strokeColor"), QStringLiteral("rgba(241,72,70,1)")},
              {QStringLiteral("pointColor"), QStringLiteral("rgba(241,72,70,1)")},
              {QStringLiteral("pointStrokeColor"), QStringLiteral("#fff")},
-             {QStringLiteral("data"), QJsonArray::fromStringList(cpuArray)},
+             {QStringLiteral("data"), cpu.values[0]},
          }}},
     };
 
     QJsonObject memory{
-        {QStringLiteral("labels"), QJsonArray::fromStringList(timerArray)},
+        {QStringLiteral("labels"), mem.labels},
         {QStringLiteral("datasets"),
          QJsonArray{QJsonObject{
              {QStringLiteral("fillColor"), QStringLiteral("rgba(249,134,33,0.5)")},
              {QStringLiteral("strokeColor"), QStringLiteral("rgba(249,134,33,1)")},
              {QStringLiteral("pointColor"), QStringLiteral("rgba(249,134,33,1)")},
              {QStringLiteral("pointStrokeColor"), QStringLiteral("#fff")},
-             {QStringLiteral("data"), QJsonArray::fromStringList(memArray)},
+             {QStringLiteral("data"), mem.values[0]},
          }}},
     };
 
     c->response()->setJsonObjectBody({
-        {QStringLiteral("cpu"), cpu},
+        {QStringLiteral("cpu"), cpuChart},
         {QStringLiteral("memory"), memory},
+        {QStringLiteral("guests"), lineChart(guests, {"249,134,33", "241,72,70", "83,191,189"})},
+        {QStringLiteral("overcommit"), overcommit(hostId)},
+        {QStringLiteral("host_memory"), hostMemory(hostId)},
+    });
+}
+
+void Info::cpuheatmap(Context *c, const QString &hostId)
+{
+    const int rounds = c->request()->queryParam(QStringLiteral("rounds")).toInt();
+    const CpuHeatmap::Heatmap heatmap =
+        CpuHeatmap::heatmap(hostId, rounds > 0 ? rounds : CpuHeatmap::Rounds);
+
+    QJsonArray labels;
+    for (qint64 timestamp : heatmap.timestamps) {
+        labels.append(
+            QDateTime::fromMSecsSinceEpoch(timestamp).toString(QStringLiteral("HH:mm:ss")));
+    }
+
+    // One row per CPU, so pinned and idle ones read across
+    QJsonArray usage;
+    for (int cpu = 0; cpu < heatmap.cpus; ++cpu) {
+        QJsonArray row;
+        for (qsizetype i = cpu; i < heatmap.usage.size(); i += heatmap.cpus) {
+            const quint8 value = heatmap.usage[i];
+            row.append(value == CpuHeatmap::Unknown ? QJsonValue() : QJsonValue(value));
+        }
+        usage.append(row);
+    }
+
+    c->response()->setJsonObjectBody({
+        {QStringLiteral("labels"), labels},
+        {QStringLiteral("usage"), usage},
     });
-    c->response()->setCookie(QNetworkCookie("cpu", cpuArray.join(QLatin1Char(' ')).toLatin1()));
-    c->response()->setCookie(QNetworkCookie("timer", timerArray.join(QLatin1Char(' ')).toLatin1()));
-    c->response()->setCookie(QNetworkCookie("mem", memArray.join(QLatin1Char(' ')).toLatin1()));
 }
 
 void Info::insts_status(Context *c, const QString &hostId)
@@ -151,16 +401,16 @@ void Info::inst_status(Context *c, const QString &hostId, const QString &name)
     }
 }
 
-QStringList buildArrayFromCookie(const QString &cookie, qint64 value, int points)
+void Info::clone_status(Context *c, const QString &hostId, const QString &name)
 {
-    QStringList values = cookie.split(u' ', Qt::SkipEmptyParts);
-    values.append(QString::number(value));
-
-    if (values.size() > points) {
-        values = values.mid(values.size() - points);
+    Connection *conn = m_virtlyst->connection(hostId, c);
+    if (conn == nullptr) {
+        qWarning() << "Host id not found or connection not active";
+        c->response()->redirect(c->uriForAction(QStringLiteral("/index")));
+        return;
     }
 
-    return values;
+    c->response()->setJsonObjectBody(CloneJob::progress(hostId, name, conn));
 }
 
 void Info::instusage(Context *c, const QString &hostId, const QString &name)
@@ -181,121 +431,240 @@ void Info::instusage(Context *c, const QString &hostId, const QString &name)
         return;
     }
 
-    int points = 5;
-    QStringList timerArray =
-        QString::fromLatin1(c->request()->cookie("timer")).split(u' ', Qt::SkipEmptyParts);
-    QStringList cpuArray =
-        QString::fromLatin1(c->request()->cookie("cpu")).split(u' ', Qt::SkipEmptyParts);
-
-    timerArray.append(QTime::currentTime().toString());
-    cpuArray.append(QString::number(dom->cpuUsage()));
-
-    if (timerArray.size() > points) {
-        timerArray = timerArray.mid(timerArray.size() - points);
-    }
-    if (cpuArray.size() > points) {
-        cpuArray = cpuArray.mid(cpuArray.size() - points);
-    }
+    const QString uuid = dom->uuid();
+    const ChartQuery query = chartQuery(c);
+    const ChartSeries cpu =
+        chartSeries(query, {MetricsStore::domainSeries(hostId, uuid, QByteArrayLiteral("cpu"))});
 
-    QJsonObject cpu{
-        {QStringLiteral("labels"), QJsonArray::fromStringList(timerArray)},
+    QJsonObject cpuChart{
+        {QStringLiteral("labels"), cpu.labels},
         {QStringLiteral("datasets"),
          QJsonArray{QJsonObject{
              {QStringLiteral("fillColor"), QStringLiteral("rgba(241,72,70,0.5)")},
              {QStringLiteral("strokeColor"), QStringLiteral("rgba(241,72,70,1)")},
              {QStringLiteral("pointColor"), QStringLiteral("rgba(241,72,70,1)")},
              {QStringLiteral("pointStrokeColor"), QStringLiteral("#fff")},
-             {QStringLiteral("data"), QJsonArray::fromStringList(cpuArray)},
+             {QStringLiteral("data"), cpu.values[0]},
          }}},
     };
-    c->response()->setCookie(QNetworkCookie("cpu", cpuArray.join(QLatin1Char(' ')).toLatin1()));
+
+    // Devices as of the last sample, the history itself never asks libvirt
+    int vcpus = 0;
+    int nets  = 0;
+    QStringList disks;
+    if (const auto snapshot = Sampler::snapshot()) {
+        for (const Sampler::Host &host : *snapshot) {
+            if (host.id != hostId) {
+                continue;
+            }
+            for (const Connection::StatsRecord &record : host.domains) {
+                if (record.uuid == uuid) {
+                    vcpus            = int(record.values.value("vcpu.maximum"));
+                    nets             = int(record.values.value("net.count"));
+                    const int blocks = int(record.values.value("block.count"));
+                    for (int i = 0; i < blocks; ++i) {
+                        disks.append(record.strings.value("block." + QByteArray::number(i) +
+                                                          ".name"));
+                    }
+                    break;
+                }
+            }
+        }
+    }
 
     QJsonArray net;
-    const QVector<std::pair<qint64, qint64>> net_usage = dom->netUsageMiBs();
-
-    int netDev = 0;
-    for (const std::pair<qint64, qint64> &rx_tx : net_usage) {
-        const auto cookieRx       = "net-rx-" + QByteArray::number(netDev);
-        const auto cookieTx       = "net-tx-" + QByteArray::number(netDev);
-        const QString rx          = c->request()->cookie(cookieRx);
-        const QString tx          = c->request()->cookie(cookieTx);
-        const QStringList rxArray = buildArrayFromCookie(rx, rx_tx.first, points);
-        const QStringList txArray = buildArrayFromCookie(tx, rx_tx.second, points);
-        c->response()->setCookie(
-            QNetworkCookie(cookieRx, rxArray.join(QLatin1Char(' ')).toLatin1()));
-        c->response()->setCookie(
-            QNetworkCookie(cookieTx, txArray.join(QLatin1Char(' ')).toLatin1()));
+    for (int netDev = 0; netDev < nets; ++netDev) {
+        const QByteArray prefix = "net." + QByteArray::number(netDev);
+        // Downsampled together so that both keep the labels
+        const ChartSeries rxTx =
+            chartSeries(query,
+                        {MetricsStore::domainSeries(hostId, uuid, prefix + ".rx"),
+                         MetricsStore::domainSeries(hostId, uuid, prefix + ".tx")});
 
         QJsonObject network{
-            {QStringLiteral("labels"), QJsonArray::fromStringList(timerArray)},
+            {QStringLiteral("labels"), rxTx.labels},
             {QStringLiteral("datasets"),
              QJsonArray{QJsonObject{
                             {QStringLiteral("fillColor"), QStringLiteral("rgba(83,191,189,0.5)")},
                             {QStringLiteral("strokeColor"), QStringLiteral("rgba(83,191,189,1)")},
                             {QStringLiteral("pointColor"), QStringLiteral("rgba(83,191,189,1)")},
                             {QStringLiteral("pointStrokeColor"), QStringLiteral("#fff")},
-                            {QStringLiteral("data"), QJsonArray::fromStringList(rxArray)},
+                            {QStringLiteral("data"), rxTx.values[0]},
                         },
                         QJsonObject{
                             {QStringLiteral("fillColor"), QStringLiteral("rgba(249,134,33,0.5)")},
                             {QStringLiteral("strokeColor"), QStringLiteral("rgba(249,134,33,1)")},
                             {QStringLiteral("pointColor"), QStringLiteral("rgba(1249,134,33,1)")},
                             {QStringLiteral("pointStrokeColor"), QStringLiteral("#fff")},
-                            {QStringLiteral("data"), QJsonArray::fromStringList(txArray)},
+                            {QStringLiteral("data"), rxTx.values[1]},
                         }}},
         };
         net.append(QJsonObject{
-            {QStringLiteral("dev"), netDev++},
+            {QStringLiteral("dev"), netDev},
             {QStringLiteral("data"), network},
         });
     }
 
     QJsonArray hdd;
-
-    const QMap<QString, std::pair<qint64, qint64>> hdd_usage = dom->hddUsageMiBs();
-
-    auto it = hdd_usage.constBegin();
-    while (it != hdd_usage.constEnd()) {
-        const std::pair<qint64, qint64> &rd_wr = it.value();
-        const auto cookieRd                    = "hdd-rd-" + it.key().toLatin1();
-        const auto cookieWr                    = "hdd-wr-" + it.key().toLatin1();
-        const QString rd                       = c->request()->cookie(cookieRd);
-        const QString wr                       = c->request()->cookie(cookieWr);
-        const QStringList rdArray              = buildArrayFromCookie(rd, rd_wr.first, points);
-        const QStringList wrArray              = buildArrayFromCookie(wr, rd_wr.second, points);
-        c->response()->setCookie(QNetworkCookie(cookieRd, rdArray.join(u' ').toLatin1()));
-        c->response()->setCookie(QNetworkCookie(cookieWr, wrArray.join(u' ').toLatin1()));
+    for (const QString &disk : disks) {
+        const QByteArray prefix = "block." + disk.toUtf8();
+        const ChartSeries rdWr =
+            chartSeries(query,
+                        {MetricsStore::domainSeries(hostId, uuid, prefix + ".rd"),
+                         MetricsStore::domainSeries(hostId, uuid, prefix + ".wr")});
 
         QJsonObject network{
-            {QStringLiteral("labels"), QJsonArray::fromStringList(timerArray)},
+            {QStringLiteral("labels"), rdWr.labels},
             {QStringLiteral("datasets"),
              QJsonArray{QJsonObject{
                             {QStringLiteral("fillColor"), QStringLiteral("rgba(83,191,189,0.5)")},
                             {QStringLiteral("strokeColor"), QStringLiteral("rgba(83,191,189,1)")},
                             {QStringLiteral("pointColor"), QStringLiteral("rgba(83,191,189,1)")},
                             {QStringLiteral("pointStrokeColor"), QStringLiteral("#fff")},
-                            {QStringLiteral("data"), QJsonArray::fromStringList(rdArray)},
+                            {QStringLiteral("data"), rdWr.values[0]},
                         },
                         QJsonObject{
                             {QStringLiteral("fillColor"), QStringLiteral("rgba(151,187,205,0.5)")},
                             {QStringLiteral("strokeColor"), QStringLiteral("rgba(151,187,205,1)")},
                             {QStringLiteral("pointColor"), QStringLiteral("rgba(151,187,205,1)")},
                             {QStringLiteral("pointStrokeColor"), QStringLiteral("#fff")},
-                            {QStringLiteral("data"), QJsonArray::fromStringList(wrArray)},
+                            {QStringLiteral("data"), rdWr.values[1]},
                         }}},
         };
         hdd.append(QJsonObject{
-            {QStringLiteral("dev"), it.key()},
+            {QStringLiteral("dev"), disk},
             {QStringLiteral("data"), network},
         });
+    }
 
-        ++it;
+    // Balloon stats, used and swap need the guest driver to report them
+    const ChartSeries memory =
+        chartSeries(query,
+                    {MetricsStore::domainSeries(hostId, uuid, "mem.actual"),
+                     MetricsStore::domainSeries(hostId, uuid, "mem.used"),
+                     MetricsStore::domainSeries(hostId, uuid, "mem.rss")});
+    const ChartSeries swap =
+        chartSeries(query,
+                    {MetricsStore::domainSeries(hostId, uuid, "mem.swap_in"),
+                     MetricsStore::domainSeries(hostId, uuid, "mem.swap_out")});
+    const ChartSeries faults =
+        chartSeries(query, {MetricsStore::domainSeries(hostId, uuid, "mem.major_faults")});
+
+    // One line per vCPU, in % of a host CPU
+    QVector<QByteArray> vcpuTime;
+    QVector<QByteArray> vcpuWait;
+    QVector<QByteArray> vcpuDelay;
+    QVector<const char *> vcpuColors;
+    QStringList vcpuLabels;
+    for (int i = 0; i < vcpus; ++i) {
+        const QByteArray prefix = "vcpu." + QByteArray::number(i);
+        vcpuTime.append(MetricsStore::domainSeries(hostId, uuid, prefix + ".time"));
+        vcpuWait.append(MetricsStore::domainSeries(hostId, uuid, prefix + ".wait"));
+        vcpuDelay.append(MetricsStore::domainSeries(hostId, uuid, prefix + ".delay"));
+        vcpuColors.append(VcpuColors[i % std::size(VcpuColors)]);
+        vcpuLabels.append(QStringLiteral("vCPU %1").arg(i));
     }
+    const ChartSeries halted =
+        chartSeries(query, {MetricsStore::domainSeries(hostId, uuid, "vcpu.halted")});
+
+    // Only the perf events enabled on the instance have points
+    const ChartSeries cacheMisses =
+        chartSeries(query, {MetricsStore::domainSeries(hostId, uuid, "perf.cache_misses")});
+    const ChartSeries cycles =
+        chartSeries(query,
+                    {MetricsStore::domainSeries(hostId, uuid, "perf.cycles"),
+                     MetricsStore::domainSeries(hostId, uuid, "perf.instructions")});
+    const ChartSeries ipc =
+        chartSeries(query, {MetricsStore::domainSeries(hostId, uuid, "perf.ipc")});
+    const ChartSeries cmt =
+        chartSeries(query, {MetricsStore::domainSeries(hostId, uuid, "perf.cmt")});
+    const ChartSeries mbm =
+        chartSeries(query,
+                    {MetricsStore::domainSeries(hostId, uuid, "perf.mbmt"),
+                     MetricsStore::domainSeries(hostId, uuid, "perf.mbml")});
 
     c->response()->setJsonObjectBody({
-        {QStringLiteral("cpu"), cpu},
+        {QStringLiteral("cpu"), cpuChart},
+        {QStringLiteral("vcpu_time"),
+         lineChart(chartSeries(query, vcpuTime), vcpuColors, vcpuLabels)},
+        {QStringLiteral("vcpu_wait"),
+         lineChart(chartSeries(query, vcpuWait), vcpuColors, vcpuLabels)},
+        {QStringLiteral("vcpu_delay"),
+         lineChart(chartSeries(query, vcpuDelay), vcpuColors, vcpuLabels)},
+        {QStringLiteral("vcpu_halted"), lineChart(halted, {"151,187,205"})},
         {QStringLiteral("hdd"), hdd},
         {QStringLiteral("net"), net},
+        {QStringLiteral("memory"), lineChart(memory, {"249,134,33", "241,72,70", "83,191,189"})},
+        {QStringLiteral("swap"), lineChart(swap, {"83,191,189", "151,187,205"})},
+        {QStringLiteral("faults"), lineChart(faults, {"241,72,70"})},
+        {QStringLiteral("perf_cache_misses"), lineChart(cacheMisses, {"241,72,70"})},
+        {QStringLiteral("perf_cycles"), lineChart(cycles, {"249,134,33", "83,191,189"})},
+        {QStringLiteral("perf_ipc"), lineChart(ipc, {"151,187,205"})},
+        {QStringLiteral("perf_cmt"), lineChart(cmt, {"83,191,189"})},
+        {QStringLiteral("perf_mbm"), lineChart(mbm, {"83,191,189", "151,187,205"})},
+    });
+}
+
+void Info::top(Context *c)
+{
+    const QSharedPointer<const Fleet::Table> table = Fleet::table();
+    const int metric =
+        Fleet::metric(c->request()->queryParam(QStringLiteral("metric"), QStringLiteral("cpu")));
+    if (metric < 0) {
+        c->response()->setJsonObjectBody({
+            {QStringLiteral("error"), QStringLiteral("Unknown metric")},
+        });
+        return;
+    }
+    if (!table) {
+        c->response()->setJsonObjectBody({
+            {QStringLiteral("error"), QStringLiteral("Hosts were not sampled yet")},
+        });
+        return;
+    }
+
+    int host             = -1;
+    const QString hostId = c->request()->queryParam(QStringLiteral("host"));
+    if (!hostId.isEmpty()) {
+        host = int(table->hostIds.indexOf(hostId));
+        if (host < 0) {
+            c->response()->setJsonObjectBody({
+                {QStringLiteral("error"), QStringLiteral("Host not found: %1").arg(hostId)},
+            });
+            return;
+        }
+    }
+    const int n = c->request()->queryParam(QStringLiteral("n")).toInt();
+
+    const auto value = [](float value) {
+        return std::isnan(value) ? QJsonValue() : QJsonValue(qRound64(value * 100) / 100.0);
+    };
+
+    const auto sortBy              = Fleet::Metric(metric);
+    const QVector<float> quantiles = table->percentiles(sortBy, {0.5, 0.9, 0.99}, host);
+
+    QJsonArray top;
+    const QVector<int> ids = table->top(sortBy, n > 0 ? qMin(n, 100) : 10, host);
+    for (int id : ids) {
+        QJsonObject vm{
+            {QStringLiteral("host_id"), table->hostIds[table->host[id]]},
+            {QStringLiteral("host"), table->hostNames[table->host[id]]},
+            {QStringLiteral("uuid"), table->uuid[id]},
+            {QStringLiteral("name"), table->name[id]},
+        };
+        for (int i = 0; i < Fleet::MetricCount; ++i) {
+            vm.insert(Fleet::metricName(Fleet::Metric(i)), value(table->columns[i][id]));
+        }
+        top.append(vm);
+    }
+
+    c->response()->setJsonObjectBody({
+        {QStringLiteral("metric"), Fleet::metricName(sortBy)},
+        {QStringLiteral("timestamp"), table->timestamp},
+        {QStringLiteral("count"), table->count(sortBy, host)},
+        {QStringLiteral("p50"), value(quantiles[0])},
+        {QStringLiteral("p90"), value(quantiles[1])},
+        {QStringLiteral("p99"), value(quantiles[2])},
+        {QStringLiteral("top"), top},
     });
-    c->response()->setCookie(QNetworkCookie("timer", timerArray.join(QLatin1Char(' ')).toLatin1()));
 }
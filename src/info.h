@@ -31,15 +31,26 @@ public:
     C_ATTR(hostusage, :Local :AutoArgs)
     void hostusage(Context *c, const QString &hostId);
 
+    // Busy % of every host CPU over the last ?rounds= sampler rounds
+    C_ATTR(cpuheatmap, :Local :AutoArgs)
+    void cpuheatmap(Context *c, const QString &hostId);
+
     C_ATTR(insts_status, :Local :AutoArgs)
     void insts_status(Context *c, const QString &hostId);
 
     C_ATTR(inst_status, :Local :AutoArgs)
     void inst_status(Context *c, const QString &hostId, const QString &name);
 
+    C_ATTR(clone_status, :Local :AutoArgs)
+    void clone_status(Context *c, const QString &hostId, const QString &name);
+
     C_ATTR(instusage, :Local :AutoArgs)
     void instusage(Context *c, const QString &hostId, const QString &name);
 
+    // Heaviest domains of all hosts by ?metric=, ?host= narrows it to one
+    C_ATTR(top, :Local :AutoArgs)
+    void top(Context *c);
+
 private Q_SLOTS:
     void End(Context *c) { Q_UNUSED(c); }
 
@@ -18,12 +18,15 @@
 
 #include "lib/connection.h"
 #include "lib/domain.h"
+#include "lib/libvirtstats.h"
 #include "virtlyst.h"
 
 #include <libvirt/libvirt.h>
 
 #include <QDebug>
 
+#include <algorithm>
+
 using namespace Cutelyst;
 
 Infrastructure::Infrastructure(Virtlyst *parent)
@@ -72,3 +75,56 @@ void Infrastructure::index(Context *c)
     c->setStash(QStringLiteral("hosts_vms"), hosts);
     c->setStash(QStringLiteral("template"), QStringLiteral("infrastructure.html"));
 }
+
+void Infrastructure::top(Context *c)
+{
+    // The ranking itself is polled from /info/top
+    QVariantList hosts;
+    const QVector<ServerConn *> conns = m_virtlyst->servers(c);
+    for (ServerConn *server : conns) {
+        hosts.append(QVariantHash{
+            {QStringLiteral("id"), server->id},
+            {QStringLiteral("name"), server->name},
+        });
+    }
+
+    c->setStash(QStringLiteral("hosts"), hosts);
+    c->setStash(QStringLiteral("template"), QStringLiteral("top.html"));
+}
+
+void Infrastructure::diagnostics(Context *c)
+{
+    struct Row {
+        QString host;
+        QByteArray function;
+        LibvirtStats::Latency latency;
+        qint64 p99;
+    };
+
+    // Slowest first, the tail is what makes pages wait
+    QVector<Row> rows;
+    const auto latencies = LibvirtStats::latencies();
+    for (auto it = latencies.cbegin(); it != latencies.cend(); ++it) {
+        rows.append({it.key().first, it.key().second, it.value(), it.value().quantile(0.99)});
+    }
+    std::sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) { return a.p99 > b.p99; });
+
+    const auto ms = [](qint64 us) { return QString::number(us / 1000.0, 'f', 2); };
+    QVariantList calls;
+    for (const Row &row : rows) {
+        const LibvirtStats::Latency &latency = row.latency;
+        calls.append(QVariantHash{
+            {QStringLiteral("host"), row.host},
+            {QStringLiteral("function"), QString::fromLatin1(row.function)},
+            {QStringLiteral("calls"), latency.count},
+            {QStringLiteral("mean"), ms(latency.count ? latency.sum / latency.count : 0)},
+            {QStringLiteral("p50"), ms(latency.quantile(0.5))},
+            {QStringLiteral("p90"), ms(latency.quantile(0.9))},
+            {QStringLiteral("p99"), ms(row.p99)},
+            {QStringLiteral("max"), ms(latency.max)},
+        });
+    }
+
+    c->setStash(QStringLiteral("calls"), calls);
+    c->setStash(QStringLiteral("template"), QStringLiteral("diagnostics.html"));
+}
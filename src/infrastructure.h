@@ -31,6 +31,12 @@ public:
     C_ATTR(index, :Path :AutoArgs)
     void index(Context *c);
 
+    C_ATTR(top, :Local :AutoArgs)
+    void top(Context *c);
+
+    C_ATTR(diagnostics, :Local :AutoArgs)
+    void diagnostics(Context *c);
+
 private:
     Virtlyst *m_virtlyst;
 };
@@ -16,6 +16,7 @@
  */
 #include "instances.h"
 
+#include "clonejob.h"
 #include "lib/connection.h"
 #include "lib/domain.h"
 #include "lib/domainsnapshot.h"
@@ -133,6 +134,14 @@ void Instances::instance(Context *c, const QString &hostId, const QString &name)
         } else if (params.contains(QStringLiteral("set_autostart"))) {
             dom->setAutostart(true);
             redir = true;
+        } else if (params.contains(QStringLiteral("set_perf_events"))) {
+            const QStringList failed =
+                dom->setPerfEvents(params.values(QStringLiteral("perf_event")));
+            if (!failed.isEmpty()) {
+                errors.append(QStringLiteral("Failed to change the perf events: %1")
+                                  .arg(failed.join(QLatin1String(", "))));
+            }
+            redir = errors.isEmpty();
         } else if (params.contains(QStringLiteral("delete"))) {
             if (dom->status() == VIR_DOMAIN_RUNNING) {
                 dom->destroy();
@@ -153,6 +162,63 @@ void Instances::instance(Context *c, const QString &hostId, const QString &name)
 
             c->response()->redirect(c->uriFor(CActionFor(u"index"), QStringList{hostId}));
             return;
+        } else if (params.contains(QStringLiteral("flatten_disk"))) {
+            const QString dev = params.value(QStringLiteral("flatten_disk"));
+            if (!dom->blockPull(dev)) {
+                errors.append(conn->lastError());
+            }
+            redir = true;
+        } else if (params.contains(QStringLiteral("clone"))) {
+            const QString cloneName = params.value(QStringLiteral("name"));
+
+            QStringList macs;
+            for (int i = 0; params.contains(QStringLiteral("net-%1").arg(i)); ++i) {
+                macs.append(params.value(QStringLiteral("net-%1").arg(i)));
+            }
+
+            QVector<CloneJob::Disk> disks;
+            const QVariantList cloneDisks = dom->cloneDisks();
+            for (const QVariant &var : cloneDisks) {
+                const auto disk   = var.value<QHash<QString, QString>>();
+                const QString dev = disk.value(QStringLiteral("dev"));
+
+                CloneJob::Disk job;
+                job.dev    = dev;
+                job.source = disk.value(QStringLiteral("path"));
+                job.pool   = disk.value(QStringLiteral("storage"));
+                job.format = disk.value(QStringLiteral("format"));
+                job.target =
+                    params.value(QLatin1String("disk-") + dev, disk.value(QStringLiteral("image")));
+                job.metadata = params.contains(QLatin1String("meta-") + dev);
+                disks.append(job);
+            }
+
+            // Their storage would end up shared by both domains
+            const QStringList uncloned = dom->uncloneableDisks();
+
+            const int perPool  = m_virtlyst->config(QStringLiteral("ClonePerPool"), 2).toInt();
+            ServerConn *server = m_virtlyst->server(hostId);
+            QString error;
+            if (cloneName.isEmpty() || conn->getDomainByName(cloneName, c)) {
+                errors.append(QStringLiteral("A virtual machine with this name already exists"));
+            } else if (dom->status() != VIR_DOMAIN_SHUTOFF) {
+                errors.append(QStringLiteral("The instance must be shut off to be cloned"));
+            } else if (!uncloned.isEmpty()) {
+                errors.append(QStringLiteral("Disks outside of a storage pool can't be cloned: %1")
+                                  .arg(uncloned.join(QLatin1String(", "))));
+            } else if (!server ||
+                       !CloneJob::start(server->url,
+                                        server->name,
+                                        hostId,
+                                        name,
+                                        cloneName,
+                                        macs,
+                                        disks,
+                                        perPool,
+                                        &error)) {
+                errors.append(error);
+            }
+            redir = errors.isEmpty();
         } else if (params.contains(QStringLiteral("change_xml"))) {
             const QString xml = params.value(QStringLiteral("inst_xml"));
             conn->domainDefineXml(xml);
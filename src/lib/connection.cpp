@@ -19,6 +19,7 @@
 
 #include "domain.h"
 #include "interface.h"
+#include "libvirtstats.h"
 #include "network.h"
 #include "nodedevice.h"
 #include "secret.h"
@@ -28,12 +29,12 @@
 
 #include <libvirt/virterror.h>
 
-#include <QEventLoop>
 #include <QLoggingCategory>
-#include <QTimer>
 #include <QUrl>
 #include <QXmlStreamWriter>
 
+#include <algorithm>
+
 Q_LOGGING_CATEGORY(VIRT_CONN, "virt.connection")
 
 static int authCreds[] = {
@@ -102,6 +103,7 @@ Connection::Connection(const QUrl &url, const QString &name, QObject *parent)
         qCWarning(VIRT_CONN) << "Failed to open connection to" << url;
         return;
     }
+    LibvirtStats::setHostName(m_conn, m_connName);
     qCDebug(VIRT_CONN) << "Connected to" << uri;
 }
 
@@ -120,6 +122,9 @@ QString Connection::name() const
 void Connection::setName(const QString &name)
 {
     m_connName = name;
+    if (m_conn) {
+        LibvirtStats::setHostName(m_conn, name);
+    }
 }
 
 Connection *Connection::clone(QObject *parent)
@@ -131,15 +136,31 @@ Connection *Connection::clone(QObject *parent)
 
 QString Connection::uri() const
 {
-    return QString::fromUtf8(virConnectGetURI(m_conn));
+    char *uri;
+    {
+        LibvirtStats::Call call(m_conn, "virConnectGetURI");
+        uri = virConnectGetURI(m_conn);
+    }
+    const QString ret = QString::fromUtf8(uri);
+    free(uri);
+    return ret;
+}
+
+bool Connection::isLocal() const
+{
+    return QUrl(uri()).host().isEmpty();
 }
 
 QString Connection::hostname() const
 {
     QString ret;
     if (m_conn) {
-        char *host = virConnectGetHostname(m_conn);
-        ret        = QString::fromUtf8(host);
+        char *host;
+        {
+            LibvirtStats::Call call(m_conn, "virConnectGetHostname");
+            host = virConnectGetHostname(m_conn);
+        }
+        ret = QString::fromUtf8(host);
         free(host);
     }
     return ret;
@@ -153,6 +174,7 @@ QString Connection::hypervisor() const
 quint64 Connection::freeMemoryBytes() const
 {
     if (m_conn) {
+        LibvirtStats::Call call(m_conn, "virNodeGetFreeMemory");
         return virNodeGetFreeMemory(m_conn);
     }
     return 0;
@@ -196,6 +218,7 @@ bool Connection::isAlive()
     if (m_conn) {
         // This is will still return true when the connection
         // closed but no request has been made
+        LibvirtStats::Call call(m_conn, "virConnectIsAlive");
         return virConnectIsAlive(m_conn) == 1;
     }
     return false;
@@ -203,6 +226,7 @@ bool Connection::isAlive()
 
 int Connection::maxVcpus() const
 {
+    LibvirtStats::Call call(m_conn, "virConnectGetMaxVcpus");
     return virConnectGetMaxVcpus(m_conn, NULL);
 }
 
@@ -281,80 +305,6 @@ bool Connection::kvmSupported()
     return false;
 }
 
-struct cpu_stats {
-    quint64 user;
-    quint64 sys;
-    quint64 idle;
-    quint64 iowait;
-    quint64 util;
-    bool utilization = false;
-};
-
-bool getCPUStats(virConnectPtr conn, int cpuNum, int nparams, cpu_stats &stats)
-{
-    virNodeCPUStats params[nparams];
-    if (virNodeGetCPUStats(conn, cpuNum, params, &nparams, 0) == 0) {
-        for (int i = 0; i < nparams; ++i) {
-            quint64 value = params[i].value;
-
-            if (strcmp(params[i].field, VIR_NODE_CPU_STATS_KERNEL) == 0)
-                stats.sys = value;
-
-            if (strcmp(params[i].field, VIR_NODE_CPU_STATS_USER) == 0)
-                stats.user = value;
-
-            if (strcmp(params[i].field, VIR_NODE_CPU_STATS_IDLE) == 0)
-                stats.idle = value;
-
-            if (strcmp(params[i].field, VIR_NODE_CPU_STATS_IOWAIT) == 0)
-                stats.iowait = value;
-
-            if (strcmp(params[i].field, VIR_NODE_CPU_STATS_UTILIZATION) == 0) {
-                stats.util        = value;
-                stats.utilization = true;
-            }
-        }
-        return true;
-    }
-    return false;
-}
-
-int Connection::allCpusUsage()
-{
-    int nparams = 0;
-    if (virNodeGetCPUStats(m_conn, VIR_NODE_CPU_STATS_ALL_CPUS, NULL, &nparams, 0) == 0 &&
-        nparams != 0) {
-        cpu_stats t0;
-        if (!getCPUStats(m_conn, VIR_NODE_CPU_STATS_ALL_CPUS, nparams, t0)) {
-            return -1;
-        }
-
-        if (t0.utilization) {
-            return t0.util;
-        }
-
-        QEventLoop loop;
-        QTimer::singleShot(1000, &loop, &QEventLoop::quit);
-        loop.exec();
-
-        cpu_stats t1;
-        if (!getCPUStats(m_conn, VIR_NODE_CPU_STATS_ALL_CPUS, nparams, t1)) {
-            return -1;
-        }
-
-        double user_time   = t1.user - t0.user;
-        double sys_time    = t1.sys - t0.sys;
-        double idle_time   = t1.idle - t0.idle;
-        double iowait_time = t1.iowait - t0.iowait;
-        double total_time  = user_time + sys_time + idle_time + iowait_time;
-
-        double usage = (user_time + sys_time) / total_time * 100;
-
-        return usage;
-    }
-    return -1;
-}
-
 QStringList Connection::isoMedia()
 {
     // TODO cache results
@@ -395,7 +345,11 @@ QString Connection::lastError()
 
 bool Connection::domainDefineXml(const QString &xml)
 {
-    virDomainPtr dom = virDomainDefineXML(m_conn, xml.toUtf8().constData());
+    virDomainPtr dom;
+    {
+        LibvirtStats::Call call(m_conn, "virDomainDefineXML");
+        dom = virDomainDefineXML(m_conn, xml.toUtf8().constData());
+    }
     if (dom) {
         virDomainFree(dom);
         return true;
@@ -413,6 +367,28 @@ bool Connection::createDomain(const QString &name,
                               const QStringList &networks,
                               bool virtIO,
                               const QString &consoleType)
+{
+    QVector<DiskSource> disks;
+    for (StorageVol *vol : images) {
+        disks.append({vol->path(), vol->type()});
+    }
+
+    const QString xml = domainXml(
+        name, memory, vcpu, hostModel, uuid, disks, cacheMode, networks, virtIO, consoleType);
+    qCDebug(VIRT_CONN) << "XML output" << xml;
+    return domainDefineXml(xml);
+}
+
+QString Connection::domainXml(const QString &name,
+                              const QString &memory,
+                              const QString &vcpu,
+                              bool hostModel,
+                              const QString &uuid,
+                              const QVector<DiskSource> &disks,
+                              const QString &cacheMode,
+                              const QStringList &networks,
+                              bool virtIO,
+                              const QString &consoleType)
 {
     QByteArray output;
     QXmlStreamWriter stream(&output);
@@ -465,8 +441,8 @@ bool Connection::createDomain(const QString &name,
     stream.writeStartElement(QStringLiteral("devices"));
     {
         QVector<char> letters = {'a', 'b', 'c', 'd', 'e'}; //....
-        for (StorageVol *vol : images) {
-            const QString type = vol->type();
+        for (const DiskSource &disk : disks) {
+            const QString &type = disk.type;
 
             stream.writeStartElement(QStringLiteral("disk"));
             stream.writeAttribute(QStringLiteral("device"), QStringLiteral("disk"));
@@ -490,19 +466,19 @@ bool Connection::createDomain(const QString &name,
 
                 stream.writeEmptyElement(QStringLiteral("source"));
                 stream.writeAttribute(QStringLiteral("type"), QStringLiteral("rbd"));
-                stream.writeAttribute(QStringLiteral("name"), vol->path());
+                stream.writeAttribute(QStringLiteral("name"), disk.path);
             } else {
                 stream.writeAttribute(QStringLiteral("type"), QStringLiteral("file"));
 
                 stream.writeEmptyElement(QStringLiteral("driver"));
                 stream.writeAttribute(QStringLiteral("name"), QStringLiteral("qemu"));
-                stream.writeAttribute(QStringLiteral("type"), vol->type());
+                stream.writeAttribute(QStringLiteral("type"), type);
                 if (!cacheMode.isEmpty()) {
                     stream.writeAttribute(QStringLiteral("cache"), cacheMode);
                 }
 
                 stream.writeEmptyElement(QStringLiteral("source"));
-                stream.writeAttribute(QStringLiteral("file"), vol->path());
+                stream.writeAttribute(QStringLiteral("file"), disk.path);
             }
 
             stream.writeEmptyElement(QStringLiteral("target"));
@@ -597,15 +573,281 @@ bool Connection::createDomain(const QString &name,
     stream.writeEndElement(); // devices
 
     stream.writeEndElement(); // domain
-    qCDebug(VIRT_CONN) << "XML output" << output.constData();
-    return domainDefineXml(QString::fromUtf8(output));
+    return QString::fromUtf8(output);
+}
+
+QVector<Connection::StatsRecord> Connection::allDomainStats(uint stats, uint flags)
+{
+    QVector<StatsRecord> ret;
+    virDomainStatsRecordPtr *records = nullptr;
+    int count;
+    {
+        LibvirtStats::Call call(m_conn, "virConnectGetAllDomainStats");
+        count = virConnectGetAllDomainStats(m_conn, stats, &records, flags);
+    }
+    if (count < 0) {
+        qCWarning(VIRT_CONN) << "Failed to get domain stats" << lastError();
+        return ret;
+    }
+
+    ret.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        StatsRecord record;
+        char uuid[VIR_UUID_STRING_BUFLEN];
+        if (virDomainGetUUIDString(records[i]->dom, uuid) == 0) {
+            record.uuid = QString::fromLatin1(uuid);
+        }
+        record.name = QString::fromUtf8(virDomainGetName(records[i]->dom));
+
+        record.values.reserve(records[i]->nparams);
+        for (int j = 0; j < records[i]->nparams; ++j) {
+            const virTypedParameter &param = records[i]->params[j];
+            const QByteArray field(param.field);
+            switch (param.type) {
+            case VIR_TYPED_PARAM_INT:
+                record.values.insert(field, param.value.i);
+                break;
+            case VIR_TYPED_PARAM_UINT:
+                record.values.insert(field, param.value.ui);
+                break;
+            case VIR_TYPED_PARAM_LLONG:
+                record.values.insert(field, param.value.l);
+                break;
+            case VIR_TYPED_PARAM_ULLONG:
+                record.values.insert(field, param.value.ul);
+                break;
+            case VIR_TYPED_PARAM_DOUBLE:
+                record.values.insert(field, param.value.d);
+                break;
+            case VIR_TYPED_PARAM_BOOLEAN:
+                record.values.insert(field, param.value.b ? 1 : 0);
+                break;
+            case VIR_TYPED_PARAM_STRING:
+                record.strings.insert(field, QString::fromUtf8(param.value.s));
+                break;
+            }
+        }
+        ret.append(record);
+    }
+    virDomainStatsRecordListFree(records);
+
+    return ret;
+}
+
+QHash<QByteArray, double> Connection::nodeStats()
+{
+    QHash<QByteArray, double> ret;
+
+    QVector<virNodeCPUStats> cpu;
+    int ncpu = 0;
+    {
+        LibvirtStats::Call call(m_conn, "virNodeGetCPUStats");
+        const int all = VIR_NODE_CPU_STATS_ALL_CPUS;
+        if (virNodeGetCPUStats(m_conn, all, nullptr, &ncpu, 0) == 0 && ncpu) {
+            cpu.resize(ncpu);
+            if (virNodeGetCPUStats(m_conn, all, cpu.data(), &ncpu, 0) < 0) {
+                ncpu = 0;
+            }
+        }
+    }
+    for (int i = 0; i < ncpu; ++i) {
+        ret.insert(QByteArrayLiteral("cpu.") + cpu[i].field, double(cpu[i].value));
+    }
+
+    QVector<virNodeMemoryStats> mem;
+    const int cells = VIR_NODE_MEMORY_STATS_ALL_CELLS;
+    int nmem        = 0;
+    {
+        LibvirtStats::Call call(m_conn, "virNodeGetMemoryStats");
+        if (virNodeGetMemoryStats(m_conn, cells, nullptr, &nmem, 0) == 0 && nmem) {
+            mem.resize(nmem);
+            if (virNodeGetMemoryStats(m_conn, cells, mem.data(), &nmem, 0) < 0) {
+                nmem = 0;
+            }
+        }
+    }
+    for (int i = 0; i < nmem; ++i) {
+        ret.insert(QByteArrayLiteral("memory.") + mem[i].field, double(mem[i].value));
+    }
+
+    numaStats(ret);
+    ksmStats(ret);
+
+    return ret;
+}
+
+void Connection::numaStats(QHash<QByteArray, double> &stats)
+{
+    if (!m_domainCapabilitiesLoaded && !loadDomainCapabilities()) {
+        return;
+    }
+
+    // Sizes and totals only change with the boot time configuration
+    QVector<int> cells;
+    QVector<uint> pageSizes;
+    QDomElement cell = m_xmlCapsDoc.documentElement()
+                           .firstChildElement(QStringLiteral("host"))
+                           .firstChildElement(QStringLiteral("topology"))
+                           .firstChildElement(QStringLiteral("cells"))
+                           .firstChildElement(QStringLiteral("cell"));
+    while (!cell.isNull()) {
+        const int id            = cell.attribute(QStringLiteral("id")).toInt();
+        const QByteArray prefix = "numa." + QByteArray::number(id);
+        cells.append(id);
+        stats.insert(prefix + ".total",
+                     cell.firstChildElement(QStringLiteral("memory")).text().toDouble());
+
+        QDomElement pages = cell.firstChildElement(QStringLiteral("pages"));
+        while (!pages.isNull()) {
+            const uint size = pages.attribute(QStringLiteral("size")).toUInt();
+            if (!pageSizes.contains(size)) {
+                pageSizes.append(size);
+            }
+            stats.insert(prefix + ".pages." + QByteArray::number(size) + ".total",
+                         pages.text().toDouble());
+            pages = pages.nextSiblingElement(QStringLiteral("pages"));
+        }
+        cell = cell.nextSiblingElement(QStringLiteral("cell"));
+    }
+    if (cells.isEmpty()) {
+        return;
+    }
+
+    // Cell ids are usually dense, a gap is left without free counts
+    const int count = *std::max_element(cells.cbegin(), cells.cend()) + 1;
+    stats.insert("numa.count", count);
+
+    QVector<unsigned long long> free(count);
+    int cellCount;
+    {
+        LibvirtStats::Call call(m_conn, "virNodeGetCellsFreeMemory");
+        cellCount = virNodeGetCellsFreeMemory(m_conn, free.data(), 0, count);
+    }
+    if (cellCount == count) {
+        for (int id : cells) {
+            stats.insert("numa." + QByteArray::number(id) + ".free", double(free[id]) / 1024);
+        }
+    }
+
+    if (pageSizes.isEmpty()) {
+        return;
+    }
+    const int npages = int(pageSizes.size());
+    QVector<unsigned long long> counts(qsizetype(count) * npages);
+    {
+        LibvirtStats::Call call(m_conn, "virNodeGetFreePages");
+        if (virNodeGetFreePages(
+                m_conn, uint(npages), pageSizes.data(), 0, uint(count), counts.data(), 0) < 0) {
+            return;
+        }
+    }
+    for (int id : cells) {
+        const QByteArray prefix = "numa." + QByteArray::number(id) + ".pages.";
+        for (int i = 0; i < npages; ++i) {
+            stats.insert(prefix + QByteArray::number(pageSizes[i]) + ".free",
+                         double(counts[id * npages + i]));
+        }
+    }
+}
+
+void Connection::ksmStats(QHash<QByteArray, double> &stats)
+{
+    int nparams = 0;
+    QVector<virTypedParameter> params;
+    {
+        LibvirtStats::Call call(m_conn, "virNodeGetMemoryParameters");
+        if (virNodeGetMemoryParameters(m_conn, nullptr, &nparams, 0) < 0 || nparams == 0) {
+            return;
+        }
+        params.resize(nparams);
+        if (virNodeGetMemoryParameters(m_conn, params.data(), &nparams, 0) < 0) {
+            return;
+        }
+    }
+
+    // e.g. "shm_pages_sharing" as "ksm.pages_sharing"
+    for (int i = 0; i < nparams; ++i) {
+        const virTypedParameter &param = params[i];
+        const QByteArray field(param.field);
+        if (!field.startsWith("shm_")) {
+            continue;
+        }
+        if (param.type == VIR_TYPED_PARAM_UINT) {
+            stats.insert("ksm." + field.mid(4), param.value.ui);
+        } else if (param.type == VIR_TYPED_PARAM_ULLONG) {
+            stats.insert("ksm." + field.mid(4), double(param.value.ul));
+        }
+    }
+    virTypedParamsClear(params.data(), nparams);
+}
+
+QVector<Connection::CpuTime> Connection::cpuTimes()
+{
+    QVector<CpuTime> ret;
+    unsigned char *map  = nullptr;
+    unsigned int online = 0;
+    int count;
+    {
+        LibvirtStats::Call call(m_conn, "virNodeGetCPUMap");
+        count = virNodeGetCPUMap(m_conn, &map, &online, 0);
+    }
+    if (count <= 0) {
+        return ret;
+    }
+    ret.resize(count);
+
+    // One call per CPU, all of them report the same fields
+    QVector<virNodeCPUStats> params;
+    for (int cpu = 0; cpu < count; ++cpu) {
+        if (!VIR_CPU_USED(map, cpu)) {
+            continue;
+        }
+        int nparams = int(params.size());
+        {
+            LibvirtStats::Call call(m_conn, "virNodeGetCPUStats");
+            if (nparams == 0) {
+                if (virNodeGetCPUStats(m_conn, cpu, nullptr, &nparams, 0) < 0 || nparams == 0) {
+                    break;
+                }
+                params.resize(nparams);
+            }
+            if (virNodeGetCPUStats(m_conn, cpu, params.data(), &nparams, 0) < 0) {
+                continue;
+            }
+        }
+
+        CpuTime &time = ret[cpu];
+        double busy   = 0;
+        double idle   = 0;
+        for (int i = 0; i < nparams; ++i) {
+            const double value = double(params[i].value);
+            if (strcmp(params[i].field, VIR_NODE_CPU_STATS_KERNEL) == 0 ||
+                strcmp(params[i].field, VIR_NODE_CPU_STATS_USER) == 0) {
+                busy += value;
+            } else if (strcmp(params[i].field, VIR_NODE_CPU_STATS_IDLE) == 0 ||
+                       strcmp(params[i].field, VIR_NODE_CPU_STATS_IOWAIT) == 0) {
+                idle += value;
+            } else if (strcmp(params[i].field, VIR_NODE_CPU_STATS_UTILIZATION) == 0) {
+                time.utilization = value;
+            }
+        }
+        time.busy  = busy;
+        time.total = busy + idle;
+    }
+    free(map);
+
+    return ret;
 }
 
 QVector<Domain *> Connection::domains(int flags, QObject *parent)
 {
     QVector<Domain *> ret;
     virDomainPtr *domains;
-    int count = virConnectListAllDomains(m_conn, &domains, flags);
+    int count;
+    {
+        LibvirtStats::Call call(m_conn, "virConnectListAllDomains");
+        count = virConnectListAllDomains(m_conn, &domains, flags);
+    }
     if (count > 0) {
         for (int i = 0; i < count; i++) {
             auto domain = new Domain(domains[i], this, parent);
@@ -618,7 +860,11 @@ QVector<Domain *> Connection::domains(int flags, QObject *parent)
 
 Domain *Connection::getDomainByUuid(const QString &uuid, QObject *parent)
 {
-    virDomainPtr domain = virDomainLookupByUUIDString(m_conn, uuid.toUtf8().constData());
+    virDomainPtr domain;
+    {
+        LibvirtStats::Call call(m_conn, "virDomainLookupByUUIDString");
+        domain = virDomainLookupByUUIDString(m_conn, uuid.toUtf8().constData());
+    }
     if (!domain) {
         return nullptr;
     }
@@ -628,7 +874,11 @@ Domain *Connection::getDomainByUuid(const QString &uuid, QObject *parent)
 
 Domain *Connection::getDomainByName(const QString &name, QObject *parent)
 {
-    virDomainPtr domain = virDomainLookupByName(m_conn, name.toUtf8().constData());
+    virDomainPtr domain;
+    {
+        LibvirtStats::Call call(m_conn, "virDomainLookupByName");
+        domain = virDomainLookupByName(m_conn, name.toUtf8().constData());
+    }
     if (!domain) {
         return nullptr;
     }
@@ -640,7 +890,11 @@ QVector<Interface *> Connection::interfaces(uint flags, QObject *parent)
 {
     QVector<Interface *> ret;
     virInterfacePtr *ifaces;
-    int count = virConnectListAllInterfaces(m_conn, &ifaces, flags);
+    int count;
+    {
+        LibvirtStats::Call call(m_conn, "virConnectListAllInterfaces");
+        count = virConnectListAllInterfaces(m_conn, &ifaces, flags);
+    }
     if (count > 0) {
         for (int i = 0; i < count; ++i) {
             auto iface = new Interface(ifaces[i], this, parent);
@@ -653,7 +907,11 @@ QVector<Interface *> Connection::interfaces(uint flags, QObject *parent)
 
 Interface *Connection::getInterface(const QString &name, QObject *parent)
 {
-    virInterfacePtr iface = virInterfaceLookupByName(m_conn, name.toUtf8().constData());
+    virInterfacePtr iface;
+    {
+        LibvirtStats::Call call(m_conn, "virInterfaceLookupByName");
+        iface = virInterfaceLookupByName(m_conn, name.toUtf8().constData());
+    }
     if (!iface) {
         return nullptr;
     }
@@ -746,7 +1004,11 @@ bool Connection::createInterface(const QString &name,
     stream.writeEndElement(); // interface
     qCDebug(VIRT_CONN) << "XML output" << output;
 
-    virInterfacePtr iface = virInterfaceDefineXML(m_conn, output.constData(), 0);
+    virInterfacePtr iface;
+    {
+        LibvirtStats::Call call(m_conn, "virInterfaceDefineXML");
+        iface = virInterfaceDefineXML(m_conn, output.constData(), 0);
+    }
     if (iface) {
         virInterfaceFree(iface);
         return true;
@@ -758,7 +1020,11 @@ QVector<Network *> Connection::networks(uint flags, QObject *parent)
 {
     QVector<Network *> ret;
     virNetworkPtr *nets;
-    int count = virConnectListAllNetworks(m_conn, &nets, flags);
+    int count;
+    {
+        LibvirtStats::Call call(m_conn, "virConnectListAllNetworks");
+        count = virConnectListAllNetworks(m_conn, &nets, flags);
+    }
     if (count > 0) {
         for (int i = 0; i < count; ++i) {
             auto net = new Network(nets[i], this, parent);
@@ -771,7 +1037,11 @@ QVector<Network *> Connection::networks(uint flags, QObject *parent)
 
 Network *Connection::getNetwork(const QString &name, QObject *parent)
 {
-    virNetworkPtr network = virNetworkLookupByName(m_conn, name.toUtf8().constData());
+    virNetworkPtr network;
+    {
+        LibvirtStats::Call call(m_conn, "virNetworkLookupByName");
+        network = virNetworkLookupByName(m_conn, name.toUtf8().constData());
+    }
     if (!network) {
         return nullptr;
     }
@@ -835,7 +1105,11 @@ bool Connection::createNetwork(const QString &name,
 
     stream.writeEndElement(); // network
     qCDebug(VIRT_CONN) << "XML output" << output;
-    virNetworkPtr net = virNetworkDefineXML(m_conn, output.constData());
+    virNetworkPtr net;
+    {
+        LibvirtStats::Call call(m_conn, "virNetworkDefineXML");
+        net = virNetworkDefineXML(m_conn, output.constData());
+    }
     if (net) {
         virNetworkFree(net);
         return true;
@@ -847,7 +1121,11 @@ QVector<Secret *> Connection::secrets(uint flags, QObject *parent)
 {
     QVector<Secret *> ret;
     virSecretPtr *secrets;
-    int count = virConnectListAllSecrets(m_conn, &secrets, flags);
+    int count;
+    {
+        LibvirtStats::Call call(m_conn, "virConnectListAllSecrets");
+        count = virConnectListAllSecrets(m_conn, &secrets, flags);
+    }
     if (count > 0) {
         for (int i = 0; i < count; ++i) {
             auto secret = new Secret(secrets[i], this, parent);
@@ -888,7 +1166,11 @@ bool Connection::createSecret(const QString &ephemeral,
     stream.writeEndElement(); // secret
     qDebug(VIRT_CONN) << "XML output" << output;
     //    xml.appendChild();
-    virSecretPtr secret = virSecretDefineXML(m_conn, output.constData(), 0);
+    virSecretPtr secret;
+    {
+        LibvirtStats::Call call(m_conn, "virSecretDefineXML");
+        secret = virSecretDefineXML(m_conn, output.constData(), 0);
+    }
     if (secret) {
         virSecretFree(secret);
         return true;
@@ -898,7 +1180,11 @@ bool Connection::createSecret(const QString &ephemeral,
 
 Secret *Connection::getSecretByUuid(const QString &uuid, QObject *parent)
 {
-    virSecretPtr secret = virSecretLookupByUUIDString(m_conn, uuid.toLatin1().constData());
+    virSecretPtr secret;
+    {
+        LibvirtStats::Call call(m_conn, "virSecretLookupByUUIDString");
+        secret = virSecretLookupByUUIDString(m_conn, uuid.toLatin1().constData());
+    }
     if (!secret) {
         return nullptr;
     }
@@ -907,10 +1193,15 @@ Secret *Connection::getSecretByUuid(const QString &uuid, QObject *parent)
 
 bool Connection::deleteSecretByUuid(const QString &uuid)
 {
-    virSecretPtr secret = virSecretLookupByUUIDString(m_conn, uuid.toLatin1().constData());
+    virSecretPtr secret;
+    {
+        LibvirtStats::Call call(m_conn, "virSecretLookupByUUIDString");
+        secret = virSecretLookupByUUIDString(m_conn, uuid.toLatin1().constData());
+    }
     if (!secret) {
         return true;
     }
+    LibvirtStats::Call call(m_conn, "virSecretUndefine");
     return virSecretUndefine(secret) == 0;
 }
 
@@ -918,7 +1209,11 @@ QVector<StoragePool *> Connection::storagePools(int flags, QObject *parent)
 {
     QVector<StoragePool *> ret;
     virStoragePoolPtr *storagePools;
-    int count = virConnectListAllStoragePools(m_conn, &storagePools, flags);
+    int count;
+    {
+        LibvirtStats::Call call(m_conn, "virConnectListAllStoragePools");
+        count = virConnectListAllStoragePools(m_conn, &storagePools, flags);
+    }
     if (count > 0) {
         for (int i = 0; i < count; ++i) {
             auto storagePool = new StoragePool(storagePools[i], parent);
@@ -968,7 +1263,11 @@ bool Connection::createStoragePool(const QString &name,
     stream.writeEndElement(); // pool
                               //    qDebug(VIRT_CONN) << "XML output" << output;
 
-    virStoragePoolPtr pool = virStoragePoolDefineXML(m_conn, output.constData(), 0);
+    virStoragePoolPtr pool;
+    {
+        LibvirtStats::Call call(m_conn, "virStoragePoolDefineXML");
+        pool = virStoragePoolDefineXML(m_conn, output.constData(), 0);
+    }
     if (!pool) {
         qDebug(VIRT_CONN) << "virStoragePoolDefineXML" << output;
         return false;
@@ -1020,7 +1319,11 @@ bool Connection::createStoragePoolCeph(const QString &name,
     stream.writeEndElement(); // pool
     qDebug(VIRT_CONN) << "XML output" << output;
 
-    virStoragePoolPtr pool = virStoragePoolDefineXML(m_conn, output.constData(), 0);
+    virStoragePoolPtr pool;
+    {
+        LibvirtStats::Call call(m_conn, "virStoragePoolDefineXML");
+        pool = virStoragePoolDefineXML(m_conn, output.constData(), 0);
+    }
     if (!pool) {
         qDebug(VIRT_CONN) << "virStoragePoolDefineXML" << output;
         return false;
@@ -1068,7 +1371,11 @@ bool Connection::createStoragePoolNetFs(const QString &name,
     stream.writeEndElement(); // pool
     qDebug(VIRT_CONN) << "XML output" << output;
 
-    virStoragePoolPtr pool = virStoragePoolDefineXML(m_conn, output.constData(), 0);
+    virStoragePoolPtr pool;
+    {
+        LibvirtStats::Call call(m_conn, "virStoragePoolDefineXML");
+        pool = virStoragePoolDefineXML(m_conn, output.constData(), 0);
+    }
     if (!pool) {
         qDebug(VIRT_CONN) << "virStoragePoolDefineXML" << output;
         return false;
@@ -1083,7 +1390,11 @@ bool Connection::createStoragePoolNetFs(const QString &name,
 StoragePool *Connection::getStoragePool(const QString &name, QObject *parent)
 {
 
-    virStoragePoolPtr pool = virStoragePoolLookupByName(m_conn, name.toUtf8().constData());
+    virStoragePoolPtr pool;
+    {
+        LibvirtStats::Call call(m_conn, "virStoragePoolLookupByName");
+        pool = virStoragePoolLookupByName(m_conn, name.toUtf8().constData());
+    }
     if (!pool) {
         return nullptr;
     }
@@ -1108,7 +1419,11 @@ QVector<StorageVol *> Connection::getStorageImages(QObject *parent)
 
 StorageVol *Connection::getStorageVolByPath(const QString &path, QObject *parent)
 {
-    virStorageVolPtr vol = virStorageVolLookupByPath(m_conn, path.toUtf8().constData());
+    virStorageVolPtr vol;
+    {
+        LibvirtStats::Call call(m_conn, "virStorageVolLookupByPath");
+        vol = virStorageVolLookupByPath(m_conn, path.toUtf8().constData());
+    }
     if (!vol) {
         return nullptr;
     }
@@ -1119,7 +1434,11 @@ QVector<NodeDevice *> Connection::nodeDevices(uint flags, QObject *parent)
 {
     QVector<NodeDevice *> ret;
     virNodeDevicePtr *nodes;
-    int count = virConnectListAllNodeDevices(m_conn, &nodes, flags);
+    int count;
+    {
+        LibvirtStats::Call call(m_conn, "virConnectListAllNodeDevices");
+        count = virConnectListAllNodeDevices(m_conn, &nodes, flags);
+    }
     if (count > 0) {
         for (int i = 0; i < count; ++i) {
             auto node = new NodeDevice(nodes[i], this, parent);
@@ -1133,12 +1452,17 @@ QVector<NodeDevice *> Connection::nodeDevices(uint flags, QObject *parent)
 void Connection::loadNodeInfo()
 {
     m_nodeInfoLoaded = true;
+    LibvirtStats::Call call(m_conn, "virNodeGetInfo");
     virNodeGetInfo(m_conn, &m_nodeInfo);
 }
 
 bool Connection::loadDomainCapabilities()
 {
-    char *xml = virConnectGetCapabilities(m_conn);
+    char *xml;
+    {
+        LibvirtStats::Call call(m_conn, "virConnectGetCapabilities");
+        xml = virConnectGetCapabilities(m_conn);
+    }
     if (!xml) {
         qCWarning(VIRT_CONN) << "Failed to load domain capabilities";
         return false;
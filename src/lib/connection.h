@@ -21,6 +21,7 @@
 #include <libvirt/libvirt.h>
 
 #include <QDomDocument>
+#include <QHash>
 #include <QObject>
 
 class Domain;
@@ -54,6 +55,7 @@ public:
     Connection *clone(QObject *parent);
 
     QString uri() const;
+    bool isLocal() const;
     QString hostname() const;
     QString hypervisor() const;
     quint64 freeMemoryBytes() const;
@@ -74,8 +76,6 @@ public:
     QString modelCpu();
     bool kvmSupported();
 
-    int allCpusUsage();
-
     QStringList isoMedia();
 
     QVector<QVariantList> getCacheModes() const;
@@ -93,6 +93,46 @@ public:
                       bool virtIO,
                       const QString &consoleType);
 
+    struct DiskSource {
+        QString path;
+        QString type;
+    };
+    QString domainXml(const QString &name,
+                      const QString &memory,
+                      const QString &vcpu,
+                      bool hostModel,
+                      const QString &uuid,
+                      const QVector<DiskSource> &disks,
+                      const QString &cacheMode,
+                      const QStringList &networks,
+                      bool virtIO,
+                      const QString &consoleType);
+
+    struct StatsRecord {
+        QString uuid;
+        QString name;
+        // Typed parameters by field, e.g. "cpu.time" or "net.0.rx.bytes"
+        QHash<QByteArray, double> values;
+        QHash<QByteArray, QString> strings;
+    };
+    // Stats of all domains in one call, stats is a virDomainStatsTypes mask
+    QVector<StatsRecord> allDomainStats(uint stats, uint flags = 0);
+    // Node CPU times in ns as "cpu.user" and memory in KiB as "memory.free",
+    // NUMA cells in KiB as "numa.0.free" with "numa.count" cells, their
+    // pages of 2 MiB as "numa.0.pages.2048.free" and KSM counters as
+    // "ksm.pages_sharing"
+    QHash<QByteArray, double> nodeStats();
+
+    struct CpuTime {
+        // ns, negative for offline CPUs
+        double busy        = -1;
+        double total       = -1;
+        // %, only from hypervisors that don't report times
+        double utilization = -1;
+    };
+    // Times of every host CPU by number, one call per online CPU
+    QVector<CpuTime> cpuTimes();
+
     QVector<Domain *> domains(int flags, QObject *parent = nullptr);
     Domain *getDomainByUuid(const QString &uuid, QObject *parent = nullptr);
     Domain *getDomainByName(const QString &name, QObject *parent = nullptr);
@@ -157,10 +197,12 @@ public:
 private:
     void loadNodeInfo();
     bool loadDomainCapabilities();
+    void numaStats(QHash<QByteArray, double> &stats);
+    void ksmStats(QHash<QByteArray, double> &stats);
     QString dataFromSimpleNode(const QString &element) const;
 
     QString m_connName;
-    virConnectPtr m_conn;
+    virConnectPtr m_conn = nullptr;
     virNodeInfo m_nodeInfo;
     QDomDocument m_xmlCapsDoc;
     bool m_nodeInfoLoaded           = false;
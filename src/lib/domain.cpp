@@ -19,6 +19,7 @@
 
 #include "connection.h"
 #include "domainsnapshot.h"
+#include "libvirtstats.h"
 #include "network.h"
 #include "storagepool.h"
 #include "storagevol.h"
@@ -33,9 +34,20 @@
 #include <QLoggingCategory>
 #include <QTextStream>
 #include <QTimer>
+#include <QUuid>
 
 Q_LOGGING_CATEGORY(VIRT_DOM, "virt.domain")
 
+// Cache and memory bandwidth ones need Intel RDT, the others a PMU
+static const char *const PerfEvents[] = {
+    VIR_PERF_PARAM_CMT,
+    VIR_PERF_PARAM_MBMT,
+    VIR_PERF_PARAM_MBML,
+    VIR_PERF_PARAM_CACHE_MISSES,
+    VIR_PERF_PARAM_CYCLES,
+    VIR_PERF_PARAM_INSTRUCTIONS,
+};
+
 Domain::Domain(virDomainPtr domain, Connection *conn, QObject *parent)
     : QObject(parent)
     , m_conn(conn)
@@ -98,8 +110,14 @@ void Domain::setDescription(const QString &description)
 
 int Domain::status()
 {
+    LibvirtStats::cacheLookup(m_gotInfo);
     if (!m_gotInfo) {
-        if (virDomainGetInfo(m_domain, &m_info) < 0) {
+        bool ok;
+        {
+            LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainGetInfo");
+            ok = virDomainGetInfo(m_domain, &m_info) == 0;
+        }
+        if (!ok) {
             qCWarning(VIRT_DOM) << "Failed to get info for domain" << name();
             return -1;
         }
@@ -174,13 +192,19 @@ QString Domain::currentMemoryPretty()
 
 bool Domain::hasManagedSaveImage() const
 {
+    LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainHasManagedSaveImage");
     return virDomainHasManagedSaveImage(m_domain, 0);
 }
 
 bool Domain::autostart() const
 {
     int autostart = 0;
-    if (virDomainGetAutostart(m_domain, &autostart) < 0) {
+    bool ok;
+    {
+        LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainGetAutostart");
+        ok = virDomainGetAutostart(m_domain, &autostart) == 0;
+    }
+    if (!ok) {
         qWarning() << "Failed to get autostart for domain" << name();
     }
     return autostart;
@@ -215,8 +239,12 @@ bool Domain::snapshot(const QString &name)
 
     newDoc.appendChild(e);
 
-    virDomainSnapshotPtr snapshot =
-        virDomainSnapshotCreateXML(m_domain, newDoc.toString(0).toUtf8().constData(), 0);
+    const QByteArray xml = newDoc.toString(0).toUtf8();
+    virDomainSnapshotPtr snapshot;
+    {
+        LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainSnapshotCreateXML");
+        snapshot = virDomainSnapshotCreateXML(m_domain, xml.constData(), 0);
+    }
     //    qDebug() << snapshot << newDoc.toString(2).toUtf8().constData();
     if (snapshot) {
         virDomainSnapshotFree(snapshot);
@@ -229,13 +257,18 @@ QVariantList Domain::snapshots()
 {
     QVariantList ret;
     auto it = m_cache.constFind(QStringLiteral("snapshots"));
+    LibvirtStats::cacheLookup(it != m_cache.constEnd());
     if (it != m_cache.constEnd()) {
         ret = it.value().toList();
         return ret;
     }
 
     virDomainSnapshotPtr *snaps;
-    int count = virDomainListAllSnapshots(m_domain, &snaps, 0);
+    int count;
+    {
+        LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainListAllSnapshots");
+        count = virDomainListAllSnapshots(m_domain, &snaps, 0);
+    }
     if (count == -1) {
         return ret;
     }
@@ -252,8 +285,11 @@ QVariantList Domain::snapshots()
 
 DomainSnapshot *Domain::getSnapshot(const QString &name)
 {
-    virDomainSnapshotPtr snap =
-        virDomainSnapshotLookupByName(m_domain, name.toUtf8().constData(), 0);
+    virDomainSnapshotPtr snap;
+    {
+        LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainSnapshotLookupByName");
+        snap = virDomainSnapshotLookupByName(m_domain, name.toUtf8().constData(), 0);
+    }
     if (!snap) {
         return nullptr;
     }
@@ -327,6 +363,51 @@ QString Domain::consoleListenAddress()
     return ret;
 }
 
+int Domain::openGraphicsFd(uint idx)
+{
+    // Only works when the daemon runs on this host,
+    // the socket is passed over the libvirt connection
+    int fd;
+    {
+        LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainOpenGraphicsFD");
+        fd = virDomainOpenGraphicsFD(m_domain, idx, 0);
+    }
+    if (fd < 0) {
+        qCWarning(VIRT_DOM) << "Failed to open graphics fd for domain" << name();
+    }
+    return fd;
+}
+
+bool Domain::hasSerialConsole()
+{
+    const QDomElement devices =
+        xmlDoc().documentElement().firstChildElement(QStringLiteral("devices"));
+    return !devices.firstChildElement(QStringLiteral("console")).isNull() ||
+           !devices.firstChildElement(QStringLiteral("serial")).isNull();
+}
+
+virStreamPtr Domain::openSerialConsole()
+{
+    // Non blocking, data is read from the libvirt event loop
+    virStreamPtr stream = virStreamNew(virDomainGetConnect(m_domain), VIR_STREAM_NONBLOCK);
+    if (!stream) {
+        return nullptr;
+    }
+
+    // Takes over the console from other clients, like virsh console --force
+    bool ok;
+    {
+        LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainOpenConsole");
+        ok = virDomainOpenConsole(m_domain, nullptr, stream, VIR_DOMAIN_CONSOLE_FORCE) == 0;
+    }
+    if (!ok) {
+        qCWarning(VIRT_DOM) << "Failed to open serial console for domain" << name();
+        virStreamFree(stream);
+        return nullptr;
+    }
+    return stream;
+}
+
 QString Domain::consoleKeymap()
 {
     return xmlDoc()
@@ -348,7 +429,12 @@ void Domain::setConsoleKeymap(const QString &keymap)
 bool getCpuTime(virDomainPtr dom, int nparams, quint64 &cpu_time)
 {
     virTypedParameter params[nparams];
-    if (virDomainGetCPUStats(dom, params, uint(nparams), -1, 1, 0) != nparams) {
+    int count;
+    {
+        LibvirtStats::Call call(virDomainGetConnect(dom), "virDomainGetCPUStats");
+        count = virDomainGetCPUStats(dom, params, uint(nparams), -1, 1, 0);
+    }
+    if (count != nparams) {
         return false;
     }
 
@@ -368,6 +454,7 @@ struct GetCPUStats {
     GetCPUStats(virDomainPtr dom)
         : m_dom(dom)
     {
+        LibvirtStats::Call call(virDomainGetConnect(dom), "virDomainGetCPUStats");
         m_nparams = virDomainGetCPUStats(dom, nullptr, 0, -1, 1, 0);
     }
 
@@ -434,10 +521,7 @@ struct GetNetUsage {
             virDomainInterfaceStatsStruct stats;
             qint64 rx = 0;
             qint64 tx = 0;
-            if (virDomainInterfaceStats(m_dom,
-                                        net.toUtf8().constData(),
-                                        &stats,
-                                        sizeof(virDomainInterfaceStatsStruct)) == 0) {
+            if (interfaceStats(net, stats)) {
                 if (stats.rx_bytes != -1) {
                     rx = stats.rx_bytes;
                 }
@@ -457,10 +541,7 @@ struct GetNetUsage {
             std::pair<qint64, qint64> rx_tx = ret[i];
             qint64 rx                       = 0;
             qint64 tx                       = 0;
-            if (virDomainInterfaceStats(m_dom,
-                                        net.toUtf8().constData(),
-                                        &stats,
-                                        sizeof(virDomainInterfaceStatsStruct)) == 0) {
+            if (interfaceStats(net, stats)) {
                 if (stats.rx_bytes != -1) {
                     rx = (stats.rx_bytes - rx_tx.first) * 8 / 1024 / 1024;
                 }
@@ -473,6 +554,15 @@ struct GetNetUsage {
         return ret;
     }
 
+    bool interfaceStats(const QString &net, virDomainInterfaceStatsStruct &stats)
+    {
+        LibvirtStats::Call call(virDomainGetConnect(m_dom), "virDomainInterfaceStats");
+        return virDomainInterfaceStats(m_dom,
+                                       net.toUtf8().constData(),
+                                       &stats,
+                                       sizeof(virDomainInterfaceStatsStruct)) == 0;
+    }
+
     const QStringList m_networks;
     virDomainPtr m_dom;
     QVector<std::pair<qint64, qint64>> ret;
@@ -498,9 +588,7 @@ struct GetHddUsage {
             virDomainBlockStatsStruct stats;
             qint64 rd = 0;
             qint64 wr = 0;
-            if (virDomainBlockStats(
-                    m_dom, dev.toUtf8().constData(), &stats, sizeof(virDomainBlockStatsStruct)) ==
-                0) {
+            if (blockStats(dev, stats)) {
                 if (stats.rd_bytes != -1) {
                     rd = stats.rd_bytes;
                 }
@@ -519,9 +607,7 @@ struct GetHddUsage {
             std::pair<qint64, qint64> rd_wr = ret[dev];
             qint64 rd                       = 0;
             qint64 wr                       = 0;
-            if (virDomainBlockStats(
-                    m_dom, dev.toUtf8().constData(), &stats, sizeof(virDomainBlockStatsStruct)) ==
-                0) {
+            if (blockStats(dev, stats)) {
                 if (stats.rd_bytes != -1) {
                     rd = (stats.rd_bytes - rd_wr.first) / 1024 / 1024;
                 }
@@ -535,6 +621,14 @@ struct GetHddUsage {
         return ret;
     }
 
+    bool blockStats(const QString &dev, virDomainBlockStatsStruct &stats)
+    {
+        LibvirtStats::Call call(virDomainGetConnect(m_dom), "virDomainBlockStats");
+        return virDomainBlockStats(
+                   m_dom, dev.toUtf8().constData(), &stats, sizeof(virDomainBlockStatsStruct)) ==
+               0;
+    }
+
     const QStringList m_devices;
     virDomainPtr m_dom;
     QMap<QString, std::pair<qint64, qint64>> ret;
@@ -551,6 +645,7 @@ QStringList Domain::blkDevices()
 {
     QStringList ret;
     auto it = m_cache.constFind(QStringLiteral("blkDevices"));
+    LibvirtStats::cacheLookup(it != m_cache.constEnd());
     if (it != m_cache.constEnd()) {
         ret = it.value().toStringList();
         return ret;
@@ -598,6 +693,7 @@ QVariantList Domain::disks()
 {
     QVariantList ret;
     auto it = m_cache.constFind(QStringLiteral("disks"));
+    LibvirtStats::cacheLookup(it != m_cache.constEnd());
     if (it != m_cache.constEnd()) {
         ret = it.value().toList();
         return ret;
@@ -617,10 +713,12 @@ QVariantList Domain::disks()
                 disk.firstChildElement(QStringLiteral("driver")).attribute(QStringLiteral("type"));
             QString volume;
             QString storage;
+            QString backing;
             if (!srcFile.isEmpty()) {
                 StorageVol *vol = m_conn->getStorageVolByPath(srcFile, this);
                 if (vol) {
                     volume            = vol->name();
+                    backing           = vol->backingStore();
                     StoragePool *pool = vol->pool();
                     if (pool) {
                         storage = pool->name();
@@ -628,12 +726,22 @@ QVariantList Domain::disks()
                 }
             }
 
+            QString job;
+            if (!backing.isEmpty() && status() == VIR_DOMAIN_RUNNING) {
+                const int progress = blockJobProgress(dev);
+                if (progress != -1) {
+                    job = QString::number(progress);
+                }
+            }
+
             QHash<QString, QString> data{
                 {QStringLiteral("dev"), dev},
                 {QStringLiteral("image"), volume},
                 {QStringLiteral("storage"), storage},
                 {QStringLiteral("path"), srcFile},
                 {QStringLiteral("format"), diskFormat},
+                {QStringLiteral("backing"), backing},
+                {QStringLiteral("job"), job},
             };
             ret.append(QVariant::fromValue(data));
         }
@@ -648,6 +756,7 @@ QVariantList Domain::cloneDisks()
 {
     QVariantList ret;
     auto it = m_cache.constFind(QStringLiteral("cloneDisks"));
+    LibvirtStats::cacheLookup(it != m_cache.constEnd());
     if (it != m_cache.constEnd()) {
         ret = it.value().toList();
         return ret;
@@ -664,14 +773,15 @@ QVariantList Domain::cloneDisks()
         if (image.contains(QLatin1Char('.'))) {
             QFileInfo info(image);
             if (info.path() == QLatin1String(".")) {
-                disk.value(u"image"_qs) =
-                    info.baseName() + QLatin1String("-clone.") + info.completeSuffix();
+                disk.insert(QStringLiteral("image"),
+                            info.baseName() + QLatin1String("-clone.") + info.completeSuffix());
             } else {
-                disk.value(u"image"_qs) = info.path() + QLatin1Char('/') + info.baseName() +
-                                          QLatin1String("-clone.") + info.completeSuffix();
+                disk.insert(QStringLiteral("image"),
+                            info.path() + QLatin1Char('/') + info.baseName() +
+                                QLatin1String("-clone.") + info.completeSuffix());
             }
         } else {
-            disk.value(u"image"_qs) = image + QLatin1String("-clone");
+            disk.insert(QStringLiteral("image"), image + QLatin1String("-clone"));
         }
         ret.append(QVariant::fromValue(disk));
     }
@@ -680,10 +790,73 @@ QVariantList Domain::cloneDisks()
     return ret;
 }
 
+QStringList Domain::uncloneableDisks()
+{
+    QStringList ret;
+    const QVariantList _disks = disks();
+    for (const QVariant &var : _disks) {
+        const QHash<QString, QString> disk = var.value<QHash<QString, QString>>();
+        if (disk.value(QStringLiteral("image")).isEmpty()) {
+            ret.append(disk.value(QStringLiteral("dev")));
+        }
+    }
+    return ret;
+}
+
+QString Domain::cloneXml(const QString &name,
+                         const QStringList &macs,
+                         const QHash<QString, QString> &diskPaths)
+{
+    QDomDocument doc = xmlDoc().cloneNode(true).toDocument();
+    QDomElement root = doc.documentElement();
+
+    root.firstChildElement(QStringLiteral("name")).firstChild().setNodeValue(name);
+    root.firstChildElement(QStringLiteral("uuid"))
+        .firstChild()
+        .setNodeValue(QUuid::createUuid().toString(QUuid::WithoutBraces));
+
+    QDomElement devices = root.firstChildElement(QStringLiteral("devices"));
+
+    int nic           = 0;
+    QDomElement iface = devices.firstChildElement(QStringLiteral("interface"));
+    while (!iface.isNull()) {
+        QDomElement mac       = iface.firstChildElement(QStringLiteral("mac"));
+        const QString address = macs.value(nic++);
+        if (address.isEmpty() ||
+            address.compare(mac.attribute(QStringLiteral("address")), Qt::CaseInsensitive) == 0) {
+            // libvirt generates a new one, the source keeps its own
+            iface.removeChild(mac);
+        } else {
+            mac.setAttribute(QStringLiteral("address"), address);
+        }
+        iface = iface.nextSiblingElement(QStringLiteral("interface"));
+    }
+
+    QDomElement disk = devices.firstChildElement(QStringLiteral("disk"));
+    while (!disk.isNull()) {
+        const QString dev =
+            disk.firstChildElement(QStringLiteral("target")).attribute(QStringLiteral("dev"));
+
+        auto it = diskPaths.constFind(dev);
+        if (it != diskPaths.constEnd()) {
+            disk.firstChildElement(QStringLiteral("source"))
+                .setAttribute(QStringLiteral("file"), it.value());
+            disk.removeChild(disk.firstChildElement(QStringLiteral("backingStore")));
+        } else if (disk.attribute(QStringLiteral("device")) == QLatin1String("disk")) {
+            // Both domains would write to the same storage
+            return QString();
+        }
+        disk = disk.nextSiblingElement(QStringLiteral("disk"));
+    }
+
+    return doc.toString(0);
+}
+
 QVariantList Domain::media()
 {
     QVariantList ret;
     auto it = m_cache.constFind(QStringLiteral("media"));
+    LibvirtStats::cacheLookup(it != m_cache.constEnd());
     if (it != m_cache.constEnd()) {
         ret = it.value().toList();
         return ret;
@@ -731,6 +904,7 @@ QVariantList Domain::networks()
 {
     QVariantList ret;
     auto it = m_cache.constFind(QStringLiteral("networks"));
+    LibvirtStats::cacheLookup(it != m_cache.constEnd());
     if (it != m_cache.constEnd()) {
         ret = it.value().toList();
         return ret;
@@ -776,6 +950,7 @@ QStringList Domain::networkTargetDevs()
 {
     QStringList ret;
     auto it = m_cache.constFind(QStringLiteral("networkTargetDevs"));
+    LibvirtStats::cacheLookup(it != m_cache.constEnd());
     if (it != m_cache.constEnd()) {
         ret = it.value().toStringList();
         return ret;
@@ -800,58 +975,182 @@ QStringList Domain::networkTargetDevs()
 
 void Domain::start()
 {
+    LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainCreate");
     virDomainCreate(m_domain);
 }
 
 void Domain::shutdown()
 {
+    LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainShutdown");
     virDomainShutdown(m_domain);
 }
 
 void Domain::suspend()
 {
+    LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainSuspend");
     virDomainSuspend(m_domain);
 }
 
 void Domain::resume()
 {
+    LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainResume");
     virDomainResume(m_domain);
 }
 
 void Domain::destroy()
 {
+    LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainDestroy");
     virDomainDestroy(m_domain);
 }
 
 void Domain::undefine()
 {
+    LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainUndefine");
     virDomainUndefine(m_domain);
 }
 
 void Domain::managedSave()
 {
+    LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainManagedSave");
     virDomainManagedSave(m_domain, 0);
 }
 
 void Domain::managedSaveRemove()
 {
+    LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainManagedSaveRemove");
     virDomainManagedSaveRemove(m_domain, 0);
 }
 
 void Domain::setAutostart(bool enable)
 {
+    LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainSetAutostart");
     virDomainSetAutostart(m_domain, enable ? 1 : 0);
 }
 
+bool Domain::setMemoryStatsPeriod(int period)
+{
+    LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainSetMemoryStatsPeriod");
+    return virDomainSetMemoryStatsPeriod(m_domain, period, VIR_DOMAIN_AFFECT_LIVE) == 0;
+}
+
+QVariantList Domain::perfEvents()
+{
+    QVariantList ret;
+    auto it = m_cache.constFind(QStringLiteral("perf_events"));
+    LibvirtStats::cacheLookup(it != m_cache.constEnd());
+    if (it != m_cache.constEnd()) {
+        ret = it.value().toList();
+        return ret;
+    }
+
+    virTypedParameterPtr params = nullptr;
+    int nparams                 = 0;
+    bool ok;
+    {
+        LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainGetPerfEvents");
+        ok = virDomainGetPerfEvents(m_domain, &params, &nparams, 0) == 0;
+    }
+    if (!ok) {
+        qCWarning(VIRT_DOM) << "Failed to get perf events for domain" << name();
+        return ret;
+    }
+
+    // Events unknown to the libvirt of the host are not listed
+    for (const char *event : PerfEvents) {
+        int enabled;
+        if (virTypedParamsGetBoolean(params, nparams, event, &enabled) == 1) {
+            ret.append(QVariantHash{
+                {QStringLiteral("name"), QString::fromLatin1(event)},
+                {QStringLiteral("enabled"), enabled == 1},
+            });
+        }
+    }
+    virTypedParamsFree(params, nparams);
+
+    m_cache.insert(QStringLiteral("perf_events"), ret);
+    return ret;
+}
+
+QStringList Domain::setPerfEvents(const QStringList &enabled)
+{
+    QStringList failed;
+    uint flags = VIR_DOMAIN_AFFECT_CONFIG;
+    if (status() == VIR_DOMAIN_RUNNING) {
+        flags |= VIR_DOMAIN_AFFECT_LIVE;
+    }
+
+    // libvirt applies a set of events all or nothing, one call per
+    // changed event so one the host can't count doesn't fail the others
+    const QVariantList events = perfEvents();
+    for (const QVariant &var : events) {
+        const QVariantHash event = var.toHash();
+        const QString name       = event.value(QStringLiteral("name")).toString();
+        const bool enable        = enabled.contains(name);
+        if (enable == event.value(QStringLiteral("enabled")).toBool()) {
+            continue;
+        }
+
+        virTypedParameterPtr params = nullptr;
+        int nparams                 = 0;
+        int maxparams               = 0;
+        const QByteArray field      = name.toLatin1();
+
+        bool ok =
+            virTypedParamsAddBoolean(&params, &nparams, &maxparams, field.constData(), enable) == 0;
+        if (ok) {
+            LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainSetPerfEvents");
+            ok = virDomainSetPerfEvents(m_domain, params, nparams, flags) == 0;
+        }
+        virTypedParamsFree(params, nparams);
+
+        if (!ok) {
+            qCWarning(VIRT_DOM) << "Failed to set perf event" << name << "for domain"
+                                << this->name() << virGetLastErrorMessage();
+            failed.append(name);
+        }
+    }
+
+    m_cache.remove(QStringLiteral("perf_events"));
+    return failed;
+}
+
+bool Domain::blockPull(const QString &dev)
+{
+    // Copies the backing file data into the overlay while the
+    // guest keeps running, qemu does this as a background job
+    LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainBlockPull");
+    return virDomainBlockPull(m_domain, dev.toUtf8().constData(), 0, 0) == 0;
+}
+
+int Domain::blockJobProgress(const QString &dev)
+{
+    virDomainBlockJobInfo info;
+    int found;
+    {
+        LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainGetBlockJobInfo");
+        found = virDomainGetBlockJobInfo(m_domain, dev.toUtf8().constData(), &info, 0);
+    }
+    if (found != 1) {
+        return -1;
+    }
+
+    if (info.end == 0) {
+        return 0;
+    }
+    return int(info.cur * 100 / info.end);
+}
+
 bool Domain::attachDevice(const QString &xml)
 {
     m_xml.clear();
+    LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainAttachDevice");
     return virDomainAttachDevice(m_domain, xml.toUtf8().constData()) == 0;
 }
 
 bool Domain::updateDevice(const QString &xml, uint flags)
 {
     m_xml.clear();
+    LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainUpdateDeviceFlags");
     return virDomainUpdateDeviceFlags(m_domain, xml.toUtf8().constData(), flags) == 0;
 }
 
@@ -916,8 +1215,13 @@ void Domain::umountIso(const QString &dev, const QString &image)
 
 QDomDocument Domain::xmlDoc()
 {
+    LibvirtStats::cacheLookup(!m_xml.isNull());
     if (m_xml.isNull()) {
-        char *xml               = virDomainGetXMLDesc(m_domain, VIR_DOMAIN_XML_SECURE);
+        char *xml;
+        {
+            LibvirtStats::Call call(virDomainGetConnect(m_domain), "virDomainGetXMLDesc");
+            xml = virDomainGetXMLDesc(m_domain, VIR_DOMAIN_XML_SECURE);
+        }
         const QString xmlString = QString::fromUtf8(xml);
         //        qDebug() << "XML" << xml;
         QString error;
@@ -49,11 +49,13 @@ class Domain : public QObject
     Q_PROPERTY(QString consoleType READ consoleType CONSTANT)
     Q_PROPERTY(QString consolePassword READ consolePassword CONSTANT)
     Q_PROPERTY(QString consoleKeymap READ consoleKeymap CONSTANT)
+    Q_PROPERTY(bool hasSerialConsole READ hasSerialConsole CONSTANT)
     Q_PROPERTY(QVariantList disks READ disks CONSTANT)
     Q_PROPERTY(QVariantList cloneDisks READ cloneDisks CONSTANT)
     Q_PROPERTY(QVariantList media READ media CONSTANT)
     Q_PROPERTY(QVariantList networks READ networks CONSTANT)
     Q_PROPERTY(QVariantList snapshots READ snapshots CONSTANT)
+    Q_PROPERTY(QVariantList perfEvents READ perfEvents CONSTANT)
 public:
     explicit Domain(virDomainPtr domain, Connection *conn, QObject *parent = nullptr);
     ~Domain();
@@ -104,6 +106,9 @@ public:
 
     quint16 consolePort();
     QString consoleListenAddress();
+    int openGraphicsFd(uint idx = 0);
+    bool hasSerialConsole();
+    virStreamPtr openSerialConsole();
     QString consoleKeymap();
     void setConsoleKeymap(const QString &keymap);
 
@@ -113,6 +118,13 @@ public:
     QStringList blkDevices();
     QVariantList disks();
     QVariantList cloneDisks();
+    // Disks outside of any storage pool, e.g. block devices or network
+    // sources, a clone would keep writing to them
+    QStringList uncloneableDisks();
+    // Empty if a disk of the source is missing from diskPaths
+    QString cloneXml(const QString &name,
+                     const QStringList &macs,
+                     const QHash<QString, QString> &diskPaths);
     QVariantList media();
     QVariantList networks();
     QStringList networkTargetDevs();
@@ -126,6 +138,16 @@ public:
     void managedSave();
     void managedSaveRemove();
     void setAutostart(bool enable);
+    // Seconds between guest memory stats updates of the running domain
+    bool setMemoryStatsPeriod(int period);
+    // Hardware perf events the host supports, as name and enabled
+    QVariantList perfEvents();
+    // Enables the events of enabled and disables the others, live too if
+    // running. Returns the events that could not be changed.
+    QStringList setPerfEvents(const QStringList &enabled);
+
+    bool blockPull(const QString &dev);
+    int blockJobProgress(const QString &dev);
 
     bool attachDevice(const QString &xml);
     bool updateDevice(const QString &xml, uint flags);
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "eventloop.h"
+
+#include <libvirt/libvirt.h>
+
+#include <QCoreApplication>
+#include <QLoggingCategory>
+#include <QThread>
+
+#include <atomic>
+#include <mutex>
+
+Q_LOGGING_CATEGORY(VIRT_EVENT, "virt.event")
+
+namespace {
+
+QThread *loopThread = nullptr;
+std::atomic<bool> running{false};
+
+void wakeUp(int timer, void *opaque)
+{
+    Q_UNUSED(opaque)
+    virEventRemoveTimeout(timer);
+}
+
+} // namespace
+
+void EventLoop::start()
+{
+    static std::once_flag once;
+    std::call_once(once, [] {
+        if (virEventRegisterDefaultImpl() < 0) {
+            qCWarning(VIRT_EVENT) << "Failed to register libvirt event loop";
+            return;
+        }
+
+        running    = true;
+        loopThread = QThread::create([] {
+            while (running) {
+                if (virEventRunDefaultImpl() < 0) {
+                    qCWarning(VIRT_EVENT) << "Failed to run libvirt event loop";
+                }
+            }
+        });
+        loopThread->setObjectName(QStringLiteral("libvirt-events"));
+        loopThread->start();
+        qAddPostRoutine(&EventLoop::stop);
+    });
+}
+
+void EventLoop::stop()
+{
+    running = false;
+    // A timeout makes the blocked loop iteration return
+    virEventAddTimeout(0, wakeUp, nullptr, nullptr);
+    loopThread->wait();
+    delete loopThread;
+}
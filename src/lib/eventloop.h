@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+class QThread;
+class EventLoop
+{
+public:
+    // Registers the default libvirt event implementation and runs it on
+    // its own thread. Must happen in the worker process, after the fork,
+    // and before any connection is opened, stream and keepalive callbacks
+    // are only dispatched by this loop.
+    static void start();
+
+private:
+    static void stop();
+};
+
+#endif // EVENTLOOP_H
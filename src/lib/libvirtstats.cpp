@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "libvirtstats.h"
+
+#include <QMutex>
+#include <QSet>
+#include <QtAlgorithms>
+
+#include <atomic>
+#include <cmath>
+
+namespace {
+
+std::atomic<qint64> hits{0};
+std::atomic<qint64> misses{0};
+
+// Written by its thread only, read by any while merging
+struct ThreadLatency {
+    std::atomic<qint64> buckets[LibvirtStats::Latency::BucketCount] = {};
+    std::atomic<qint64> count{0};
+    std::atomic<qint64> sum{0};
+    std::atomic<qint64> max{0};
+
+    void add(qint64 us)
+    {
+        // A single writer, so plain stores don't lose updates
+        auto bump = [](std::atomic<qint64> &value, qint64 delta) {
+            value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+        };
+        bump(buckets[LibvirtStats::Latency::bucket(us)], 1);
+        bump(count, 1);
+        bump(sum, us);
+        if (us > max.load(std::memory_order_relaxed)) {
+            max.store(us, std::memory_order_relaxed);
+        }
+    }
+
+    void mergeInto(LibvirtStats::Latency &merged) const
+    {
+        for (int i = 0; i < LibvirtStats::Latency::BucketCount; ++i) {
+            merged.buckets[i] += buckets[i].load(std::memory_order_relaxed);
+        }
+        merged.count += count.load(std::memory_order_relaxed);
+        merged.sum += sum.load(std::memory_order_relaxed);
+        merged.max = qMax(merged.max, max.load(std::memory_order_relaxed));
+    }
+};
+
+using LatencyKey = QPair<QString, QByteArray>;
+
+struct ThreadCache;
+
+// Threads that made libvirt calls, and what the ended ones recorded
+QMutex latenciesMutex;
+QSet<ThreadCache *> liveThreads;
+QMap<LatencyKey, LibvirtStats::Latency> retired;
+QHash<virConnectPtr, QString> hostNames;
+// Bumped when a connection gets a name, the thread caches start over
+std::atomic<quint32> hostsGeneration{0};
+
+struct ThreadCache {
+    ThreadCache()
+    {
+        QMutexLocker locker(&latenciesMutex);
+        liveThreads.insert(this);
+    }
+
+    // Thread pools end and recreate their threads, what they recorded
+    // is folded in so only one histogram per host and function is left
+    ~ThreadCache()
+    {
+        QMutexLocker locker(&latenciesMutex);
+        liveThreads.remove(this);
+        for (auto it = latencies.constBegin(); it != latencies.constEnd(); ++it) {
+            it.value()->mergeInto(retired[it.key()]);
+        }
+        qDeleteAll(latencies);
+    }
+
+    quint32 generation = 0;
+    QHash<QPair<virConnectPtr, const char *>, ThreadLatency *> connections;
+    // Only added to under latenciesMutex
+    QHash<LatencyKey, ThreadLatency *> latencies;
+};
+
+thread_local ThreadCache threadCache;
+
+ThreadLatency *threadLatency(virConnectPtr conn, const char *function)
+{
+    const quint32 generation = hostsGeneration.load(std::memory_order_acquire);
+    if (threadCache.generation != generation) {
+        threadCache.connections.clear();
+        threadCache.generation = generation;
+    }
+
+    const auto key = qMakePair(conn, function);
+    auto it        = threadCache.connections.constFind(key);
+    if (it != threadCache.connections.constEnd()) {
+        return it.value();
+    }
+
+    QMutexLocker locker(&latenciesMutex);
+    ThreadLatency *&ret =
+        threadCache.latencies[qMakePair(hostNames.value(conn), QByteArray(function))];
+    if (!ret) {
+        ret = new ThreadLatency;
+    }
+    threadCache.connections.insert(key, ret);
+    return ret;
+}
+
+// Under latenciesMutex
+QMap<LatencyKey, LibvirtStats::Latency> merged()
+{
+    QMap<LatencyKey, LibvirtStats::Latency> ret = retired;
+    for (const ThreadCache *thread : std::as_const(liveThreads)) {
+        for (auto it = thread->latencies.constBegin(); it != thread->latencies.constEnd(); ++it) {
+            it.value()->mergeInto(ret[it.key()]);
+        }
+    }
+    return ret;
+}
+
+} // namespace
+
+int LibvirtStats::Latency::bucket(qint64 us)
+{
+    if (us < SubBuckets) {
+        return int(qMax<qint64>(us, 0));
+    }
+    const int exponent = 63 - int(qCountLeadingZeroBits(quint64(us)));
+    if (exponent > BucketCount / SubBuckets + 1) {
+        return BucketCount - 1;
+    }
+    // The 3 bits below the highest one pick the sub bucket
+    const int sub = int((us >> (exponent - 3)) & (SubBuckets - 1));
+    return (exponent - 2) * SubBuckets + sub;
+}
+
+qint64 LibvirtStats::Latency::bucketValue(int bucket)
+{
+    if (bucket < SubBuckets) {
+        return bucket;
+    }
+    const int exponent = bucket / SubBuckets + 2;
+    const int sub      = bucket % SubBuckets;
+    return (qint64(SubBuckets + sub + 1) << (exponent - 3)) - 1;
+}
+
+qint64 LibvirtStats::Latency::quantile(double q) const
+{
+    if (count == 0) {
+        return 0;
+    }
+    const qint64 rank = qMax<qint64>(1, qint64(std::ceil(q * double(count))));
+    qint64 seen       = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return qMin(bucketValue(i), max);
+        }
+    }
+    return max;
+}
+
+LibvirtStats::Call::Call(virConnectPtr conn, const char *function)
+    : m_conn(conn)
+    , m_function(function)
+    , m_start(std::chrono::steady_clock::now())
+{
+}
+
+LibvirtStats::Call::~Call()
+{
+    const auto elapsed = std::chrono::steady_clock::now() - m_start;
+    threadLatency(m_conn, m_function)
+        ->add(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
+
+void LibvirtStats::cacheLookup(bool hit)
+{
+    if (hit) {
+        ++hits;
+    } else {
+        ++misses;
+    }
+}
+
+void LibvirtStats::setHostName(virConnectPtr conn, const QString &name)
+{
+    QMutexLocker locker(&latenciesMutex);
+    auto it = hostNames.find(conn);
+    if (it == hostNames.end() || it.value() != name) {
+        // A closed connection's address can come back for another host
+        hostNames.insert(conn, name);
+        hostsGeneration.fetch_add(1, std::memory_order_release);
+    }
+}
+
+QHash<QByteArray, qint64> LibvirtStats::calls()
+{
+    QHash<QByteArray, qint64> ret;
+
+    QMutexLocker locker(&latenciesMutex);
+    const QMap<LatencyKey, Latency> latencies = merged();
+    for (auto it = latencies.constBegin(); it != latencies.constEnd(); ++it) {
+        ret[it.key().second] += it.value().count;
+    }
+    return ret;
+}
+
+qint64 LibvirtStats::cacheHits()
+{
+    return hits;
+}
+
+qint64 LibvirtStats::cacheMisses()
+{
+    return misses;
+}
+
+QMap<QPair<QString, QByteArray>, LibvirtStats::Latency> LibvirtStats::latencies()
+{
+    QMutexLocker locker(&latenciesMutex);
+    return merged();
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LIBVIRTSTATS_H
+#define LIBVIRTSTATS_H
+
+#include <libvirt/libvirt.h>
+
+#include <QByteArray>
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QString>
+
+#include <chrono>
+
+// Process wide counters of the libvirt wrappers, for the metrics endpoint
+class LibvirtStats
+{
+public:
+    // Latencies in µs with 8 log-linear buckets per power of two, so
+    // every value is known within 12.5%, from 1 µs up to hours
+    struct Latency {
+        static constexpr int SubBuckets  = 8;
+        static constexpr int BucketCount = 35 * SubBuckets;
+
+        qint64 buckets[BucketCount] = {};
+        qint64 count                = 0;
+        qint64 sum                  = 0;
+        qint64 max                  = 0;
+
+        static int bucket(qint64 us);
+        // Highest value of the bucket
+        static qint64 bucketValue(int bucket);
+        // e.g. 0.99 for the value 99% of the calls stay under
+        qint64 quantile(double q) const;
+    };
+
+    // Times a libvirt call on conn from construction to destruction,
+    // takes a string literal. Writes go to a histogram of the calling
+    // thread, so no lock is taken but on the first call of a kind.
+    // Scope it to the one call it names.
+    class Call
+    {
+    public:
+        Call(virConnectPtr conn, const char *function);
+        ~Call();
+
+    private:
+        virConnectPtr m_conn;
+        const char *m_function;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    // Lookups in the per object caches of the wrappers
+    static void cacheLookup(bool hit);
+    // Host the latencies of conn are recorded for
+    static void setHostName(virConnectPtr conn, const QString &name);
+
+    // Calls by function, the counts of the histograms
+    static QHash<QByteArray, qint64> calls();
+    static qint64 cacheHits();
+    static qint64 cacheMisses();
+    // Histograms of all threads merged, ended ones included, by host name and function
+    static QMap<QPair<QString, QByteArray>, Latency> latencies();
+};
+
+#endif // LIBVIRTSTATS_H
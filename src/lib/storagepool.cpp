@@ -17,6 +17,7 @@
  */
 #include "storagepool.h"
 
+#include "libvirtstats.h"
 #include "storagevol.h"
 #include "virtlyst.h"
 
@@ -26,6 +27,7 @@
 StoragePool::StoragePool(virStoragePoolPtr storage, QObject *parent)
     : QObject(parent)
     , m_pool(storage)
+    , m_conn(virStoragePoolGetConnect(storage))
 {
 }
 
@@ -91,20 +93,20 @@ QString StoragePool::status()
 
 bool StoragePool::active()
 {
+    LibvirtStats::Call call(m_conn, "virStoragePoolIsActive");
     return virStoragePoolIsActive(m_pool) == 1;
 }
 
 bool StoragePool::autostart()
 {
     int autostart;
-    if (virStoragePoolGetAutostart(m_pool, &autostart) == 0) {
-        return autostart == 1;
-    }
-    return false;
+    LibvirtStats::Call call(m_conn, "virStoragePoolGetAutostart");
+    return virStoragePoolGetAutostart(m_pool, &autostart) == 0 && autostart == 1;
 }
 
 int StoragePool::volumeCount()
 {
+    LibvirtStats::Call call(m_conn, "virStoragePoolNumOfVolumes");
     return virStoragePoolNumOfVolumes(m_pool);
 }
 
@@ -118,23 +120,35 @@ QString StoragePool::path()
         .nodeValue();
 }
 
+bool StoragePool::supportsReflink()
+{
+    // Only file based pools can share extents, if the
+    // filesystem really can is only known when trying
+    const QString poolType = type();
+    return poolType == u"dir" || poolType == u"fs" || poolType == u"netfs";
+}
+
 bool StoragePool::start()
 {
+    LibvirtStats::Call call(m_conn, "virStoragePoolCreate");
     return virStoragePoolCreate(m_pool, 0) == 0;
 }
 
 bool StoragePool::stop()
 {
+    LibvirtStats::Call call(m_conn, "virStoragePoolDestroy");
     return virStoragePoolDestroy(m_pool) == 0;
 }
 
 bool StoragePool::undefine()
 {
+    LibvirtStats::Call call(m_conn, "virStoragePoolUndefine");
     return virStoragePoolUndefine(m_pool) == 0;
 }
 
 bool StoragePool::setAutostart(bool enable)
 {
+    LibvirtStats::Call call(m_conn, "virStoragePoolSetAutostart");
     return virStoragePoolSetAutostart(m_pool, enable ? 1 : 0) == 0;
 }
 
@@ -146,10 +160,17 @@ QVariant StoragePool::volumes()
 QVector<StorageVol *> StoragePool::storageVols(unsigned int flags)
 {
     if (!m_gotVols) {
-        virStoragePoolRefresh(m_pool, 0);
+        {
+            LibvirtStats::Call call(m_conn, "virStoragePoolRefresh");
+            virStoragePoolRefresh(m_pool, 0);
+        }
 
         virStorageVolPtr *vols;
-        int count = virStoragePoolListAllVolumes(m_pool, &vols, flags);
+        int count;
+        {
+            LibvirtStats::Call call(m_conn, "virStoragePoolListAllVolumes");
+            count = virStoragePoolListAllVolumes(m_pool, &vols, flags);
+        }
         if (count > 0) {
             for (int i = 0; i < count; ++i) {
                 auto vol = new StorageVol(vols[i], m_pool, this);
@@ -165,11 +186,13 @@ QVector<StorageVol *> StoragePool::storageVols(unsigned int flags)
 
 bool StoragePool::build(int flags)
 {
+    LibvirtStats::Call call(m_conn, "virStoragePoolBuild");
     return virStoragePoolBuild(m_pool, flags) == 0;
 }
 
 bool StoragePool::create(int flags)
 {
+    LibvirtStats::Call call(m_conn, "virStoragePoolCreate");
     return virStoragePoolCreate(m_pool, flags) == 0;
 }
 
@@ -208,7 +231,11 @@ StorageVol *StoragePool::createStorageVolume(const QString &name,
     stream.writeEndElement(); // volume
     qDebug() << "XML output" << output;
 
-    virStorageVolPtr vol = virStorageVolCreateXML(m_pool, output.constData(), flags);
+    virStorageVolPtr vol;
+    {
+        LibvirtStats::Call call(m_conn, "virStorageVolCreateXML");
+        vol = virStorageVolCreateXML(m_pool, output.constData(), flags);
+    }
     if (vol) {
         return new StorageVol(vol, m_pool, this);
     }
@@ -217,7 +244,11 @@ StorageVol *StoragePool::createStorageVolume(const QString &name,
 
 StorageVol *StoragePool::getVolume(const QString &name)
 {
-    virStorageVolPtr vol = virStorageVolLookupByName(m_pool, name.toUtf8().constData());
+    virStorageVolPtr vol;
+    {
+        LibvirtStats::Call call(m_conn, "virStorageVolLookupByName");
+        vol = virStorageVolLookupByName(m_pool, name.toUtf8().constData());
+    }
     if (!vol) {
         return nullptr;
     }
@@ -227,7 +258,11 @@ StorageVol *StoragePool::getVolume(const QString &name)
 QDomDocument StoragePool::xmlDoc()
 {
     if (m_xml.isNull()) {
-        char *xml               = virStoragePoolGetXMLDesc(m_pool, 0);
+        char *xml;
+        {
+            LibvirtStats::Call call(m_conn, "virStoragePoolGetXMLDesc");
+            xml = virStoragePoolGetXMLDesc(m_pool, 0);
+        }
         const QString xmlString = QString::fromUtf8(xml);
         //        qDebug() << "XML" << xml;
         QString error;
@@ -241,6 +276,7 @@ QDomDocument StoragePool::xmlDoc()
 
 bool StoragePool::getInfo()
 {
+    LibvirtStats::Call call(m_conn, "virStoragePoolGetInfo");
     if (virStoragePoolGetInfo(m_pool, &m_info) == 0) {
         m_gotInfo = true;
     }
@@ -56,6 +56,7 @@ public:
     int volumeCount();
 
     QString path();
+    bool supportsReflink();
 
     bool start();
     bool stop();
@@ -74,11 +75,15 @@ public:
     StorageVol *getVolume(const QString &name);
 
 private:
+    friend class StorageVol;
+
     QDomDocument xmlDoc();
     bool getInfo();
 
     QDomDocument m_xml;
     virStoragePoolPtr m_pool;
+    // Of the pool, only to time the calls
+    virConnectPtr m_conn;
     QVector<StorageVol *> m_vols;
     virStoragePoolInfo m_info;
     bool m_gotVols = false;
@@ -17,9 +17,13 @@
  */
 #include "storagevol.h"
 
+#include "libvirtstats.h"
 #include "storagepool.h"
 #include "virtlyst.h"
 
+#include <libvirt/virterror.h>
+
+#include <QElapsedTimer>
 #include <QLoggingCategory>
 #include <QXmlStreamWriter>
 
@@ -27,6 +31,7 @@ StorageVol::StorageVol(virStorageVolPtr vol, virStoragePoolPtr pool, QObject *pa
     : QObject(parent)
     , m_vol(vol)
     , m_pool(pool)
+    , m_conn(virStorageVolGetConnect(vol))
 {
 }
 
@@ -56,6 +61,14 @@ QString StorageVol::size()
     return QString();
 }
 
+quint64 StorageVol::allocation()
+{
+    if (getInfo()) {
+        return m_info.allocation;
+    }
+    return 0;
+}
+
 QString StorageVol::usedby()
 {
     QString usedbyvm;
@@ -64,14 +77,21 @@ QString StorageVol::usedby()
     QString trysrc;
     QVector<Domain *> ret;
 
-    m_conn = virStorageVolGetConnect(m_vol);
     virDomainPtr *domains;
-    int count = virConnectListAllDomains(
-        m_conn, &domains, VIR_CONNECT_LIST_DOMAINS_ACTIVE | VIR_CONNECT_LIST_DOMAINS_INACTIVE);
+    int count;
+    {
+        LibvirtStats::Call call(m_conn, "virConnectListAllDomains");
+        count = virConnectListAllDomains(
+            m_conn, &domains, VIR_CONNECT_LIST_DOMAINS_ACTIVE | VIR_CONNECT_LIST_DOMAINS_INACTIVE);
+    }
     if (count > 0) {
         for (int i = 0; i < count; i++) {
-            tryname           = QString::fromUtf8(virDomainGetName(domains[i]));
-            char *xml         = virDomainGetXMLDesc(domains[i], VIR_DOMAIN_XML_SECURE);
+            tryname = QString::fromUtf8(virDomainGetName(domains[i]));
+            char *xml;
+            {
+                LibvirtStats::Call call(m_conn, "virDomainGetXMLDesc");
+                xml = virDomainGetXMLDesc(domains[i], VIR_DOMAIN_XML_SECURE);
+            }
             QString xmlString = QString::fromUtf8(xml);
             QString error;
             QDomDocument domxml;
@@ -98,16 +118,35 @@ QString StorageVol::usedby()
 
 QString StorageVol::path()
 {
+    LibvirtStats::Call call(m_conn, "virStorageVolGetPath");
     return QString::fromUtf8(virStorageVolGetPath(m_vol));
 }
 
+QString StorageVol::backingStore()
+{
+    return xmlDoc()
+        .documentElement()
+        .firstChildElement(QStringLiteral("backingStore"))
+        .firstChildElement(QStringLiteral("path"))
+        .firstChild()
+        .nodeValue();
+}
+
 bool StorageVol::undefine(int flags)
 {
+    LibvirtStats::Call call(m_conn, "virStorageVolDelete");
     return virStorageVolDelete(m_vol, flags) == 0;
 }
 
-StorageVol *StorageVol::clone(const QString &name, const QString &format, int flags)
+StorageVol *StorageVol::clone(const QString &name,
+                              const QString &format,
+                              int flags,
+                              CloneMode mode,
+                              CloneStats *stats,
+                              StoragePool *target)
 {
+    virStoragePoolPtr targetPool = target ? target->m_pool : poolPtr();
+
     QByteArray output;
     QXmlStreamWriter stream(&output);
 
@@ -131,7 +170,87 @@ StorageVol *StorageVol::clone(const QString &name, const QString &format, int fl
     stream.writeEndElement(); // volume
     qDebug() << "XML output" << output;
 
-    virStorageVolPtr vol = virStorageVolCreateXMLFrom(poolPtr(), output.constData(), m_vol, flags);
+    QElapsedTimer timer;
+    timer.start();
+
+    // libvirt only reflinks raw copies, and it fails rather than
+    // copying when the filesystem can't share extents
+    virStorageVolPtr vol = nullptr;
+    bool reflinked       = false;
+    if (mode == CloneReflink && localFormat == u"raw" &&
+        (target ? target : pool())->supportsReflink()) {
+        {
+            LibvirtStats::Call call(m_conn, "virStorageVolCreateXMLFrom");
+            vol = virStorageVolCreateXMLFrom(
+                targetPool, output.constData(), m_vol, VIR_STORAGE_VOL_CREATE_REFLINK);
+        }
+        reflinked = vol != nullptr;
+        if (!reflinked) {
+            qDebug() << "Reflink clone not possible, falling back to copy"
+                     << virGetLastErrorMessage();
+        }
+    }
+
+    if (!vol) {
+        LibvirtStats::Call call(m_conn, "virStorageVolCreateXMLFrom");
+        vol = virStorageVolCreateXMLFrom(targetPool, output.constData(), m_vol, flags);
+    }
+
+    if (!vol) {
+        return nullptr;
+    }
+
+    auto ret = new StorageVol(vol, targetPool, this);
+
+    CloneStats localStats;
+    localStats.elapsedMs = timer.elapsed();
+    localStats.reflink   = reflinked;
+    localStats.bytes     = reflinked ? 0 : ret->allocation();
+    qInfo() << "Cloned" << this->name() << "to" << ret->name() << "in" << localStats.elapsedMs
+            << "ms" << (reflinked ? "using reflink" : "copying") << localStats.bytes << "bytes";
+    if (stats) {
+        *stats = localStats;
+    }
+
+    return ret;
+}
+
+StorageVol *StorageVol::linkedClone(const QString &name)
+{
+    if (!getInfo()) {
+        return nullptr;
+    }
+
+    QByteArray output;
+    QXmlStreamWriter stream(&output);
+
+    // A qcow2 overlay only stores the blocks that diverge from
+    // its backing file, so creating it takes the same time
+    // no matter how big the template is
+    stream.writeStartElement(QStringLiteral("volume"));
+    stream.writeTextElement(QStringLiteral("name"), name);
+    stream.writeTextElement(QStringLiteral("capacity"), QString::number(m_info.capacity));
+    stream.writeTextElement(QStringLiteral("allocation"), QStringLiteral("0"));
+
+    stream.writeStartElement(QStringLiteral("target"));
+    stream.writeEmptyElement(QStringLiteral("format"));
+    stream.writeAttribute(QStringLiteral("type"), QStringLiteral("qcow2"));
+    stream.writeEndElement(); // target
+
+    stream.writeStartElement(QStringLiteral("backingStore"));
+    stream.writeTextElement(QStringLiteral("path"), path());
+    stream.writeEmptyElement(QStringLiteral("format"));
+    stream.writeAttribute(QStringLiteral("type"), type());
+    stream.writeEndElement(); // backingStore
+
+    stream.writeEndElement(); // volume
+
+    virStoragePoolPtr pool = poolPtr();
+    virStorageVolPtr vol;
+    {
+        LibvirtStats::Call call(m_conn, "virStorageVolCreateXML");
+        vol = virStorageVolCreateXML(pool, output.constData(), 0);
+    }
     if (vol) {
         return new StorageVol(vol, m_pool, this);
     }
@@ -143,10 +262,22 @@ StoragePool *StorageVol::pool()
     return new StoragePool(poolPtr(), this);
 }
 
+QString StorageVol::cloneSummary(const QString &name, const CloneStats &stats)
+{
+    if (stats.reflink) {
+        return QStringLiteral("Volume %1 reflinked in %2 ms").arg(name).arg(stats.elapsedMs);
+    }
+    return QStringLiteral("Volume %1 copied in %2 ms, %3 written")
+        .arg(name)
+        .arg(stats.elapsedMs)
+        .arg(Virtlyst::prettyKibiBytes(stats.bytes / 1024));
+}
+
 bool StorageVol::getInfo()
 {
-    if (!m_gotInfo && virStorageVolGetInfo(m_vol, &m_info) == 0) {
-        m_gotInfo = true;
+    if (!m_gotInfo) {
+        LibvirtStats::Call call(m_conn, "virStorageVolGetInfo");
+        m_gotInfo = virStorageVolGetInfo(m_vol, &m_info) == 0;
     }
     return m_gotInfo;
 }
@@ -154,7 +285,11 @@ bool StorageVol::getInfo()
 QDomDocument StorageVol::xmlDoc()
 {
     if (m_xml.isNull()) {
-        char *xml               = virStorageVolGetXMLDesc(m_vol, 0);
+        char *xml;
+        {
+            LibvirtStats::Call call(m_conn, "virStorageVolGetXMLDesc");
+            xml = virStorageVolGetXMLDesc(m_vol, 0);
+        }
         const QString xmlString = QString::fromUtf8(xml);
         qDebug() << "XML" << xml;
         QString error;
@@ -169,6 +304,7 @@ QDomDocument StorageVol::xmlDoc()
 virStoragePoolPtr StorageVol::poolPtr()
 {
     if (!m_pool) {
+        LibvirtStats::Call call(m_conn, "virStoragePoolLookupByVolume");
         m_pool = virStoragePoolLookupByVolume(m_vol);
     }
     return m_pool;
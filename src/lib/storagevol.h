@@ -33,20 +33,42 @@ class StorageVol : public QObject
     Q_PROPERTY(QString size READ size CONSTANT)
     Q_PROPERTY(QString usedby READ usedby CONSTANT)
     Q_PROPERTY(QString path READ path CONSTANT)
+    Q_PROPERTY(QString backingStore READ backingStore CONSTANT)
 public:
+    enum CloneMode {
+        CloneCopy,
+        CloneReflink,
+    };
+
+    struct CloneStats {
+        qint64 elapsedMs = 0;
+        quint64 bytes    = 0;
+        bool reflink     = false;
+    };
+
     explicit StorageVol(virStorageVolPtr vol, virStoragePoolPtr pool, QObject *parent = nullptr);
 
     QString name();
     QString type();
     QString size();
+    quint64 allocation();
     QString usedby();
     QString path();
+    QString backingStore();
 
     bool undefine(int flags = 0);
-    StorageVol *clone(const QString &name, const QString &format, int flags);
+    StorageVol *clone(const QString &name,
+                      const QString &format,
+                      int flags,
+                      CloneMode mode      = CloneCopy,
+                      CloneStats *stats   = nullptr,
+                      StoragePool *target = nullptr);
+    StorageVol *linkedClone(const QString &name);
 
     StoragePool *pool();
 
+    static QString cloneSummary(const QString &name, const CloneStats &stats);
+
 private:
     bool getInfo();
     QDomDocument xmlDoc();
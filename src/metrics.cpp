@@ -0,0 +1,667 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "metrics.h"
+
+#include "consolesession.h"
+#include "lib/libvirtstats.h"
+#include "sampler.h"
+#include "virtlyst.h"
+
+#include <Cutelyst/Action>
+#include <Cutelyst/Application>
+#include <Cutelyst/Context>
+#include <Cutelyst/Request>
+#include <Cutelyst/Response>
+
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QMutex>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iterator>
+
+Q_LOGGING_CATEGORY(V_METRICS, "virtlyst.metrics")
+
+namespace {
+
+// Request latency buckets, in seconds
+constexpr double Buckets[] = {0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+constexpr int BucketCount  = int(std::size(Buckets));
+
+struct Histogram {
+    qint64 buckets[BucketCount] = {};
+    qint64 count                = 0;
+    double sum                  = 0;
+};
+
+// Requests of all worker threads, by action
+QMutex requestsMutex;
+QHash<QString, Histogram> requests;
+
+struct DomainMetric {
+    const char *name;
+    const char *type;
+    const char *help;
+    const char *field;
+    double scale;
+};
+
+constexpr DomainMetric DomainMetrics[] = {
+    {"virtlyst_domain_state", "gauge", "Domain state as a virDomainState value", "state.state", 1},
+    {"virtlyst_domain_cpu_seconds_total", "counter", "CPU time of the domain", "cpu.time", 1e-9},
+    {"virtlyst_domain_cpu_user_seconds_total",
+     "counter",
+     "User CPU time of the domain",
+     "cpu.user",
+     1e-9},
+    {"virtlyst_domain_cpu_system_seconds_total",
+     "counter",
+     "System CPU time of the domain",
+     "cpu.system",
+     1e-9},
+    {"virtlyst_domain_balloon_current_bytes",
+     "gauge",
+     "Memory currently assigned by the balloon",
+     "balloon.current",
+     1024},
+    {"virtlyst_domain_balloon_maximum_bytes",
+     "gauge",
+     "Maximum memory of the balloon",
+     "balloon.maximum",
+     1024},
+    {"virtlyst_domain_memory_unused_bytes",
+     "gauge",
+     "Memory the guest leaves unused",
+     "balloon.unused",
+     1024},
+    {"virtlyst_domain_memory_available_bytes",
+     "gauge",
+     "Memory the guest sees",
+     "balloon.available",
+     1024},
+    {"virtlyst_domain_memory_usable_bytes",
+     "gauge",
+     "Memory the guest can use without swapping",
+     "balloon.usable",
+     1024},
+    {"virtlyst_domain_memory_rss_bytes",
+     "gauge",
+     "Resident memory of the domain process",
+     "balloon.rss",
+     1024},
+    {"virtlyst_domain_memory_swap_in_bytes_total",
+     "counter",
+     "Memory swapped in by the guest",
+     "balloon.swap_in",
+     1024},
+    {"virtlyst_domain_memory_swap_out_bytes_total",
+     "counter",
+     "Memory swapped out by the guest",
+     "balloon.swap_out",
+     1024},
+    {"virtlyst_domain_memory_major_faults_total",
+     "counter",
+     "Major page faults of the guest",
+     "balloon.major_fault",
+     1},
+    {"virtlyst_domain_perf_cache_occupancy_bytes",
+     "gauge",
+     "Last level cache used by the domain, while the cmt perf event is enabled",
+     "perf.cmt",
+     1},
+    {"virtlyst_domain_perf_memory_bandwidth_total_bytes_per_second",
+     "gauge",
+     "Total memory bandwidth of the domain, while the mbmt perf event is enabled",
+     "perf.mbmt",
+     1},
+    {"virtlyst_domain_perf_memory_bandwidth_local_bytes_per_second",
+     "gauge",
+     "Local memory bandwidth of the domain, while the mbml perf event is enabled",
+     "perf.mbml",
+     1},
+    {"virtlyst_domain_perf_cache_misses_total",
+     "counter",
+     "Cache misses of the domain, while the cache_misses perf event is enabled",
+     "perf.cache_misses",
+     1},
+    {"virtlyst_domain_perf_cycles_total",
+     "counter",
+     "CPU cycles of the domain, while the cycles perf event is enabled",
+     "perf.cycles",
+     1},
+    {"virtlyst_domain_perf_instructions_total",
+     "counter",
+     "Instructions of the domain, while the instructions perf event is enabled",
+     "perf.instructions",
+     1},
+};
+
+// Stats of numbered devices, e.g. "net.0.rx.bytes" named by "net.0.name",
+// or "vcpu.0.time" named by its number
+struct DeviceMetric {
+    const char *name;
+    const char *type;
+    const char *help;
+    const char *group;
+    const char *label;
+    const char *field;
+    double scale;
+};
+
+constexpr DeviceMetric DeviceMetrics[] = {
+    {"virtlyst_domain_net_receive_bytes_total",
+     "counter",
+     "Bytes received by the interface",
+     "net",
+     "interface",
+     "rx.bytes",
+     1},
+    {"virtlyst_domain_net_receive_packets_total",
+     "counter",
+     "Packets received by the interface",
+     "net",
+     "interface",
+     "rx.pkts",
+     1},
+    {"virtlyst_domain_net_transmit_bytes_total",
+     "counter",
+     "Bytes sent by the interface",
+     "net",
+     "interface",
+     "tx.bytes",
+     1},
+    {"virtlyst_domain_net_transmit_packets_total",
+     "counter",
+     "Packets sent by the interface",
+     "net",
+     "interface",
+     "tx.pkts",
+     1},
+    {"virtlyst_domain_vcpu_seconds_total",
+     "counter",
+     "CPU time of the vCPU",
+     "vcpu",
+     "vcpu",
+     "time",
+     1e-9},
+    {"virtlyst_domain_vcpu_wait_seconds_total",
+     "counter",
+     "Time the vCPU wanted to run while the host ran something else",
+     "vcpu",
+     "vcpu",
+     "wait",
+     1e-9},
+    {"virtlyst_domain_vcpu_delay_seconds_total",
+     "counter",
+     "Time the vCPU spent queued on the host, the steal time of the guest",
+     "vcpu",
+     "vcpu",
+     "delay",
+     1e-9},
+    {"virtlyst_domain_block_read_bytes_total",
+     "counter",
+     "Bytes read from the disk",
+     "block",
+     "device",
+     "rd.bytes",
+     1},
+    {"virtlyst_domain_block_read_requests_total",
+     "counter",
+     "Read requests of the disk",
+     "block",
+     "device",
+     "rd.reqs",
+     1},
+    {"virtlyst_domain_block_write_bytes_total",
+     "counter",
+     "Bytes written to the disk",
+     "block",
+     "device",
+     "wr.bytes",
+     1},
+    {"virtlyst_domain_block_write_requests_total",
+     "counter",
+     "Write requests of the disk",
+     "block",
+     "device",
+     "wr.reqs",
+     1},
+};
+
+QByteArray escapeLabel(const QString &value)
+{
+    QByteArray ret = value.toUtf8();
+    if (ret.contains('\\') || ret.contains('"') || ret.contains('\n')) {
+        ret.replace('\\', "\\\\").replace('"', "\\\"").replace('\n', "\\n");
+    }
+    return ret;
+}
+
+// Buffers the exposition and hands it to the response in chunks,
+// so a large scrape never lives in one string
+class MetricWriter
+{
+public:
+    MetricWriter(Response *res, bool openMetrics)
+        : m_res(res)
+        , m_openMetrics(openMetrics)
+    {
+        m_buf.reserve(ChunkSize + 1024);
+    }
+
+    ~MetricWriter()
+    {
+        if (m_openMetrics) {
+            m_buf.append("# EOF\n");
+        }
+        flush();
+    }
+
+    void family(const char *name, const char *type, const char *help)
+    {
+        // OpenMetrics names the counter family without the suffix
+        QByteArray family(name);
+        if (m_openMetrics && qstrcmp(type, "counter") == 0 && family.endsWith("_total")) {
+            family.chop(6);
+        }
+        m_buf.append("# HELP ").append(family).append(' ').append(help).append('\n');
+        m_buf.append("# TYPE ").append(family).append(' ').append(type).append('\n');
+    }
+
+    // labels are already escaped, extra is an optional name="value" pair
+    void sample(const char *name,
+                const QByteArray &labels,
+                double value,
+                const char *extraName   = nullptr,
+                const QByteArray &extra = {})
+    {
+        m_buf.append(name);
+        if (!labels.isEmpty() || extraName) {
+            m_buf.append('{').append(labels);
+            if (extraName) {
+                if (!labels.isEmpty()) {
+                    m_buf.append(',');
+                }
+                m_buf.append(extraName).append("=\"").append(extra).append('"');
+            }
+            m_buf.append('}');
+        }
+        m_buf.append(' ');
+        appendValue(value);
+        m_buf.append('\n');
+
+        if (m_buf.size() >= ChunkSize) {
+            flush();
+        }
+    }
+
+    void flush()
+    {
+        if (!m_buf.isEmpty()) {
+            m_res->write(m_buf);
+            m_buf.clear();
+        }
+    }
+
+private:
+    static constexpr qsizetype ChunkSize = 32 * 1024;
+
+    void appendValue(double value)
+    {
+        if (std::isinf(value)) {
+            m_buf.append(value > 0 ? "+Inf" : "-Inf");
+        } else if (value == std::floor(value) && std::abs(value) < 1e15) {
+            m_buf.append(QByteArray::number(qint64(value)));
+        } else {
+            m_buf.append(QByteArray::number(value, 'g', 15));
+        }
+    }
+
+    Response *m_res;
+    QByteArray m_buf;
+    bool m_openMetrics;
+};
+
+void writeHosts(MetricWriter &out, const Sampler::Snapshot &snapshot)
+{
+    QVector<QByteArray> labels;
+    labels.reserve(snapshot.size());
+    for (const Sampler::Host &host : snapshot) {
+        labels.append("host=\"" + escapeLabel(host.name) + "\",host_id=\"" +
+                      escapeLabel(host.id) + '"');
+    }
+
+    out.family("virtlyst_host_up", "gauge", "Whether the last sample reached the host");
+    for (int i = 0; i < snapshot.size(); ++i) {
+        out.sample("virtlyst_host_up", labels[i], snapshot[i].up ? 1 : 0);
+    }
+
+    out.family("virtlyst_host_sample_timestamp_seconds", "gauge", "When the host was sampled");
+    for (int i = 0; i < snapshot.size(); ++i) {
+        out.sample(
+            "virtlyst_host_sample_timestamp_seconds", labels[i], snapshot[i].timestamp / 1000.0);
+    }
+
+    out.family("virtlyst_host_sample_duration_seconds", "gauge", "Time taken to sample the host");
+    for (int i = 0; i < snapshot.size(); ++i) {
+        out.sample(
+            "virtlyst_host_sample_duration_seconds", labels[i], snapshot[i].durationMs / 1000.0);
+    }
+
+    out.family("virtlyst_host_domains", "gauge", "Domains defined on the host");
+    for (int i = 0; i < snapshot.size(); ++i) {
+        if (snapshot[i].up) {
+            out.sample("virtlyst_host_domains", labels[i], snapshot[i].domains.size());
+        }
+    }
+
+    out.family("virtlyst_host_cpu_seconds_total", "counter", "CPU time of the host by mode");
+    for (int i = 0; i < snapshot.size(); ++i) {
+        const QHash<QByteArray, double> &node = snapshot[i].node;
+        for (auto it = node.cbegin(); it != node.cend(); ++it) {
+            if (it.key().startsWith("cpu.") && it.key() != "cpu.utilization") {
+                out.sample("virtlyst_host_cpu_seconds_total",
+                           labels[i],
+                           it.value() / 1e9,
+                           "mode",
+                           it.key().mid(4));
+            }
+        }
+    }
+
+    out.family("virtlyst_host_memory_bytes", "gauge", "Memory of the host by kind");
+    for (int i = 0; i < snapshot.size(); ++i) {
+        const QHash<QByteArray, double> &node = snapshot[i].node;
+        for (auto it = node.cbegin(); it != node.cend(); ++it) {
+            if (it.key().startsWith("memory.")) {
+                out.sample("virtlyst_host_memory_bytes",
+                           labels[i],
+                           it.value() * 1024,
+                           "kind",
+                           it.key().mid(7));
+            }
+        }
+    }
+
+    out.family("virtlyst_host_numa_memory_bytes", "gauge", "Memory of the host NUMA cells by kind");
+    for (int i = 0; i < snapshot.size(); ++i) {
+        const QHash<QByteArray, double> &node = snapshot[i].node;
+        const int cells                       = int(node.value("numa.count"));
+        for (int cell = 0; cell < cells; ++cell) {
+            const QByteArray prefix     = "numa." + QByteArray::number(cell);
+            const QByteArray cellLabels = labels[i] + ",cell=\"" + QByteArray::number(cell) + '"';
+            for (const char *kind : {"total", "free"}) {
+                auto it = node.constFind(prefix + '.' + kind);
+                if (it != node.cend()) {
+                    out.sample("virtlyst_host_numa_memory_bytes",
+                               cellLabels,
+                               it.value() * 1024,
+                               "kind",
+                               kind);
+                }
+            }
+        }
+    }
+
+    // e.g. "numa.0.pages.2048.free", sizes in KiB
+    out.family(
+        "virtlyst_host_numa_pages", "gauge", "Pages of the host NUMA cells by size and kind");
+    for (int i = 0; i < snapshot.size(); ++i) {
+        const QHash<QByteArray, double> &node = snapshot[i].node;
+        for (auto it = node.cbegin(); it != node.cend(); ++it) {
+            const QList<QByteArray> parts = it.key().split('.');
+            if (parts.size() != 5 || parts[0] != "numa" || parts[2] != "pages") {
+                continue;
+            }
+            const QByteArray pageLabels = labels[i] + ",cell=\"" + parts[1] + "\",size_bytes=\"" +
+                                          QByteArray::number(parts[3].toULongLong() * 1024) + '"';
+            out.sample("virtlyst_host_numa_pages", pageLabels, it.value(), "kind", parts[4]);
+        }
+    }
+
+    out.family("virtlyst_host_ksm_pages", "gauge", "Pages merged by KSM on the host by kind");
+    for (int i = 0; i < snapshot.size(); ++i) {
+        const QHash<QByteArray, double> &node = snapshot[i].node;
+        for (const char *kind : {"shared", "sharing", "unshared", "volatile"}) {
+            auto it = node.constFind(QByteArray("ksm.pages_") + kind);
+            if (it != node.cend()) {
+                out.sample("virtlyst_host_ksm_pages", labels[i], it.value(), "kind", kind);
+            }
+        }
+    }
+}
+
+void writeDomains(MetricWriter &out, const Sampler::Snapshot &snapshot)
+{
+    // Label sets of every domain, rendered once per scrape
+    QVector<QVector<QByteArray>> labels(snapshot.size());
+    for (int i = 0; i < snapshot.size(); ++i) {
+        const QByteArray host = escapeLabel(snapshot[i].name);
+        labels[i].reserve(snapshot[i].domains.size());
+        for (const Connection::StatsRecord &dom : snapshot[i].domains) {
+            labels[i].append("host=\"" + host + "\",domain=\"" + escapeLabel(dom.name) +
+                             "\",uuid=\"" + dom.uuid.toLatin1() + '"');
+        }
+    }
+
+    for (const DomainMetric &metric : DomainMetrics) {
+        const QByteArray field = QByteArray::fromRawData(metric.field, qstrlen(metric.field));
+        out.family(metric.name, metric.type, metric.help);
+        for (int i = 0; i < snapshot.size(); ++i) {
+            const QVector<Connection::StatsRecord> &domains = snapshot[i].domains;
+            for (int j = 0; j < domains.size(); ++j) {
+                auto it = domains[j].values.constFind(field);
+                if (it != domains[j].values.cend()) {
+                    out.sample(metric.name, labels[i][j], it.value() * metric.scale);
+                }
+            }
+        }
+    }
+
+    for (const DeviceMetric &metric : DeviceMetrics) {
+        const QByteArray group = metric.group;
+        out.family(metric.name, metric.type, metric.help);
+        for (int i = 0; i < snapshot.size(); ++i) {
+            const QVector<Connection::StatsRecord> &domains = snapshot[i].domains;
+            for (int j = 0; j < domains.size(); ++j) {
+                const Connection::StatsRecord &dom = domains[j];
+                // vCPUs are numbered up to the maximum instead
+                const int count = int(
+                    dom.values.value(group + ".count", dom.values.value(group + ".maximum")));
+                for (int k = 0; k < count; ++k) {
+                    const QByteArray prefix = group + '.' + QByteArray::number(k) + '.';
+                    auto it                 = dom.values.constFind(prefix + metric.field);
+                    if (it == dom.values.cend()) {
+                        continue;
+                    }
+                    auto name = dom.strings.constFind(prefix + "name");
+                    out.sample(metric.name,
+                               labels[i][j],
+                               it.value() * metric.scale,
+                               metric.label,
+                               name != dom.strings.cend() ? escapeLabel(*name)
+                                                          : QByteArray::number(k));
+                }
+            }
+        }
+    }
+}
+
+void writeInternals(MetricWriter &out)
+{
+    QHash<QString, Histogram> requestsCopy;
+    {
+        QMutexLocker locker(&requestsMutex);
+        requestsCopy = requests;
+    }
+
+    out.family("virtlyst_http_request_duration_seconds", "histogram", "Request latency by action");
+    for (auto it = requestsCopy.cbegin(); it != requestsCopy.cend(); ++it) {
+        const QByteArray labels  = "action=\"" + escapeLabel(it.key()) + '"';
+        const Histogram &latency = it.value();
+        qint64 cumulative        = 0;
+        for (int i = 0; i < BucketCount; ++i) {
+            cumulative += latency.buckets[i];
+            out.sample("virtlyst_http_request_duration_seconds_bucket",
+                       labels,
+                       cumulative,
+                       "le",
+                       QByteArray::number(Buckets[i]));
+        }
+        out.sample("virtlyst_http_request_duration_seconds_bucket",
+                   labels,
+                   latency.count,
+                   "le",
+                   "+Inf");
+        out.sample("virtlyst_http_request_duration_seconds_sum", labels, latency.sum);
+        out.sample("virtlyst_http_request_duration_seconds_count", labels, latency.count);
+    }
+
+    const QHash<QByteArray, qint64> calls = LibvirtStats::calls();
+    out.family("virtlyst_libvirt_calls_total", "counter", "Calls to libvirt by function");
+    for (auto it = calls.cbegin(); it != calls.cend(); ++it) {
+        out.sample("virtlyst_libvirt_calls_total", {}, it.value(), "function", it.key());
+    }
+
+    // Quantiles are only known within a bucket, 12.5%
+    const auto callLatencies = LibvirtStats::latencies();
+    out.family(
+        "virtlyst_libvirt_call_duration_seconds", "summary", "Latency of libvirt calls by host");
+    for (auto it = callLatencies.cbegin(); it != callLatencies.cend(); ++it) {
+        const QByteArray labels = "host=\"" + escapeLabel(it.key().first) + "\",function=\"" +
+                                  escapeLabel(QString::fromLatin1(it.key().second)) + '"';
+        const LibvirtStats::Latency &latency = it.value();
+        for (double quantile : {0.5, 0.9, 0.99}) {
+            out.sample("virtlyst_libvirt_call_duration_seconds",
+                       labels,
+                       latency.quantile(quantile) / 1e6,
+                       "quantile",
+                       QByteArray::number(quantile));
+        }
+        out.sample("virtlyst_libvirt_call_duration_seconds_sum", labels, latency.sum / 1e6);
+        out.sample("virtlyst_libvirt_call_duration_seconds_count", labels, latency.count);
+    }
+
+    out.family("virtlyst_cache_lookups_total", "counter", "Lookups in the libvirt object caches");
+    out.sample("virtlyst_cache_lookups_total", {}, LibvirtStats::cacheHits(), "result", "hit");
+    out.sample("virtlyst_cache_lookups_total", {}, LibvirtStats::cacheMisses(), "result", "miss");
+
+    const QJsonObject consoles = ConsoleSession::hosts();
+    QVector<QByteArray> labels;
+    for (auto it = consoles.constBegin(); it != consoles.constEnd(); ++it) {
+        const QJsonObject host = it.value().toObject();
+        labels.append("host=\"" + escapeLabel(host.value(u"name").toString()) +
+                      "\",host_id=\"" + escapeLabel(it.key()) + '"');
+    }
+
+    const auto writeConsole =
+        [&](const char *name, const char *type, const char *help, QStringView key) {
+        out.family(name, type, help);
+        int i = 0;
+        for (auto it = consoles.constBegin(); it != consoles.constEnd(); ++it, ++i) {
+            out.sample(name, labels[i], it.value()[key].toDouble());
+        }
+    };
+    writeConsole("virtlyst_console_sessions_active", "gauge", "Open console sessions", u"active");
+    writeConsole(
+        "virtlyst_console_sessions_total", "counter", "Console sessions started", u"sessions");
+    writeConsole("virtlyst_console_sent_bytes_total",
+                 "counter",
+                 "Console bytes sent to browsers",
+                 u"sent");
+    writeConsole("virtlyst_console_received_bytes_total",
+                 "counter",
+                 "Console bytes received from browsers",
+                 u"received");
+
+    out.family("virtlyst_console_closed_total", "counter", "Ended console sessions by cause");
+    int i = 0;
+    for (auto it = consoles.constBegin(); it != consoles.constEnd(); ++it, ++i) {
+        const QJsonObject closed = it.value()[u"closed"].toObject();
+        for (auto cause = closed.constBegin(); cause != closed.constEnd(); ++cause) {
+            out.sample("virtlyst_console_closed_total",
+                       labels[i],
+                       cause.value().toDouble(),
+                       "cause",
+                       cause.key().toLatin1());
+        }
+    }
+}
+
+qint64 now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+} // namespace
+
+Metrics::Metrics(Virtlyst *parent)
+    : Controller(parent)
+    , m_token(parent->config(u"MetricsToken"_qs).toString().toUtf8())
+{
+    connect(parent, &Application::beforeDispatch, this, [](Context *c) {
+        c->setStash(u"_metrics_start"_qs, now());
+    });
+    connect(parent, &Application::afterDispatch, this, [](Context *c) {
+        const qint64 start = c->stash(u"_metrics_start"_qs).toLongLong();
+        if (!start) {
+            return;
+        }
+        const double seconds = (now() - start) / 1e9;
+        const QString action = c->action() ? c->action()->reverse() : u"none"_qs;
+
+        QMutexLocker locker(&requestsMutex);
+        Histogram &latency = requests[action];
+        const double *bucket =
+            std::lower_bound(std::begin(Buckets), std::end(Buckets), seconds);
+        if (bucket != std::end(Buckets)) {
+            ++latency.buckets[bucket - std::begin(Buckets)];
+        }
+        ++latency.count;
+        latency.sum += seconds;
+    });
+}
+
+void Metrics::index(Context *c)
+{
+    const bool openMetrics =
+        c->request()->header("Accept").contains("application/openmetrics-text");
+    c->response()->setContentType(
+        openMetrics ? "application/openmetrics-text; version=1.0.0; charset=utf-8"_qba
+                    : "text/plain; version=0.0.4; charset=utf-8"_qba);
+
+    // Rendered from the last sample, a scrape never waits on libvirt
+    const QSharedPointer<const Sampler::Snapshot> snapshot = Sampler::snapshot();
+
+    MetricWriter out(c->response(), openMetrics);
+    if (snapshot) {
+        writeHosts(out, *snapshot);
+        writeDomains(out, *snapshot);
+    } else {
+        qCDebug(V_METRICS) << "No sample yet";
+    }
+    writeInternals(out);
+}
+
+bool Metrics::scraperAuthorized(Context *c) const
+{
+    return !m_token.isEmpty() && c->request()->header("Authorization") == "Bearer " + m_token;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Cutelyst/Controller>
+
+using namespace Cutelyst;
+
+class Virtlyst;
+class Metrics : public Controller
+{
+    Q_OBJECT
+public:
+    explicit Metrics(Virtlyst *parent = nullptr);
+
+    // Prometheus text format, or OpenMetrics when the scraper asks for it
+    C_ATTR(index, :Path :AutoArgs)
+    void index(Context *c);
+
+    // True for "Authorization: Bearer <MetricsToken>", so that
+    // scrapers don't need a login session
+    bool scraperAuthorized(Context *c) const;
+
+private Q_SLOTS:
+    void End(Context *c) { Q_UNUSED(c); }
+
+private:
+    QByteArray m_token;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,747 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "metricsstore.h"
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+Q_LOGGING_CATEGORY(V_METRICSSTORE, "virtlyst.metricsstore")
+
+namespace {
+
+struct Tier {
+    // Seconds per rolled up point, 0 keeps every sample
+    quint32 step;
+    quint32 retention;
+};
+
+constexpr Tier Tiers[MetricsStore::ResolutionCount] = {
+    {0, 3600},
+    {60, 24 * 3600},
+    {15 * 60, 7 * 24 * 3600},
+    {3600, 30 * 24 * 3600},
+};
+
+// Log layout, native endian as the file never leaves the host:
+//   "VLMS" quint32 version
+//   'S' quint32 id, quint16 size, key          a new series
+//   quint8 resolution, quint32 id, quint32 time, float value
+constexpr char Magic[]            = {'V', 'L', 'M', 'S'};
+constexpr quint32 Version         = 1;
+constexpr int HeaderSize          = 8;
+constexpr char SeriesTag          = 'S';
+constexpr int PointSize           = 13;
+constexpr qint64 CompactThreshold = 1024 * 1024;
+// Counters not seen for this long belong to gone domains
+constexpr qint64 CounterExpiry = 10 * 60 * 1000;
+
+template <typename T>
+void put(QByteArray &buf, T value)
+{
+    buf.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+T get(const uchar *data)
+{
+    T ret;
+    memcpy(&ret, data, sizeof(T));
+    return ret;
+}
+
+QByteArray header()
+{
+    QByteArray ret(Magic, sizeof(Magic));
+    put(ret, Version);
+    return ret;
+}
+
+// What the guest uses, -1 unless its balloon driver reports it
+double guestUsedKiB(const Connection::StatsRecord &dom)
+{
+    auto available = dom.values.constFind("balloon.available");
+    if (available == dom.values.cend()) {
+        return -1;
+    }
+    auto usable = dom.values.constFind("balloon.usable");
+    if (usable != dom.values.cend()) {
+        return *available - *usable;
+    }
+    auto unused = dom.values.constFind("balloon.unused");
+    if (unused != dom.values.cend()) {
+        return *available - *unused;
+    }
+    return -1;
+}
+
+bool olderThan(const MetricsStore::Point &point, quint32 time)
+{
+    return point.time < time;
+}
+
+bool newerThan(quint32 time, const MetricsStore::Point &point)
+{
+    return time < point.time;
+}
+
+} // namespace
+
+MetricsStore *MetricsStore::instance()
+{
+    static MetricsStore store;
+    return &store;
+}
+
+bool MetricsStore::open(const QString &path)
+{
+    QWriteLocker locker(&m_lock);
+    if (!m_file.fileName().isEmpty()) {
+        return m_file.isOpen();
+    }
+
+    QObject::connect(
+        Sampler::instance(),
+        &Sampler::sampled,
+        Sampler::instance(),
+        [this](const QSharedPointer<const Sampler::Snapshot> &snapshot) { add(*snapshot); },
+        Qt::DirectConnection);
+
+    // Workers sharing the file would interleave their appends and
+    // compact it under each other
+    m_writeLock = std::make_unique<QLockFile>(path + QLatin1String(".lock"));
+    m_writeLock->setStaleLockTime(0);
+    const bool writer = m_writeLock->tryLock();
+
+    m_file.setFileName(path);
+    if (!m_file.open(writer ? QIODevice::ReadWrite : QIODevice::ReadOnly)) {
+        // History still builds up, it's just lost on restart
+        qCWarning(V_METRICSSTORE) << "Failed to open" << path << m_file.errorString();
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    if (!replay()) {
+        qCWarning(V_METRICSSTORE) << "Not a metrics store, starting over" << path;
+        m_series.clear();
+        m_ids.clear();
+        m_livePoints = 0;
+        if (writer) {
+            m_file.resize(0);
+        }
+    }
+    if (writer) {
+        compact();
+    } else {
+        m_file.close();
+    }
+    qCDebug(V_METRICSSTORE) << "Loaded" << m_series.size() << "series with" << m_livePoints
+                            << "points in" << timer.elapsed() << "ms" << "writer" << writer;
+
+    return m_file.isOpen();
+}
+
+QVector<MetricsStore::Point>
+    MetricsStore::range(const QByteArray &series, qint64 from, qint64 to) const
+{
+    QReadLocker locker(&m_lock);
+    auto it = m_ids.constFind(series);
+    if (it == m_ids.constEnd() || from > to) {
+        return {};
+    }
+
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    int resolution   = Raw;
+    while (resolution < Hour && now - from > Tiers[resolution].retention) {
+        ++resolution;
+    }
+
+    const QVector<Point> &points = m_series[it.value()].points[resolution];
+    const quint32 first          = quint32(qMax<qint64>(from, 0));
+    const quint32 last           = quint32(qMin<qint64>(to, std::numeric_limits<quint32>::max()));
+    auto begin = std::lower_bound(points.cbegin(), points.cend(), first, olderThan);
+    auto end   = std::upper_bound(begin, points.cend(), last, newerThan);
+    return QVector<Point>(begin, end);
+}
+
+QVector<qsizetype> MetricsStore::downsample(const QVector<QVector<Point>> &series,
+                                            int threshold)
+{
+    const qsizetype size = series.isEmpty() ? 0 : series.constFirst().size();
+    QVector<qsizetype> ret;
+    if (threshold < 3 || size <= threshold) {
+        ret.resize(size);
+        std::iota(ret.begin(), ret.end(), 0);
+        return ret;
+    }
+
+    // Times relative to the first point and the values of every series
+    // side by side, so the inner loops walk one buffer
+    const qsizetype width = series.size() + 1;
+    std::vector<double> buf(size_t(size * width));
+    const quint32 origin = series.constFirst().constFirst().time;
+    for (qsizetype i = 0; i < size; ++i) {
+        double *row = buf.data() + i * width;
+        row[0]      = double(series.constFirst()[i].time - origin);
+        for (qsizetype j = 1; j < width; ++j) {
+            row[j] = series[j - 1][i].value;
+        }
+    }
+
+    ret.reserve(threshold);
+    ret.append(0);
+
+    // First and last points are kept, the others are split in buckets
+    const double every = double(size - 2) / (threshold - 2);
+    std::vector<double> average(size_t(width));
+    qsizetype selected = 0;
+    for (int bucket = 0; bucket < threshold - 2; ++bucket) {
+        // Average of the next bucket, the third corner of the triangles
+        const qsizetype nextBegin = qsizetype((bucket + 1) * every) + 1;
+        const qsizetype nextEnd   = qMin(qsizetype((bucket + 2) * every) + 1, size);
+        std::fill(average.begin(), average.end(), 0.0);
+        for (qsizetype i = nextBegin; i < nextEnd; ++i) {
+            const double *row = buf.data() + i * width;
+            for (qsizetype j = 0; j < width; ++j) {
+                average[size_t(j)] += row[j];
+            }
+        }
+        for (double &value : average) {
+            value /= double(nextEnd - nextBegin);
+        }
+
+        const double *a       = buf.data() + selected * width;
+        const qsizetype begin = qsizetype(bucket * every) + 1;
+        const qsizetype end   = qsizetype((bucket + 1) * every) + 1;
+        double maxArea        = -1;
+        for (qsizetype i = begin; i < end; ++i) {
+            const double *row = buf.data() + i * width;
+            double area       = 0;
+            for (qsizetype j = 1; j < width; ++j) {
+                area += std::abs((a[0] - average[0]) * (row[j] - a[j]) -
+                                 (a[0] - row[0]) * (average[size_t(j)] - a[j]));
+            }
+            if (area > maxArea) {
+                maxArea  = area;
+                selected = i;
+            }
+        }
+        ret.append(selected);
+    }
+
+    ret.append(size - 1);
+    return ret;
+}
+
+QByteArray MetricsStore::hostSeries(const QString &hostId, const char *metric)
+{
+    return hostId.toUtf8() + '/' + metric;
+}
+
+QByteArray
+    MetricsStore::domainSeries(const QString &hostId, const QString &uuid, const QByteArray &metric)
+{
+    return hostId.toUtf8() + '/' + uuid.toLatin1() + '/' + metric;
+}
+
+void MetricsStore::add(const Sampler::Snapshot &snapshot)
+{
+    QWriteLocker locker(&m_lock);
+
+    qint64 newest = 0;
+    for (const Sampler::Host &host : snapshot) {
+        if (!host.up) {
+            continue;
+        }
+        const qint64 time  = host.timestamp;
+        const quint32 secs = quint32(time / 1000);
+        newest             = qMax(newest, time);
+
+        // Memory of the running guests, in MiB
+        Guests guests;
+
+        const QHash<QByteArray, double> &node = host.node;
+        auto utilization                      = node.constFind("cpu.utilization");
+        if (utilization != node.cend()) {
+            append(seriesId(hostSeries(host.id, "cpu"), true), secs, *utilization, true);
+        } else {
+            const double busy         = node.value("cpu.user") + node.value("cpu.kernel");
+            const double total        = busy + node.value("cpu.idle") + node.value("cpu.iowait");
+            const QByteArray busyKey  = hostSeries(host.id, "cpu.busy");
+            const QByteArray totalKey = hostSeries(host.id, "cpu.total");
+            const Counter lastBusy    = m_counters.value(busyKey, {0, -1});
+            const Counter lastTotal   = m_counters.value(totalKey, {0, -1});
+            m_counters.insert(busyKey, {time, busy});
+            m_counters.insert(totalKey, {time, total});
+            if (lastTotal.value >= 0 && total > lastTotal.value && busy >= lastBusy.value) {
+                const double usage = (busy - lastBusy.value) / (total - lastTotal.value) * 100;
+                append(seriesId(hostSeries(host.id, "cpu"), true), secs, usage, true);
+            }
+        }
+
+        auto total = node.constFind("memory.total");
+        if (total != node.cend()) {
+            const double used = *total - node.value("memory.free");
+            append(seriesId(hostSeries(host.id, "mem"), true), secs, used / 1024, true);
+        }
+
+        for (const Connection::StatsRecord &dom : host.domains) {
+            auto cpu = dom.values.constFind("cpu.time");
+            if (cpu != dom.values.cend()) {
+                // ns of CPU per ms of wall time, spread over the vCPUs
+                const double vcpus = qMax(1.0, dom.values.value("vcpu.current"));
+                addCounter(domainSeries(host.id, dom.uuid, "cpu"), time, *cpu, 1e-4 / vcpus);
+            }
+
+            const int nets = int(dom.values.value("net.count"));
+            for (int i = 0; i < nets; ++i) {
+                const QByteArray prefix = "net." + QByteArray::number(i);
+                addCounter(domainSeries(host.id, dom.uuid, prefix + ".rx"),
+                           time,
+                           dom.values.value(prefix + ".rx.bytes"),
+                           1000.0 / (1024 * 1024));
+                addCounter(domainSeries(host.id, dom.uuid, prefix + ".tx"),
+                           time,
+                           dom.values.value(prefix + ".tx.bytes"),
+                           1000.0 / (1024 * 1024));
+            }
+
+            const int blocks = int(dom.values.value("block.count"));
+            for (int i = 0; i < blocks; ++i) {
+                const QByteArray prefix = "block." + QByteArray::number(i);
+                const QByteArray name   = "block." + dom.strings.value(prefix + ".name").toUtf8();
+                addCounter(domainSeries(host.id, dom.uuid, name + ".rd"),
+                           time,
+                           dom.values.value(prefix + ".rd.bytes"),
+                           1000.0 / (1024 * 1024));
+                addCounter(domainSeries(host.id, dom.uuid, name + ".wr"),
+                           time,
+                           dom.values.value(prefix + ".wr.bytes"),
+                           1000.0 / (1024 * 1024));
+            }
+
+            addBalloon(host.id, dom, time, guests);
+            addVcpus(host.id, dom, time);
+            addPerf(host.id, dom, time);
+        }
+
+        if (guests.actual > 0) {
+            append(seriesId(hostSeries(host.id, "guests.actual"), true), secs, guests.actual, true);
+            append(seriesId(hostSeries(host.id, "guests.used"), true), secs, guests.used, true);
+            append(seriesId(hostSeries(host.id, "guests.rss"), true), secs, guests.rss, true);
+        }
+    }
+
+    m_counters.removeIf([newest](const auto &it) {
+        return it.value().time < newest - CounterExpiry;
+    });
+
+    if (!m_file.isOpen() && m_writeLock && m_writeLock->tryLock()) {
+        // The writer is gone, this worker's history replaces its log
+        if (m_file.open(QIODevice::ReadWrite)) {
+            m_log.clear();
+            compact(true);
+        }
+    }
+
+    if (m_log.isEmpty() || !m_file.isOpen()) {
+        m_log.clear();
+        return;
+    }
+    if (m_file.write(m_log) != m_log.size() || !m_file.flush()) {
+        qCWarning(V_METRICSSTORE) << "Failed to append to" << m_file.fileName()
+                                  << m_file.errorString();
+    }
+    m_log.clear();
+
+    // Most of the log is expired points, rewrite it with the live ones
+    const qint64 live = m_livePoints * PointSize + m_series.size() * 64;
+    if (m_file.size() > CompactThreshold + 2 * live) {
+        compact();
+    }
+}
+
+void MetricsStore::addBalloon(const QString &hostId,
+                              const Connection::StatsRecord &dom,
+                              qint64 time,
+                              Guests &guests)
+{
+    auto current       = dom.values.constFind("balloon.current");
+    const bool running = int(dom.values.value("state.state")) == VIR_DOMAIN_RUNNING;
+    if (current == dom.values.cend() || !running) {
+        return;
+    }
+
+    const quint32 secs  = quint32(time / 1000);
+    const double actual = *current / 1024;
+    const double used   = guestUsedKiB(dom);
+    const double rss    = dom.values.value("balloon.rss");
+    append(seriesId(domainSeries(hostId, dom.uuid, "mem.actual"), true), secs, actual, true);
+    if (used >= 0) {
+        append(seriesId(domainSeries(hostId, dom.uuid, "mem.used"), true), secs, used / 1024, true);
+    }
+    if (rss > 0) {
+        append(seriesId(domainSeries(hostId, dom.uuid, "mem.rss"), true), secs, rss / 1024, true);
+    }
+
+    // Swap is counted in KiB, to MiB/s, and faults to faults/s
+    auto swapIn = dom.values.constFind("balloon.swap_in");
+    if (swapIn != dom.values.cend()) {
+        addCounter(domainSeries(hostId, dom.uuid, "mem.swap_in"), time, *swapIn, 1000.0 / 1024);
+        addCounter(domainSeries(hostId, dom.uuid, "mem.swap_out"),
+                   time,
+                   dom.values.value("balloon.swap_out"),
+                   1000.0 / 1024);
+    }
+    auto faults = dom.values.constFind("balloon.major_fault");
+    if (faults != dom.values.cend()) {
+        addCounter(domainSeries(hostId, dom.uuid, "mem.major_faults"), time, *faults, 1000);
+    }
+
+    // Guests that don't report their usage could be using all they have
+    guests.actual += actual;
+    guests.used += used >= 0 ? used / 1024 : actual;
+    guests.rss += rss / 1024;
+}
+
+void MetricsStore::addVcpus(const QString &hostId, const Connection::StatsRecord &dom, qint64 time)
+{
+    // Offline vCPUs up to the maximum are reported too, without times
+    const int vcpus = int(dom.values.value("vcpu.maximum"));
+    int halted      = 0;
+    for (int i = 0; i < vcpus; ++i) {
+        const QByteArray prefix = "vcpu." + QByteArray::number(i);
+        auto cpuTime            = dom.values.constFind(prefix + ".time");
+        if (cpuTime == dom.values.cend()) {
+            continue;
+        }
+
+        // ns per ms, to % of a host CPU
+        addCounter(domainSeries(hostId, dom.uuid, prefix + ".time"), time, *cpuTime, 1e-4);
+        auto wait = dom.values.constFind(prefix + ".wait");
+        if (wait != dom.values.cend()) {
+            addCounter(domainSeries(hostId, dom.uuid, prefix + ".wait"), time, *wait, 1e-4);
+        }
+        // Time spent runnable on the host run queue, the steal time of the guest
+        auto delay = dom.values.constFind(prefix + ".delay");
+        if (delay != dom.values.cend()) {
+            addCounter(domainSeries(hostId, dom.uuid, prefix + ".delay"), time, *delay, 1e-4);
+        }
+        if (dom.values.value(prefix + ".halted") > 0) {
+            ++halted;
+        }
+    }
+
+    if (dom.values.contains("vcpu.current")) {
+        append(seriesId(domainSeries(hostId, dom.uuid, "vcpu.halted"), true),
+               quint32(time / 1000),
+               halted,
+               true);
+    }
+}
+
+void MetricsStore::addPerf(const QString &hostId, const Connection::StatsRecord &dom, qint64 time)
+{
+    // Only the events enabled on the domain are reported
+    const quint32 secs = quint32(time / 1000);
+    auto cmt           = dom.values.constFind("perf.cmt");
+    if (cmt != dom.values.cend()) {
+        append(seriesId(domainSeries(hostId, dom.uuid, "perf.cmt"), true),
+               secs,
+               *cmt / (1024 * 1024),
+               true);
+    }
+    // Already bytes/s
+    for (const char *metric : {"perf.mbmt", "perf.mbml"}) {
+        auto bandwidth = dom.values.constFind(metric);
+        if (bandwidth != dom.values.cend()) {
+            append(seriesId(domainSeries(hostId, dom.uuid, metric), true),
+                   secs,
+                   *bandwidth / (1024 * 1024),
+                   true);
+        }
+    }
+
+    auto cacheMisses = dom.values.constFind("perf.cache_misses");
+    if (cacheMisses != dom.values.cend()) {
+        addCounter(domainSeries(hostId, dom.uuid, "perf.cache_misses"), time, *cacheMisses, 1e-3);
+    }
+
+    const QByteArray cyclesKey       = domainSeries(hostId, dom.uuid, "perf.cycles");
+    const QByteArray instructionsKey = domainSeries(hostId, dom.uuid, "perf.instructions");
+    const Counter lastCycles         = m_counters.value(cyclesKey, {0, -1});
+    const Counter lastInstructions   = m_counters.value(instructionsKey, {0, -1});
+    auto cycles                      = dom.values.constFind("perf.cycles");
+    auto instructions                = dom.values.constFind("perf.instructions");
+    if (cycles != dom.values.cend()) {
+        addCounter(cyclesKey, time, *cycles, 1e-3);
+    }
+    if (instructions != dom.values.cend()) {
+        addCounter(instructionsKey, time, *instructions, 1e-3);
+    }
+
+    // Instructions per cycle drop first when a neighbour thrashes the cache
+    if (cycles != dom.values.cend() && instructions != dom.values.cend() &&
+        lastCycles.value >= 0 && lastInstructions.value >= 0 && *cycles > lastCycles.value &&
+        *instructions >= lastInstructions.value) {
+        const double ipc = (*instructions - lastInstructions.value) / (*cycles - lastCycles.value);
+        append(seriesId(domainSeries(hostId, dom.uuid, "perf.ipc"), true), secs, ipc, true);
+    }
+}
+
+void MetricsStore::addCounter(const QByteArray &series, qint64 time, double value, double scale)
+{
+    auto it = m_counters.find(series);
+    if (it == m_counters.end()) {
+        m_counters.insert(series, {time, value});
+        return;
+    }
+
+    const Counter last = it.value();
+    it.value()         = {time, value};
+    // A restarted domain or a hot unplugged device starts over
+    if (time <= last.time || value < last.value) {
+        return;
+    }
+
+    const double rate = (value - last.value) / (time - last.time) * scale;
+    append(seriesId(series, true), quint32(time / 1000), float(rate), true);
+}
+
+quint32 MetricsStore::seriesId(const QByteArray &key, bool log)
+{
+    auto it = m_ids.constFind(key);
+    if (it != m_ids.constEnd()) {
+        return it.value();
+    }
+
+    const quint32 id = quint32(m_series.size());
+    m_series.append(Series{key, {}, {}});
+    m_ids.insert(key, id);
+
+    if (log) {
+        m_log.append(SeriesTag);
+        put(m_log, id);
+        put(m_log, quint16(key.size()));
+        m_log.append(key);
+    }
+    return id;
+}
+
+void MetricsStore::append(quint32 id, quint32 time, float value, bool log)
+{
+    Series &series = m_series[id];
+    if (!insert(series, Raw, {time, value})) {
+        return;
+    }
+    if (log) {
+        logPoint(Raw, id, {time, value});
+    }
+
+    for (int resolution = Minute; resolution < ResolutionCount; ++resolution) {
+        const quint32 start = time - time % Tiers[resolution].step;
+        Bucket &bucket      = series.buckets[resolution];
+        if (bucket.count && bucket.start != start) {
+            const Point point{bucket.start, float(bucket.sum / bucket.count)};
+            // While replaying the rollup may already be in the log
+            if (insert(series, resolution, point) && log) {
+                logPoint(resolution, id, point);
+            }
+            bucket = {};
+        }
+        bucket.start = start;
+        bucket.sum += value;
+        ++bucket.count;
+    }
+}
+
+bool MetricsStore::insert(Series &series, int resolution, Point point)
+{
+    QVector<Point> &points = series.points[resolution];
+    if (!points.isEmpty() && points.constLast().time >= point.time) {
+        return false;
+    }
+    points.append(point);
+    ++m_livePoints;
+
+    const quint32 retention = Tiers[resolution].retention;
+    const quint32 cutoff    = point.time > retention ? point.time - retention : 0;
+    if (points.constFirst().time < cutoff) {
+        auto end = std::lower_bound(points.begin(), points.end(), cutoff, olderThan);
+        m_livePoints -= end - points.begin();
+        points.erase(points.begin(), end);
+    }
+    return true;
+}
+
+void MetricsStore::logPoint(int resolution, quint32 id, Point point)
+{
+    put(m_log, quint8(resolution));
+    put(m_log, id);
+    put(m_log, point.time);
+    put(m_log, point.value);
+}
+
+bool MetricsStore::replay()
+{
+    const qint64 size = m_file.size();
+    if (size == 0) {
+        return true;
+    }
+    if (size < HeaderSize) {
+        return false;
+    }
+
+    const uchar *data = m_file.map(0, size);
+    QByteArray read;
+    if (!data) {
+        read = m_file.readAll();
+        data = reinterpret_cast<const uchar *>(read.constData());
+    }
+    if (memcmp(data, Magic, sizeof(Magic)) != 0 || get<quint32>(data + 4) != Version) {
+        return false;
+    }
+
+    // Ids of the log, they differ from ours if series were dropped
+    QHash<quint32, quint32> ids;
+    qint64 pos = HeaderSize;
+    while (pos < size) {
+        const uchar tag = data[pos];
+        if (tag == SeriesTag) {
+            if (pos + 7 > size) {
+                break;
+            }
+            const quint32 fileId = get<quint32>(data + pos + 1);
+            const quint16 length = get<quint16>(data + pos + 5);
+            if (pos + 7 + length > size) {
+                break;
+            }
+            const auto key = QByteArray(reinterpret_cast<const char *>(data + pos + 7), length);
+            ids.insert(fileId, seriesId(key, false));
+            pos += 7 + length;
+        } else if (tag < ResolutionCount) {
+            if (pos + PointSize > size) {
+                break;
+            }
+            auto it = ids.constFind(get<quint32>(data + pos + 1));
+            if (it == ids.constEnd()) {
+                break;
+            }
+            const Point point{get<quint32>(data + pos + 5), get<float>(data + pos + 9)};
+            if (tag == Raw) {
+                // Rebuilds the open rollups as well
+                append(it.value(), point.time, point.value, false);
+            } else {
+                insert(m_series[it.value()], tag, point);
+            }
+            pos += PointSize;
+        } else {
+            break;
+        }
+    }
+
+    if (!read.isNull()) {
+        read.clear();
+    } else {
+        m_file.unmap(const_cast<uchar *>(data));
+    }
+
+    if (pos < size) {
+        // Torn write of a crash, the rest is garbage
+        qCWarning(V_METRICSSTORE) << "Truncating" << m_file.fileName() << "at" << pos;
+        m_file.resize(pos);
+    }
+    return true;
+}
+
+void MetricsStore::compact(bool rewrite)
+{
+    const quint32 now = quint32(QDateTime::currentSecsSinceEpoch());
+
+    QByteArray out = header();
+    QVector<Series> kept;
+    kept.reserve(m_series.size());
+    m_livePoints = 0;
+    for (Series &series : m_series) {
+        int count = 0;
+        for (int resolution = 0; resolution < ResolutionCount; ++resolution) {
+            QVector<Point> &points  = series.points[resolution];
+            const quint32 retention = Tiers[resolution].retention;
+            const quint32 cutoff    = now > retention ? now - retention : 0;
+            points.erase(points.begin(),
+                         std::lower_bound(points.begin(), points.end(), cutoff, olderThan));
+            count += points.size();
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        const quint32 id = quint32(kept.size());
+        out.append(SeriesTag);
+        put(out, id);
+        put(out, quint16(series.key.size()));
+        out.append(series.key);
+        // Rollups first, replaying the raw points then only reopens the buckets
+        for (int resolution = Hour; resolution >= Raw; --resolution) {
+            for (const Point &point : std::as_const(series.points[resolution])) {
+                put(out, quint8(resolution));
+                put(out, id);
+                put(out, point.time);
+                put(out, point.value);
+            }
+        }
+
+        m_livePoints += count;
+        kept.append(std::move(series));
+    }
+
+    m_series = std::move(kept);
+    m_ids.clear();
+    for (int i = 0; i < m_series.size(); ++i) {
+        m_ids.insert(m_series[i].key, quint32(i));
+    }
+
+    if (!m_file.isOpen() || (!rewrite && m_file.size() == out.size())) {
+        m_file.seek(m_file.size());
+        return;
+    }
+
+    const QString path = m_file.fileName();
+    QSaveFile save(path);
+    if (!save.open(QIODevice::WriteOnly) || save.write(out) != out.size() || !save.commit()) {
+        qCWarning(V_METRICSSTORE) << "Failed to compact" << path << save.errorString();
+        m_file.seek(m_file.size());
+        return;
+    }
+
+    m_file.close();
+    if (!m_file.open(QIODevice::ReadWrite)) {
+        qCWarning(V_METRICSSTORE) << "Failed to reopen" << path << m_file.errorString();
+        return;
+    }
+    m_file.seek(m_file.size());
+    qCDebug(V_METRICSSTORE) << "Compacted" << path << "to" << out.size() << "bytes";
+}
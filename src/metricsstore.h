@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef METRICSSTORE_H
+#define METRICSSTORE_H
+
+#include "sampler.h"
+
+#include <QFile>
+#include <QHash>
+#include <QLockFile>
+#include <QReadWriteLock>
+#include <QVector>
+
+#include <memory>
+
+// Chart history of hosts and domains. Every sampler round is kept raw
+// for an hour and rolled up into 1 min, 15 min and 1 h averages that
+// live for days, all of it in memory and in an append-only log that is
+// replayed on start and compacted once it holds mostly expired points.
+// Every worker process keeps its own history, only the one holding the
+// lock next to the log writes it.
+class MetricsStore
+{
+public:
+    struct Point {
+        // Seconds since the epoch
+        quint32 time;
+        float value;
+    };
+
+    enum Resolution {
+        Raw,
+        Minute,
+        Quarter,
+        Hour,
+        ResolutionCount,
+    };
+
+    static MetricsStore *instance();
+
+    // Replays path and starts recording the sampler rounds, only the
+    // first call of a worker process does anything. Must be called after
+    // the fork, returns true if this process writes the log.
+    bool open(const QString &path);
+
+    // Points of series in [from, to], seconds since the epoch, from the
+    // finest resolution whose retention still reaches from
+    QVector<Point> range(const QByteArray &series, qint64 from, qint64 to) const;
+
+    // Indices of at most threshold points that keep the shape of series,
+    // picked by Largest-Triangle-Three-Buckets. The series share their
+    // times and their triangles add up, so a peak of any of them stays.
+    static QVector<qsizetype> downsample(const QVector<QVector<Point>> &series, int threshold);
+
+    // e.g. "1/cpu" in %, "1/mem" or "1/guests.rss" in MiB
+    static QByteArray hostSeries(const QString &hostId, const char *metric);
+    // e.g. "1/<uuid>/cpu", "1/<uuid>/net.0.rx", "1/<uuid>/block.vda.wr" or
+    // "1/<uuid>/mem.rss", sizes in MiB and rates in MiB/s, "1/<uuid>/vcpu.0.wait"
+    // in % of a host CPU, "1/<uuid>/perf.cycles" in millions per second
+    static QByteArray
+        domainSeries(const QString &hostId, const QString &uuid, const QByteArray &metric);
+
+private:
+    struct Bucket {
+        quint32 start = 0;
+        double sum    = 0;
+        int count     = 0;
+    };
+
+    struct Series {
+        QByteArray key;
+        QVector<Point> points[ResolutionCount];
+        // Open rollup of every resolution but Raw
+        Bucket buckets[ResolutionCount];
+    };
+
+    struct Guests {
+        double actual = 0;
+        double used   = 0;
+        double rss    = 0;
+    };
+
+    // Last value of a counter, to derive rates
+    struct Counter {
+        qint64 time;
+        double value;
+    };
+
+    MetricsStore() = default;
+
+    void add(const Sampler::Snapshot &snapshot);
+    void addBalloon(const QString &hostId,
+                    const Connection::StatsRecord &dom,
+                    qint64 time,
+                    Guests &guests);
+    void addVcpus(const QString &hostId, const Connection::StatsRecord &dom, qint64 time);
+    void addPerf(const QString &hostId, const Connection::StatsRecord &dom, qint64 time);
+    void addCounter(const QByteArray &series, qint64 time, double value, double scale);
+
+    quint32 seriesId(const QByteArray &key, bool log);
+    void append(quint32 id, quint32 time, float value, bool log);
+    // Returns false if point is not newer than the last one of resolution
+    bool insert(Series &series, int resolution, Point point);
+    void logPoint(int resolution, quint32 id, Point point);
+
+    bool replay();
+    // Rewrites the log with the live points, unless rewrite is false
+    // and it already holds nothing else
+    void compact(bool rewrite = false);
+
+    mutable QReadWriteLock m_lock;
+    QVector<Series> m_series;
+    QHash<QByteArray, quint32> m_ids;
+    QHash<QByteArray, Counter> m_counters;
+
+    QFile m_file;
+    std::unique_ptr<QLockFile> m_writeLock;
+    QByteArray m_log;
+    qint64 m_livePoints = 0;
+};
+
+#endif // METRICSSTORE_H
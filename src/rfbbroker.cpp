@@ -0,0 +1,863 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "rfbbroker.h"
+
+#include <QHash>
+#include <QLoggingCategory>
+#include <QtEndian>
+
+Q_LOGGING_CATEGORY(V_RFB, "virtlyst.rfb")
+
+namespace {
+
+// Shared consoles of all worker threads
+QMutex brokersMutex;
+QHash<QString, RfbBroker *> brokers;
+
+constexpr qint32 EncodingRaw            = 0;
+constexpr qint32 EncodingCopyRect       = 1;
+constexpr qint32 EncodingRre            = 2;
+constexpr qint32 EncodingHextile        = 5;
+constexpr qint32 EncodingZlib           = 6;
+constexpr qint32 EncodingTight          = 7;
+constexpr qint32 EncodingZrle           = 16;
+constexpr qint32 EncodingQualityLevel0  = -32;
+constexpr qint32 EncodingQualityLevel9  = -23;
+constexpr qint32 EncodingLastRect       = -224;
+constexpr qint32 EncodingDesktopSize    = -223;
+constexpr qint32 EncodingCursor         = -239;
+constexpr qint32 EncodingCompressLevel0 = -256;
+constexpr qint32 EncodingCompressLevel9 = -247;
+constexpr qint32 EncodingQemuKeyEvent   = -258;
+constexpr qint32 EncodingTightPng       = -260;
+
+constexpr quint8 HextileRaw              = 1;
+constexpr quint8 HextileBackground       = 2;
+constexpr quint8 HextileForeground       = 4;
+constexpr quint8 HextileAnySubrects      = 8;
+constexpr quint8 HextileSubrectsColoured = 16;
+
+constexpr quint8 TightFill           = 0x8;
+constexpr quint8 TightJpeg           = 0x9;
+constexpr quint8 TightPng            = 0xA;
+constexpr quint8 TightExplicitFilter = 0x40;
+constexpr quint8 TightFilterCopy     = 0;
+constexpr quint8 TightFilterPalette  = 1;
+constexpr quint8 TightFilterGradient = 2;
+
+// Appends the missing bytes of an n sized header, true once complete
+bool fill(QByteArray &buf, qsizetype n, const char *data, qsizetype size, qsizetype &pos)
+{
+    const qsizetype take = qMin(n - buf.size(), size - pos);
+    buf.append(data + pos, take);
+    pos += take;
+    return buf.size() == n;
+}
+
+quint16 u16(const QByteArray &buf, int offset)
+{
+    return qFromBigEndian<quint16>(buf.constData() + offset);
+}
+
+quint32 u32(const QByteArray &buf, int offset)
+{
+    return qFromBigEndian<quint32>(buf.constData() + offset);
+}
+
+} // namespace
+
+RfbBroker *RfbBroker::create(const QString &key, QObject *parent)
+{
+    QMutexLocker locker(&brokersMutex);
+    if (brokers.contains(key)) {
+        return nullptr;
+    }
+
+    auto broker = new RfbBroker(key, parent);
+    brokers.insert(key, broker);
+    return broker;
+}
+
+bool RfbBroker::join(const QString &key, const std::function<void(RfbBroker *)> &setup)
+{
+    QMutexLocker locker(&brokersMutex);
+    RfbBroker *broker = brokers.value(key);
+    if (!broker || !broker->m_ready) {
+        return false;
+    }
+
+    setup(broker);
+    return true;
+}
+
+RfbBroker::RfbBroker(const QString &key, QObject *parent)
+    : QObject(parent)
+    , m_key(key)
+{
+}
+
+RfbBroker::~RfbBroker()
+{
+    QMutexLocker locker(&brokersMutex);
+    if (brokers.value(m_key) == this) {
+        brokers.remove(m_key);
+    }
+}
+
+QByteArray RfbBroker::fromClient(const QByteArray &data)
+{
+    if (m_cstate == ClientState::Broken) {
+        return data;
+    }
+
+    QByteArray out;
+    out.reserve(data.size());
+
+    const char *d        = data.constData();
+    const qsizetype size = data.size();
+    qsizetype pos        = 0;
+    while (pos < size) {
+        if (m_cstate == ClientState::Broken) {
+            out.append(d + pos, size - pos);
+            break;
+        }
+
+        if (m_cskip > 0) {
+            const qint64 n = qMin<qint64>(m_cskip, size - pos);
+            out.append(d + pos, n);
+            pos += n;
+            m_cskip -= n;
+            continue;
+        }
+
+        if (!m_pending.isEmpty() && clientAtBoundary()) {
+            out.append(m_pending);
+            m_pending.clear();
+        }
+
+        const qsizetype begin = pos;
+        bool hold             = false;
+        switch (m_cstate) {
+        case ClientState::Version:
+            if (fill(m_cbuf, 12, d, size, pos)) {
+                m_minor = qMin(m_serverMinor, m_cbuf.mid(8, 3).toInt());
+                m_cbuf.clear();
+                m_cstate = ClientState::Choice;
+            }
+            break;
+        case ClientState::Choice:
+            if (fill(m_cbuf, 1, d, size, pos)) {
+                m_choice = quint8(m_cbuf.at(0));
+                m_cbuf.clear();
+                if (m_choice == 1) {
+                    m_cstate = ClientState::ClientInit;
+                } else if (m_choice == 2) {
+                    m_cstate = ClientState::Response;
+                } else {
+                    stop(QStringLiteral("Unsupported security type %1").arg(m_choice));
+                }
+            }
+            break;
+        case ClientState::Response:
+            if (fill(m_cbuf, 16, d, size, pos)) {
+                m_cbuf.clear();
+                m_cstate = ClientState::ClientInit;
+            }
+            break;
+        case ClientState::ClientInit:
+            if (fill(m_cbuf, 1, d, size, pos)) {
+                m_cbuf.clear();
+                m_cstate = ClientState::MessageType;
+            }
+            break;
+        case ClientState::MessageType:
+            if (!fill(m_cbuf, 1, d, size, pos)) {
+                break;
+            }
+
+            // The type byte stays in m_cbuf, m_cneed is the whole message
+            switch (quint8(m_cbuf.at(0))) {
+            case 0:
+                m_cneed  = 20;
+                m_cstate = ClientState::PixelFormat;
+                break;
+            case 2:
+                hold     = true;
+                m_cneed  = 4;
+                m_cstate = ClientState::EncodingsHeader;
+                break;
+            case 3:
+                m_cneed  = 10;
+                m_cstate = ClientState::Fixed;
+                break;
+            case 4:
+                m_cneed  = 8;
+                m_cstate = ClientState::Fixed;
+                break;
+            case 5:
+                m_cneed  = 6;
+                m_cstate = ClientState::Fixed;
+                break;
+            case 6:
+                m_cneed  = 8;
+                m_cstate = ClientState::CutTextHeader;
+                break;
+            case 255:
+                m_cneed  = 2;
+                m_cstate = ClientState::QemuSubtype;
+                break;
+            default:
+                stop(QStringLiteral("Unknown client message %1").arg(quint8(m_cbuf.at(0))));
+                m_cbuf.clear();
+            }
+            break;
+        case ClientState::PixelFormat:
+            if (fill(m_cbuf, m_cneed, d, size, pos)) {
+                if (setPixelFormat(m_cbuf.mid(4, 16))) {
+                    updateServerInit();
+                    m_cstate = ClientState::MessageType;
+                }
+                m_cbuf.clear();
+            }
+            break;
+        case ClientState::EncodingsHeader:
+            hold = true;
+            if (fill(m_cbuf, m_cneed, d, size, pos)) {
+                const quint16 count = u16(m_cbuf, 2);
+                if (count > 1024) {
+                    stop(QStringLiteral("Too many encodings"));
+                    out.append(m_cbuf);
+                    m_cbuf.clear();
+                    break;
+                }
+                m_cneed  = 4 + 4 * count;
+                m_cstate = ClientState::Encodings;
+            }
+            if (m_cstate != ClientState::Encodings || m_cbuf.size() < m_cneed) {
+                break;
+            }
+            Q_FALLTHROUGH();
+        case ClientState::Encodings:
+            hold = true;
+            if (fill(m_cbuf, m_cneed, d, size, pos)) {
+                m_encodings              = m_cbuf;
+                const QByteArray message = filterEncodings(m_cbuf, m_viewers > 0);
+                m_restricted             = message == filterEncodings(m_cbuf, true);
+                if (!m_restricted) {
+                    m_viewerSafe = false;
+                }
+                out.append(message);
+                m_cbuf.clear();
+                m_cstate = ClientState::MessageType;
+            }
+            break;
+        case ClientState::Fixed:
+            if (fill(m_cbuf, m_cneed, d, size, pos)) {
+                m_cbuf.clear();
+                m_cstate = ClientState::MessageType;
+            }
+            break;
+        case ClientState::CutTextHeader:
+            if (fill(m_cbuf, m_cneed, d, size, pos)) {
+                m_cskip = u32(m_cbuf, 4);
+                m_cbuf.clear();
+                m_cstate = ClientState::MessageType;
+            }
+            break;
+        case ClientState::QemuSubtype:
+            if (fill(m_cbuf, m_cneed, d, size, pos)) {
+                if (quint8(m_cbuf.at(1)) == 0) {
+                    // Extended key event
+                    m_cneed  = 12;
+                    m_cstate = ClientState::Fixed;
+                } else {
+                    stop(QStringLiteral("Unknown QEMU client message"));
+                    m_cbuf.clear();
+                }
+            }
+            break;
+        case ClientState::Broken:
+            break;
+        }
+
+        if (!hold) {
+            out.append(d + begin, pos - begin);
+        }
+    }
+
+    if (!m_pending.isEmpty() && clientAtBoundary()) {
+        out.append(m_pending);
+        m_pending.clear();
+    }
+
+    return out;
+}
+
+void RfbBroker::fromServer(const QByteArray &data)
+{
+    const char *d        = data.constData();
+    const qsizetype size = data.size();
+    qsizetype pos        = 0;
+    // Viewers only get what follows ServerInit
+    qsizetype start      = m_ready ? 0 : -1;
+    qsizetype boundary   = -1;
+
+    while (pos < size && m_sstate != ServerState::Broken) {
+        if (m_sskip > 0) {
+            const qint64 n = qMin<qint64>(m_sskip, size - pos);
+            pos += n;
+            m_sskip -= n;
+            continue;
+        }
+
+        if (boundary < 0 && start >= 0 && m_viewerSafe && m_sstate == ServerState::MessageType &&
+            m_sbuf.isEmpty()) {
+            boundary = pos;
+        }
+
+        switch (m_sstate) {
+        case ServerState::Version:
+            if (fill(m_sbuf, 12, d, size, pos)) {
+                m_serverMinor = m_sbuf.mid(8, 3).toInt();
+                if (!m_sbuf.startsWith("RFB 003.") || m_serverMinor < 7) {
+                    stop(QStringLiteral("Unsupported RFB version"));
+                    break;
+                }
+                m_sbuf.clear();
+                m_sstate = ServerState::SecurityCount;
+            }
+            break;
+        case ServerState::SecurityCount:
+            if (fill(m_sbuf, 1, d, size, pos)) {
+                m_sneed = quint8(m_sbuf.at(0));
+                m_sbuf.clear();
+                if (m_sneed == 0) {
+                    stop(QStringLiteral("Server refused the connection"));
+                    break;
+                }
+                m_sstate = ServerState::SecurityTypes;
+            }
+            break;
+        case ServerState::SecurityTypes:
+            if (fill(m_sbuf, m_sneed, d, size, pos)) {
+                m_sbuf.clear();
+                m_sstate = ServerState::SecurityNext;
+            }
+            break;
+        case ServerState::SecurityNext:
+            // The server waits for the client choice before saying anything else
+            if (m_choice == 2) {
+                m_sstate = ServerState::Challenge;
+            } else if (m_choice == 1) {
+                m_sstate = m_minor >= 8 ? ServerState::SecurityResult : ServerState::InitHeader;
+            } else {
+                stop(QStringLiteral("No security type chosen"));
+            }
+            break;
+        case ServerState::Challenge:
+            if (fill(m_sbuf, 16, d, size, pos)) {
+                m_sbuf.clear();
+                m_sstate = ServerState::SecurityResult;
+            }
+            break;
+        case ServerState::SecurityResult:
+            if (fill(m_sbuf, 4, d, size, pos)) {
+                if (u32(m_sbuf, 0) != 0) {
+                    stop(QStringLiteral("Authentication failed"));
+                    break;
+                }
+                m_sbuf.clear();
+                m_sstate = ServerState::InitHeader;
+            }
+            break;
+        case ServerState::InitHeader:
+            if (fill(m_sbuf, 24, d, size, pos)) {
+                m_width  = u16(m_sbuf, 0);
+                m_height = u16(m_sbuf, 2);
+                m_sneed  = u32(m_sbuf, 20);
+                if (!setPixelFormat(m_sbuf.mid(4, 16))) {
+                    break;
+                }
+                m_sbuf.clear();
+                if (m_sneed > 64 * 1024) {
+                    stop(QStringLiteral("Desktop name too long"));
+                    break;
+                }
+                m_sstate = ServerState::InitName;
+            }
+            break;
+        case ServerState::InitName:
+            if (fill(m_sbuf, m_sneed, d, size, pos)) {
+                m_name = m_sbuf;
+                m_sbuf.clear();
+                m_sstate = ServerState::MessageType;
+                updateServerInit();
+                m_ready = true;
+                start   = pos;
+                qCDebug(V_RFB) << "Console can be shared" << m_key << m_width << m_height;
+            }
+            break;
+        case ServerState::MessageType:
+            if (!fill(m_sbuf, 1, d, size, pos)) {
+                break;
+            }
+
+            switch (quint8(m_sbuf.at(0))) {
+            case 0:
+                m_sstate = ServerState::UpdateHeader;
+                break;
+            case 1:
+                m_sstate = ServerState::ColourMapHeader;
+                break;
+            case 2:
+                // Bell
+                break;
+            case 3:
+                m_sstate = ServerState::CutTextHeader;
+                break;
+            default:
+                stop(QStringLiteral("Unknown server message %1").arg(quint8(m_sbuf.at(0))));
+            }
+            m_sbuf.clear();
+            break;
+        case ServerState::UpdateHeader:
+            if (fill(m_sbuf, 3, d, size, pos)) {
+                m_rects = u16(m_sbuf, 1);
+                m_sbuf.clear();
+                m_updateSafe   = true;
+                m_updatePixels = false;
+                if (m_rects) {
+                    m_sstate = ServerState::RectHeader;
+                } else {
+                    updateDone();
+                }
+            }
+            break;
+        case ServerState::RectHeader:
+            if (fill(m_sbuf, 12, d, size, pos)) {
+                serverRect();
+            }
+            break;
+        case ServerState::HextileTile:
+            if (fill(m_sbuf, 1, d, size, pos)) {
+                m_subencoding = quint8(m_sbuf.at(0));
+                m_sbuf.clear();
+
+                if (m_subencoding & HextileRaw) {
+                    const int tw = qMin(16, m_rectW - m_tileX);
+                    const int th = qMin(16, m_rectH - m_tileY);
+                    nextTile();
+                    m_sskip = qint64(tw) * th * m_bpp;
+                    break;
+                }
+
+                const int colours = (m_subencoding & HextileBackground ? m_bpp : 0) +
+                                    (m_subencoding & HextileForeground ? m_bpp : 0);
+                if (m_subencoding & HextileAnySubrects) {
+                    m_sneed  = colours + 1;
+                    m_sstate = ServerState::HextileCount;
+                } else {
+                    nextTile();
+                    m_sskip = colours;
+                }
+            }
+            break;
+        case ServerState::HextileCount:
+            if (fill(m_sbuf, m_sneed, d, size, pos)) {
+                const int count = quint8(m_sbuf.back());
+                m_sbuf.clear();
+                nextTile();
+                m_sskip = qint64(count) * (m_subencoding & HextileSubrectsColoured ? m_bpp + 2 : 2);
+            }
+            break;
+        case ServerState::RreHeader:
+            if (fill(m_sbuf, m_sneed, d, size, pos)) {
+                m_sskip = qint64(u32(m_sbuf, 0)) * (m_bpp + 8);
+                m_sbuf.clear();
+                rectDone();
+            }
+            break;
+        case ServerState::DataLength:
+            if (fill(m_sbuf, 4, d, size, pos)) {
+                m_sskip = u32(m_sbuf, 0);
+                m_sbuf.clear();
+                rectDone();
+            }
+            break;
+        case ServerState::TightControl:
+            if (fill(m_sbuf, 1, d, size, pos)) {
+                const quint8 control = quint8(m_sbuf.at(0));
+                m_sbuf.clear();
+                if (control >> 4 == TightFill) {
+                    m_sskip = m_tpixel;
+                    rectDone();
+                } else if (control >> 4 == TightJpeg || control >> 4 == TightPng) {
+                    m_sstate = ServerState::TightLength;
+                } else if (control & 0x80) {
+                    stop(QStringLiteral("Unknown Tight compression %1").arg(control >> 4));
+                } else if (control & TightExplicitFilter) {
+                    m_sstate = ServerState::TightFilter;
+                } else {
+                    tightData(qint64(m_rectW) * m_rectH * m_tpixel);
+                }
+            }
+            break;
+        case ServerState::TightFilter:
+            if (fill(m_sbuf, 1, d, size, pos)) {
+                const quint8 filter = quint8(m_sbuf.at(0));
+                m_sbuf.clear();
+                if (filter == TightFilterPalette) {
+                    m_sstate = ServerState::TightPalette;
+                } else if (filter == TightFilterCopy || filter == TightFilterGradient) {
+                    tightData(qint64(m_rectW) * m_rectH * m_tpixel);
+                } else {
+                    stop(QStringLiteral("Unknown Tight filter %1").arg(filter));
+                }
+            }
+            break;
+        case ServerState::TightPalette:
+            if (fill(m_sbuf, 1, d, size, pos)) {
+                const int colours = quint8(m_sbuf.at(0)) + 1;
+                m_sbuf.clear();
+                // The palette, then an index per pixel or a bit for two colours
+                m_sskip = qint64(colours) * m_tpixel;
+                tightData(colours == 2 ? qint64((m_rectW + 7) / 8) * m_rectH
+                                       : qint64(m_rectW) * m_rectH);
+            }
+            break;
+        case ServerState::TightLength:
+            // 7 bits a byte while the high bit is set, the third byte has 8
+            if (fill(m_sbuf, m_sbuf.size() + 1, d, size, pos)) {
+                if (quint8(m_sbuf.back()) & 0x80 && m_sbuf.size() < 3) {
+                    break;
+                }
+                qint64 length = 0;
+                for (int i = 0; i < m_sbuf.size(); ++i) {
+                    length |= qint64(quint8(m_sbuf.at(i)) & (i < 2 ? 0x7f : 0xff)) << (7 * i);
+                }
+                m_sbuf.clear();
+                m_sskip = length;
+                rectDone();
+            }
+            break;
+        case ServerState::ColourMapHeader:
+            if (fill(m_sbuf, 5, d, size, pos)) {
+                m_sskip = qint64(u16(m_sbuf, 3)) * 6;
+                m_sbuf.clear();
+                m_sstate = ServerState::MessageType;
+            }
+            break;
+        case ServerState::CutTextHeader:
+            if (fill(m_sbuf, 7, d, size, pos)) {
+                m_sskip = u32(m_sbuf, 3);
+                m_sbuf.clear();
+                m_sstate = ServerState::MessageType;
+            }
+            break;
+        case ServerState::Broken:
+            break;
+        }
+    }
+
+    if (m_ready && start >= 0 && start < size) {
+        Q_EMIT viewerData(start ? data.mid(start) : data, boundary < 0 ? -1 : boundary - start);
+    }
+}
+
+QByteArray RfbBroker::serverInit() const
+{
+    QMutexLocker locker(&m_initMutex);
+    return m_serverInit;
+}
+
+int RfbBroker::viewers() const
+{
+    return m_viewers;
+}
+
+void RfbBroker::addViewer(QObject *viewer)
+{
+    ++m_viewers;
+    connect(viewer, &QObject::destroyed, this, &RfbBroker::viewerLeft);
+}
+
+void RfbBroker::refresh()
+{
+    if (!m_ready) {
+        return;
+    }
+
+    if (!m_restricted) {
+        // Viewers wait until the server is seen using these
+        queue(filterEncodings(m_encodings, true));
+        m_restricted = true;
+    }
+    queue(refreshMessage());
+}
+
+void RfbBroker::viewerLeft()
+{
+    if (--m_viewers > 0 || !m_ready || !m_restricted || m_encodings.isEmpty()) {
+        return;
+    }
+
+    // Nobody needs stateless encodings anymore, the owner gets its own back
+    const QByteArray message = filterEncodings(m_encodings, false);
+    if (message != filterEncodings(m_encodings, true)) {
+        m_restricted = false;
+        m_viewerSafe = false;
+        queue(message);
+    }
+}
+
+void RfbBroker::serverRect()
+{
+    const quint16 w  = u16(m_sbuf, 4);
+    const quint16 h  = u16(m_sbuf, 6);
+    const qint32 enc = qint32(u32(m_sbuf, 8));
+    m_sbuf.clear();
+
+    switch (enc) {
+    case EncodingRaw:
+    case EncodingHextile:
+        m_updatePixels = true;
+        break;
+    case EncodingRre:
+    case EncodingZlib:
+    case EncodingTight:
+    case EncodingZrle:
+    case EncodingTightPng:
+        m_updateSafe = false;
+        break;
+    default:
+        break;
+    }
+
+    switch (enc) {
+    case EncodingRaw:
+        m_sskip = qint64(w) * h * m_bpp;
+        rectDone();
+        break;
+    case EncodingCopyRect:
+        m_sskip = 4;
+        rectDone();
+        break;
+    case EncodingRre:
+        m_sneed  = 4 + m_bpp;
+        m_sstate = ServerState::RreHeader;
+        break;
+    case EncodingZlib:
+    case EncodingZrle:
+        m_sstate = ServerState::DataLength;
+        break;
+    case EncodingTight:
+    case EncodingTightPng:
+        m_rectW  = w;
+        m_rectH  = h;
+        m_sstate = ServerState::TightControl;
+        break;
+    case EncodingHextile:
+        m_rectW = w;
+        m_rectH = h;
+        m_tileX = 0;
+        m_tileY = 0;
+        if (w == 0 || h == 0) {
+            rectDone();
+        } else {
+            m_sstate = ServerState::HextileTile;
+        }
+        break;
+    case EncodingDesktopSize:
+        m_width  = w;
+        m_height = h;
+        updateServerInit();
+        rectDone();
+        break;
+    case EncodingCursor:
+        m_sskip = qint64(w) * h * m_bpp + qint64((w + 7) / 8) * h;
+        rectDone();
+        break;
+    case EncodingQemuKeyEvent:
+        rectDone();
+        break;
+    case EncodingLastRect:
+        m_rects = 0;
+        updateDone();
+        break;
+    default:
+        stop(QStringLiteral("Unexpected encoding %1").arg(enc));
+    }
+}
+
+void RfbBroker::rectDone()
+{
+    if (--m_rects > 0) {
+        m_sstate = ServerState::RectHeader;
+    } else {
+        updateDone();
+    }
+}
+
+void RfbBroker::updateDone()
+{
+    m_sstate = ServerState::MessageType;
+
+    // The server picks the first encoding it knows for all pixels, so
+    // stateless pixels only follow once it read the restricted list.
+    // The full update asked for until then may have come before.
+    if (!m_viewerSafe && m_restricted && m_updateSafe && m_updatePixels) {
+        m_viewerSafe = true;
+        queue(refreshMessage());
+    }
+}
+
+void RfbBroker::nextTile()
+{
+    m_tileX += 16;
+    if (m_tileX >= m_rectW) {
+        m_tileX = 0;
+        m_tileY += 16;
+    }
+
+    if (m_tileY >= m_rectH) {
+        rectDone();
+    } else {
+        m_sstate = ServerState::HextileTile;
+    }
+}
+
+void RfbBroker::tightData(qint64 size)
+{
+    // Less than 12 bytes are sent as is, more compressed after their length
+    if (size < 12) {
+        m_sskip += size;
+        rectDone();
+    } else {
+        m_sstate = ServerState::TightLength;
+    }
+}
+
+bool RfbBroker::setPixelFormat(const QByteArray &format)
+{
+    const int bpp = quint8(format.at(0)) / 8;
+    if (bpp != 1 && bpp != 2 && bpp != 4) {
+        stop(QStringLiteral("Unsupported pixel format"));
+        return false;
+    }
+
+    const bool trueColour = format.at(3) != 0 && u16(format, 4) == 255 &&
+                            u16(format, 6) == 255 && u16(format, 8) == 255;
+    m_bpp         = bpp;
+    m_tpixel      = bpp == 4 && quint8(format.at(1)) == 24 && trueColour ? 3 : bpp;
+    m_pixelFormat = format;
+    return true;
+}
+
+void RfbBroker::updateServerInit()
+{
+    // Viewers get the format the owner asked for, they are the same client
+    QByteArray init(4, Qt::Uninitialized);
+    qToBigEndian<quint16>(m_width, init.data());
+    qToBigEndian<quint16>(m_height, init.data() + 2);
+    init.append(m_pixelFormat);
+
+    QByteArray nameLength(4, Qt::Uninitialized);
+    qToBigEndian<quint32>(m_name.size(), nameLength.data());
+    init.append(nameLength);
+    init.append(m_name);
+
+    QMutexLocker locker(&m_initMutex);
+    m_serverInit = init;
+}
+
+QByteArray RfbBroker::filterEncodings(const QByteArray &message, bool shared) const
+{
+    QByteArray ret = message.left(4);
+    quint16 count  = 0;
+    for (qsizetype i = 4; i + 4 <= message.size(); i += 4) {
+        const qint32 enc = qFromBigEndian<qint32>(message.constData() + i);
+        bool keep        = false;
+        switch (enc) {
+        case EncodingRaw:
+        case EncodingCopyRect:
+        case EncodingHextile:
+        case EncodingLastRect:
+        case EncodingDesktopSize:
+        case EncodingCursor:
+        case EncodingQemuKeyEvent:
+            keep = true;
+            break;
+        case EncodingRre:
+        case EncodingZlib:
+        case EncodingTight:
+        case EncodingZrle:
+        case EncodingTightPng:
+            keep = !shared;
+            break;
+        default:
+            // Levels only tune the encodings above, they add no messages
+            keep = (enc >= EncodingQualityLevel0 && enc <= EncodingQualityLevel9) ||
+                   (enc >= EncodingCompressLevel0 && enc <= EncodingCompressLevel9);
+        }
+        if (keep) {
+            ret.append(message.constData() + i, 4);
+            ++count;
+        }
+    }
+    qToBigEndian<quint16>(count, ret.data() + 2);
+    return ret;
+}
+
+void RfbBroker::queue(const QByteArray &data)
+{
+    // Client messages can't be interleaved, wait for the current one to end
+    if (m_pending.isEmpty() && clientAtBoundary()) {
+        Q_EMIT inject(data);
+    } else {
+        m_pending.append(data);
+    }
+}
+
+QByteArray RfbBroker::refreshMessage() const
+{
+    QByteArray ret(10, '\0');
+    ret[0] = 3;
+    qToBigEndian<quint16>(m_width, ret.data() + 6);
+    qToBigEndian<quint16>(m_height, ret.data() + 8);
+    return ret;
+}
+
+bool RfbBroker::clientAtBoundary() const
+{
+    return m_cstate == ClientState::MessageType && m_cbuf.isEmpty() && m_cskip == 0;
+}
+
+void RfbBroker::stop(const QString &reason)
+{
+    qCWarning(V_RFB) << "Console can't be shared" << m_key << reason;
+    m_sstate = ServerState::Broken;
+    m_cstate = ClientState::Broken;
+    m_ready  = false;
+
+    {
+        QMutexLocker locker(&brokersMutex);
+        if (brokers.value(m_key) == this) {
+            brokers.remove(m_key);
+        }
+    }
+    Q_EMIT closed();
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RFBBROKER_H
+#define RFBBROKER_H
+
+#include <QMutex>
+#include <QObject>
+
+#include <atomic>
+#include <functional>
+
+// Follows the RFB stream of the console session that owns it, so that
+// read-only viewers can join at a message boundary. The owner keeps the
+// encodings it asked for until a viewer joins, then only stateless ones
+// are allowed upstream, a viewer can't decode zlib streams that started
+// before it joined. They are restored once the last viewer left.
+class RfbBroker : public QObject
+{
+    Q_OBJECT
+public:
+    // Registers a broker for key, nullptr if the console is already shared
+    static RfbBroker *create(const QString &key, QObject *parent);
+    // Calls setup with the broker of key while it can't go away,
+    // false if there is none or its handshake isn't done yet
+    static bool join(const QString &key, const std::function<void(RfbBroker *)> &setup);
+
+    ~RfbBroker() override;
+
+    // Called by the owner with the traffic of its console,
+    // returns what should be sent upstream
+    QByteArray fromClient(const QByteArray &data);
+    void fromServer(const QByteArray &data);
+
+    // Thread safe
+    QByteArray serverInit() const;
+    int viewers() const;
+    void addViewer(QObject *viewer);
+
+    // Asks the server for a full framebuffer update, restricting the
+    // encodings first if this is the first viewer
+    void refresh();
+
+Q_SIGNALS:
+    void inject(const QByteArray &data);
+    // boundary is the offset of the first message in data, or -1
+    void viewerData(const QByteArray &data, qsizetype boundary);
+    void closed();
+
+private:
+    enum class ServerState {
+        Version,
+        SecurityCount,
+        SecurityTypes,
+        SecurityNext,
+        Challenge,
+        SecurityResult,
+        InitHeader,
+        InitName,
+        MessageType,
+        UpdateHeader,
+        RectHeader,
+        HextileTile,
+        HextileCount,
+        RreHeader,
+        DataLength,
+        TightControl,
+        TightFilter,
+        TightPalette,
+        TightLength,
+        ColourMapHeader,
+        CutTextHeader,
+        Broken,
+    };
+
+    enum class ClientState {
+        Version,
+        Choice,
+        Response,
+        ClientInit,
+        MessageType,
+        PixelFormat,
+        EncodingsHeader,
+        Encodings,
+        Fixed,
+        CutTextHeader,
+        QemuSubtype,
+        Broken,
+    };
+
+    explicit RfbBroker(const QString &key, QObject *parent);
+
+    void serverRect();
+    void rectDone();
+    void updateDone();
+    void nextTile();
+    void tightData(qint64 size);
+    void updateServerInit();
+    void viewerLeft();
+    // Only what viewers can decode when shared, else what the broker can follow
+    QByteArray filterEncodings(const QByteArray &message, bool shared) const;
+    QByteArray refreshMessage() const;
+    // Sends data upstream once the owner is between two messages
+    void queue(const QByteArray &data);
+    bool setPixelFormat(const QByteArray &format);
+    bool clientAtBoundary() const;
+    void stop(const QString &reason);
+
+    QString m_key;
+    QByteArray m_sbuf;
+    QByteArray m_cbuf;
+    QByteArray m_pixelFormat;
+    QByteArray m_name;
+    qint64 m_sskip        = 0;
+    qint64 m_cskip        = 0;
+    ServerState m_sstate  = ServerState::Version;
+    ClientState m_cstate  = ClientState::Version;
+    qsizetype m_sneed     = 0;
+    qsizetype m_cneed     = 0;
+    int m_serverMinor     = 0;
+    int m_minor           = 0;
+    int m_choice          = -1;
+    int m_bpp             = 4;
+    // Bytes of a Tight pixel, 3 for 24 bit true colour
+    int m_tpixel          = 4;
+    int m_rects           = 0;
+    int m_rectW           = 0;
+    int m_rectH           = 0;
+    int m_tileX           = 0;
+    int m_tileY           = 0;
+    quint16 m_width       = 0;
+    quint16 m_height      = 0;
+    quint8 m_subencoding  = 0;
+    // Last SetEncodings of the owner, as it sent it
+    QByteArray m_encodings;
+    QByteArray m_pending;
+    // Upstream only has the encodings viewers can decode
+    bool m_restricted   = true;
+    // The server is known to have switched, viewers may start
+    bool m_viewerSafe   = true;
+    bool m_updateSafe   = true;
+    bool m_updatePixels = false;
+
+    mutable QMutex m_initMutex;
+    QByteArray m_serverInit;
+    std::atomic<bool> m_ready{false};
+    std::atomic<int> m_viewers{0};
+};
+
+#endif // RFBBROKER_H
@@ -16,6 +16,7 @@
  */
 #include "root.h"
 
+#include "metrics.h"
 #include "virtlyst.h"
 
 #include <Cutelyst/Plugins/Authentication/authentication.h>
@@ -87,6 +88,12 @@ bool Root::Auto(Context *c)
         return true;
     }
 
+    // Prometheus scrapers carry a bearer token instead of a session
+    if (auto metrics = qobject_cast<Metrics *>(c->controller());
+        metrics && metrics->scraperAuthorized(c)) {
+        return true;
+    }
+
     if (!Authentication::userExists(c)) {
         c->res()->redirect(c->uriFor(CActionFor(QStringLiteral("login"))));
         return false;
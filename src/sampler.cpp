@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sampler.h"
+
+#include "lib/domain.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QThread>
+#include <QTimer>
+
+#include <memory>
+
+Q_LOGGING_CATEGORY(V_SAMPLER, "virtlyst.sampler")
+
+namespace {
+
+Sampler *sampler       = nullptr;
+QThread *samplerThread = nullptr;
+
+QMutex snapshotMutex;
+QSharedPointer<const Sampler::Snapshot> lastSnapshot;
+
+} // namespace
+
+Sampler *Sampler::instance()
+{
+    static Sampler *ret = [] {
+        samplerThread = new QThread;
+        samplerThread->setObjectName(QStringLiteral("sampler"));
+        samplerThread->start();
+
+        sampler = new Sampler;
+        sampler->moveToThread(samplerThread);
+        qAddPostRoutine(&Sampler::shutdown);
+        return sampler;
+    }();
+    return ret;
+}
+
+Sampler::Sampler()
+    : QObject(nullptr)
+    , m_timer(new QTimer(this))
+{
+    connect(m_timer, &QTimer::timeout, this, &Sampler::sample);
+}
+
+void Sampler::shutdown()
+{
+    QMetaObject::invokeMethod(
+        sampler,
+        [] {
+            sampler->m_timer->stop();
+            for (Target &target : sampler->m_targets) {
+                delete target.conn;
+                target.conn = nullptr;
+            }
+        },
+        Qt::BlockingQueuedConnection);
+
+    samplerThread->quit();
+    samplerThread->wait();
+}
+
+void Sampler::setHost(const QString &id, const QString &name, const QUrl &url)
+{
+    QMetaObject::invokeMethod(this, [this, id, name, url] {
+        Target &target = m_targets[id];
+        target.name    = name;
+        if (target.url != url) {
+            target.url = url;
+            delete target.conn;
+            target.conn = nullptr;
+        }
+    });
+}
+
+void Sampler::removeHost(const QString &id)
+{
+    QMetaObject::invokeMethod(this, [this, id] {
+        auto it = m_targets.find(id);
+        if (it != m_targets.end()) {
+            delete it->conn;
+            m_targets.erase(it);
+        }
+    });
+}
+
+void Sampler::setInterval(int msecs)
+{
+    QMetaObject::invokeMethod(this, [this, msecs] {
+        if (msecs <= 0) {
+            m_timer->stop();
+        } else if (m_timer->interval() != msecs || !m_timer->isActive()) {
+            m_timer->start(msecs);
+            // Don't make the first scrape wait a whole interval
+            QTimer::singleShot(0, this, &Sampler::sample);
+        }
+    });
+}
+
+void Sampler::setBalloonPeriod(int secs)
+{
+    QMetaObject::invokeMethod(this, [this, secs] {
+        if (m_balloonPeriod != secs) {
+            m_balloonPeriod = secs;
+            for (Target &target : m_targets) {
+                target.ballooned.clear();
+            }
+        }
+    });
+}
+
+QSharedPointer<const Sampler::Snapshot> Sampler::snapshot()
+{
+    QMutexLocker locker(&snapshotMutex);
+    return lastSnapshot;
+}
+
+void Sampler::sample()
+{
+    auto snapshot = QSharedPointer<Snapshot>::create();
+    snapshot->reserve(m_targets.size());
+    for (auto it = m_targets.begin(); it != m_targets.end(); ++it) {
+        snapshot->append(sampleHost(it.key(), it.value()));
+    }
+
+    {
+        QMutexLocker locker(&snapshotMutex);
+        lastSnapshot = snapshot;
+    }
+    Q_EMIT sampled(snapshot);
+}
+
+Sampler::Host Sampler::sampleHost(const QString &id, Target &target)
+{
+    Host host;
+    host.id   = id;
+    host.name = target.name;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Our own connections, the ones of the workers belong to their threads
+    if (target.conn && !target.conn->isAlive()) {
+        delete target.conn;
+        target.conn = nullptr;
+    }
+    if (!target.conn) {
+        target.conn = new Connection(target.url, target.name, this);
+    }
+
+    if (target.conn->isAlive()) {
+        host.node    = target.conn->nodeStats();
+        host.cpus    = target.conn->cpuTimes();
+        host.domains = target.conn->allDomainStats(DomainStats);
+        host.up      = true;
+        if (m_balloonPeriod > 0) {
+            applyBalloonPeriod(target, host.domains);
+        }
+    } else {
+        qCDebug(V_SAMPLER) << "Host is down" << target.name;
+    }
+
+    host.timestamp  = QDateTime::currentMSecsSinceEpoch();
+    host.durationMs = timer.elapsed();
+    return host;
+}
+
+void Sampler::applyBalloonPeriod(Target &target, const QVector<Connection::StatsRecord> &domains)
+{
+    // A live setting, a guest that was restarted needs it again
+    QSet<QString> running;
+    for (const Connection::StatsRecord &record : domains) {
+        if (int(record.values.value("state.state")) != VIR_DOMAIN_RUNNING) {
+            continue;
+        }
+        running.insert(record.uuid);
+        if (target.ballooned.contains(record.uuid)) {
+            continue;
+        }
+
+        // Not retried, a guest without a balloon would fail every round
+        target.ballooned.insert(record.uuid);
+        std::unique_ptr<Domain> domain(target.conn->getDomainByUuid(record.uuid));
+        if (!domain || !domain->setMemoryStatsPeriod(m_balloonPeriod)) {
+            qCDebug(V_SAMPLER) << "Failed to set the balloon period of" << record.name;
+        }
+    }
+    target.ballooned.intersect(running);
+}
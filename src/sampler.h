@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "lib/connection.h"
+
+#include <QMap>
+#include <QObject>
+#include <QSet>
+#include <QSharedPointer>
+#include <QUrl>
+
+class QTimer;
+class Sampler : public QObject
+{
+    Q_OBJECT
+public:
+    struct Host {
+        QString id;
+        QString name;
+        bool up           = false;
+        // Wall clock time of the sample, in ms since the epoch
+        qint64 timestamp  = 0;
+        qint64 durationMs = 0;
+        QHash<QByteArray, double> node;
+        QVector<Connection::CpuTime> cpus;
+        QVector<Connection::StatsRecord> domains;
+    };
+    using Snapshot = QVector<Host>;
+
+    // Stats groups collected for every domain
+    static constexpr uint DomainStats = VIR_DOMAIN_STATS_STATE | VIR_DOMAIN_STATS_CPU_TOTAL |
+                                        VIR_DOMAIN_STATS_BALLOON | VIR_DOMAIN_STATS_INTERFACE |
+                                        VIR_DOMAIN_STATS_BLOCK | VIR_DOMAIN_STATS_VCPU |
+                                        VIR_DOMAIN_STATS_PERF;
+
+    // Starts the sampler thread, only call it after the fork
+    static Sampler *instance();
+
+    // Thread safe, these are queued to the sampler thread
+    void setHost(const QString &id, const QString &name, const QUrl &url);
+    void removeHost(const QString &id);
+    // 0 stops sampling
+    void setInterval(int msecs);
+    // Seconds between guest memory stats updates set on running
+    // domains, without it most balloon drivers only report rss
+    void setBalloonPeriod(int secs);
+
+    // Last complete round, readers never wait on libvirt
+    static QSharedPointer<const Snapshot> snapshot();
+
+Q_SIGNALS:
+    // Emitted on the sampler thread after every round
+    void sampled(const QSharedPointer<const Sampler::Snapshot> &snapshot);
+
+private:
+    struct Target {
+        QString name;
+        QUrl url;
+        Connection *conn = nullptr;
+        // Running domains that got the balloon period
+        QSet<QString> ballooned;
+    };
+
+    Sampler();
+
+    static void shutdown();
+
+    void sample();
+    Host sampleHost(const QString &id, Target &target);
+    void applyBalloonPeriod(Target &target, const QVector<Connection::StatsRecord> &domains);
+
+    QMap<QString, Target> m_targets;
+    QTimer *m_timer;
+    int m_balloonPeriod = 0;
+};
+
+#endif // SAMPLER_H
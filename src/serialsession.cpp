@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "serialsession.h"
+
+#include <Cutelyst/Context>
+#include <Cutelyst/Request>
+#include <Cutelyst/Response>
+
+#include <QLoggingCategory>
+#include <QMutex>
+
+Q_LOGGING_CATEGORY(V_SERIAL, "virtlyst.serial")
+
+using namespace Cutelyst;
+
+namespace {
+
+constexpr int ReadEvents  = VIR_STREAM_EVENT_READABLE | VIR_STREAM_EVENT_ERROR |
+                           VIR_STREAM_EVENT_HANGUP;
+constexpr int WriteEvents = ReadEvents | VIR_STREAM_EVENT_WRITABLE;
+
+} // namespace
+
+// Shared by the session and the libvirt event loop thread, whoever
+// is last frees the stream
+struct SerialSession::Pipe {
+    ~Pipe()
+    {
+        if (stream) {
+            virStreamFree(stream);
+        }
+    }
+
+    QMutex mutex;
+    QByteArray pending;
+    virStreamPtr stream    = nullptr;
+    SerialSession *session = nullptr;
+    bool closed            = false;
+};
+
+SerialSession::SerialSession(Context *c,
+                             virStreamPtr stream,
+                             const QString &label,
+                             qint64 inputLimit)
+    : QObject(c)
+    , m_c(c)
+    , m_pipe(std::make_shared<Pipe>())
+    , m_label(label)
+    , m_inputLimit(inputLimit)
+{
+    m_pipe->stream  = stream;
+    m_pipe->session = this;
+
+    connect(c->request(), &Request::webSocketBinaryFrame, this, &SerialSession::clientFrame);
+    connect(c->request(), &Request::webSocketTextFrame, this, [this](const QString &message) {
+        clientFrame(message.toUtf8());
+    });
+    connect(c->request(), &Request::webSocketClosed, this, [this] {
+        m_closed = true;
+        detach();
+    });
+
+    // The event loop keeps its own reference until the callback is removed
+    if (virStreamEventAddCallback(stream,
+                                  ReadEvents,
+                                  &SerialSession::streamEvent,
+                                  new std::shared_ptr<Pipe>(m_pipe),
+                                  &SerialSession::freePipe) < 0) {
+        consoleClosed(QStringLiteral("Cannot watch console stream"));
+    }
+}
+
+SerialSession::~SerialSession()
+{
+    detach();
+}
+
+void SerialSession::streamEvent(virStreamPtr stream, int events, void *opaque)
+{
+    Pipe *pipe = static_cast<std::shared_ptr<Pipe> *>(opaque)->get();
+
+    QString reason;
+    if (events & VIR_STREAM_EVENT_READABLE) {
+        char buf[16 * 1024];
+        int got;
+        while ((got = virStreamRecv(stream, buf, sizeof(buf))) > 0) {
+            const QByteArray data(buf, got);
+            QMutexLocker locker(&pipe->mutex);
+            if (pipe->session) {
+                QMetaObject::invokeMethod(pipe->session, [session = pipe->session, data] {
+                    session->consoleData(data);
+                });
+            }
+        }
+        if (got == 0) {
+            reason = QStringLiteral("Console closed");
+        } else if (got == -1) {
+            reason = QStringLiteral("Console read failed");
+        }
+    }
+
+    bool drained = false;
+    if (reason.isEmpty() && events & VIR_STREAM_EVENT_WRITABLE) {
+        QMutexLocker locker(&pipe->mutex);
+        while (!pipe->pending.isEmpty()) {
+            const int sent =
+                virStreamSend(stream, pipe->pending.constData(), pipe->pending.size());
+            if (sent == -2) {
+                break;
+            } else if (sent < 0) {
+                reason = QStringLiteral("Console write failed");
+                break;
+            }
+            pipe->pending.remove(0, sent);
+        }
+        drained = pipe->pending.isEmpty();
+    }
+
+    if (reason.isEmpty() && events & (VIR_STREAM_EVENT_ERROR | VIR_STREAM_EVENT_HANGUP)) {
+        reason = QStringLiteral("Console hung up");
+    }
+
+    if (!reason.isEmpty()) {
+        QMutexLocker locker(&pipe->mutex);
+        if (pipe->closed) {
+            return;
+        }
+        pipe->closed = true;
+        if (pipe->session) {
+            QMetaObject::invokeMethod(pipe->session, [session = pipe->session, reason] {
+                session->consoleClosed(reason);
+            });
+        }
+        locker.unlock();
+
+        virStreamEventRemoveCallback(stream);
+        virStreamAbort(stream);
+    } else if (drained) {
+        virStreamEventUpdateCallback(stream, ReadEvents);
+
+        // Input queued meanwhile would otherwise wait for more input
+        QMutexLocker locker(&pipe->mutex);
+        if (!pipe->pending.isEmpty()) {
+            locker.unlock();
+            virStreamEventUpdateCallback(stream, WriteEvents);
+        }
+    }
+}
+
+void SerialSession::freePipe(void *opaque)
+{
+    delete static_cast<std::shared_ptr<Pipe> *>(opaque);
+}
+
+void SerialSession::consoleData(const QByteArray &data)
+{
+    if (!m_closed) {
+        m_c->response()->webSocketBinaryMessage(data);
+    }
+}
+
+void SerialSession::consoleClosed(const QString &reason)
+{
+    qCDebug(V_SERIAL) << "Serial console closed" << m_label << reason;
+    if (!m_closed) {
+        m_closed = true;
+        m_c->response()->webSocketClose(Response::CloseCodeNormal, reason);
+    }
+}
+
+void SerialSession::clientFrame(const QByteArray &message)
+{
+    QMutexLocker locker(&m_pipe->mutex);
+    if (m_pipe->closed) {
+        return;
+    }
+
+    // Nothing should type faster than a serial line drains
+    if (m_pipe->pending.size() + message.size() > m_inputLimit) {
+        locker.unlock();
+        qCWarning(V_SERIAL) << "Serial console is not reading input" << m_label;
+        close();
+        return;
+    }
+
+    m_pipe->pending.append(message);
+    locker.unlock();
+
+    // libvirt locks must not be taken while holding the pipe mutex
+    virStreamEventUpdateCallback(m_pipe->stream, WriteEvents);
+}
+
+void SerialSession::close()
+{
+    detach();
+
+    if (!m_closed) {
+        m_closed = true;
+        m_c->response()->webSocketClose(Response::CloseCodeGoingAway,
+                                        QStringLiteral("Console closed"));
+    }
+}
+
+void SerialSession::detach()
+{
+    QMutexLocker locker(&m_pipe->mutex);
+    m_pipe->session = nullptr;
+    if (m_pipe->closed) {
+        return;
+    }
+    m_pipe->closed = true;
+    locker.unlock();
+
+    qCDebug(V_SERIAL) << "Closing serial console" << m_label;
+    virStreamEventRemoveCallback(m_pipe->stream);
+    virStreamAbort(m_pipe->stream);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SERIALSESSION_H
+#define SERIALSESSION_H
+
+#include <libvirt/libvirt.h>
+
+#include <QObject>
+
+#include <memory>
+
+namespace Cutelyst {
+class Context;
+}
+
+class SerialSession : public QObject
+{
+    Q_OBJECT
+public:
+    // Bridges a non blocking console stream to the WebSocket of c,
+    // takes ownership of the stream
+    SerialSession(Cutelyst::Context *c,
+                  virStreamPtr stream,
+                  const QString &label,
+                  qint64 inputLimit);
+    ~SerialSession() override;
+
+private:
+    struct Pipe;
+
+    static void streamEvent(virStreamPtr stream, int events, void *opaque);
+    static void freePipe(void *opaque);
+
+    void consoleData(const QByteArray &data);
+    void consoleClosed(const QString &reason);
+    void clientFrame(const QByteArray &message);
+    void close();
+    void detach();
+
+    Cutelyst::Context *m_c;
+    std::shared_ptr<Pipe> m_pipe;
+    QString m_label;
+    qint64 m_inputLimit;
+    bool m_closed = false;
+};
+
+#endif // SERIALSESSION_H
@@ -0,0 +1,399 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sshtunnels.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QLoggingCategory>
+#include <QProcess>
+#include <QTcpServer>
+#include <QThread>
+#include <QTimer>
+
+#include <atomic>
+
+Q_LOGGING_CATEGORY(V_SSH, "virtlyst.ssh")
+
+namespace {
+
+SshTunnels *tunnels   = nullptr;
+QThread *tunnelThread = nullptr;
+std::atomic<int> idleTimeout{60 * 1000};
+
+// Checks run every 250ms while a master authenticates
+constexpr int MasterCheckInterval = 250;
+constexpr int MasterMaxChecks     = 80;
+
+QString masterKey(const QUrl &url)
+{
+    return url.userName() + QLatin1Char('@') + url.host() + QLatin1Char(':') +
+           QString::number(url.port(22));
+}
+
+QString forwardSpec(quint16 local, quint16 remote)
+{
+    return QStringLiteral("127.0.0.1:%1:127.0.0.1:%2").arg(local).arg(remote);
+}
+
+quint16 freeLocalPort()
+{
+    // Someone else may take it before ssh binds it, the
+    // forward then fails and the next viewer retries
+    QTcpServer server;
+    if (server.listen(QHostAddress::LocalHost)) {
+        return server.serverPort();
+    }
+    return 0;
+}
+
+} // namespace
+
+SshTunnels *SshTunnels::instance()
+{
+    static SshTunnels *ret = [] {
+        tunnelThread = new QThread;
+        tunnelThread->setObjectName(QStringLiteral("ssh-tunnels"));
+        tunnelThread->start();
+
+        tunnels = new SshTunnels;
+        tunnels->moveToThread(tunnelThread);
+        qAddPostRoutine(&SshTunnels::shutdown);
+        return tunnels;
+    }();
+    return ret;
+}
+
+SshTunnels::SshTunnels()
+    : QObject(nullptr)
+{
+}
+
+void SshTunnels::shutdown()
+{
+    QMetaObject::invokeMethod(
+        tunnels,
+        [] {
+            const QStringList keys = tunnels->m_masters.keys();
+            for (const QString &key : keys) {
+                Master *master = tunnels->m_masters.value(key);
+                if (master) {
+                    master->process->terminate();
+                    master->process->waitForFinished(1000);
+                }
+            }
+        },
+        Qt::BlockingQueuedConnection);
+
+    tunnelThread->quit();
+    tunnelThread->wait();
+}
+
+void SshTunnels::forward(const QUrl &url,
+                         quint16 remotePort,
+                         QObject *context,
+                         const std::function<void(quint16, const QString &)> &callback)
+{
+    // Queued to the context thread and dropped if the context is gone
+    auto request = new SshTunnelRequest;
+    connect(request, &SshTunnelRequest::done, context, callback);
+    request->moveToThread(thread());
+
+    QMetaObject::invokeMethod(
+        this, [this, url, remotePort, request] { doForward(url, remotePort, request); });
+}
+
+void SshTunnels::release(const QUrl &url, quint16 remotePort)
+{
+    QMetaObject::invokeMethod(this, [this, url, remotePort] { doRelease(url, remotePort); });
+}
+
+void SshTunnels::setIdleTimeout(int msecs)
+{
+    idleTimeout = msecs;
+}
+
+void SshTunnels::doForward(const QUrl &url, quint16 remotePort, SshTunnelRequest *request)
+{
+    const QString key = masterKey(url);
+    Master *master    = m_masters.value(key);
+    if (!master) {
+        master              = new Master;
+        master->url         = url;
+        master->controlPath = QDir::tempPath() + QStringLiteral("/virtlyst-%1-%2")
+                                                     .arg(QCoreApplication::applicationPid())
+                                                     .arg(++m_lastId);
+        master->idle        = new QTimer(this);
+        master->idle->setSingleShot(true);
+        connect(master->idle, &QTimer::timeout, this, [this, key] { stopMaster(key); });
+        m_masters.insert(key, master);
+
+        startMaster(master);
+    }
+    master->idle->stop();
+
+    Forward &fwd = master->forwards[remotePort];
+    ++fwd.refs;
+    if (fwd.idle) {
+        fwd.idle->stop();
+    }
+
+    if (fwd.ready) {
+        Q_EMIT request->done(fwd.local, QString());
+        request->deleteLater();
+        return;
+    }
+
+    fwd.waiting.append(request);
+    if (master->ready && !fwd.requesting) {
+        requestForward(master, remotePort);
+    }
+}
+
+void SshTunnels::doRelease(const QUrl &url, quint16 remotePort)
+{
+    const QString key = masterKey(url);
+    Master *master    = m_masters.value(key);
+    if (!master) {
+        return;
+    }
+
+    auto it = master->forwards.find(remotePort);
+    if (it == master->forwards.end() || --it->refs > 0) {
+        return;
+    }
+
+    if (!it->idle) {
+        it->idle = new QTimer(this);
+        it->idle->setSingleShot(true);
+        connect(it->idle, &QTimer::timeout, this, [this, key, remotePort] {
+            cancelForward(key, remotePort);
+        });
+    }
+    it->idle->start(idleTimeout);
+}
+
+void SshTunnels::startMaster(Master *master)
+{
+    const QString key = masterKey(master->url);
+    qCDebug(V_SSH) << "Starting ssh master for" << key;
+
+    QStringList args = baseArgs(master);
+    args << u"-MNTC"_qs;
+    args << u"-o"_qs << u"ControlPersist=no"_qs;
+    args << u"-o"_qs << u"BatchMode=yes"_qs;
+    args << u"-o"_qs << u"ServerAliveInterval=30"_qs;
+    args << master->url.host();
+
+    master->process = new QProcess(this);
+    master->process->setProgram(u"ssh"_qs);
+    master->process->setArguments(args);
+    connect(master->process,
+            &QProcess::finished,
+            this,
+            [this, key, process = master->process] {
+        const QString output = QString::fromLocal8Bit(process->readAllStandardError()).trimmed();
+        process->deleteLater();
+        failMaster(key, output.isEmpty() ? QStringLiteral("ssh exited") : output);
+    });
+    master->process->start();
+
+    checkMaster(master);
+}
+
+void SshTunnels::checkMaster(Master *master)
+{
+    if (++master->checks > MasterMaxChecks) {
+        qCWarning(V_SSH) << "Timeout waiting for ssh master" << masterKey(master->url);
+        master->process->terminate();
+        return;
+    }
+
+    // A mux client only succeeds once the master is authenticated
+    const QString key = masterKey(master->url);
+    auto check        = new QProcess(this);
+    connect(check,
+            &QProcess::finished,
+            this,
+            [this, key, check](int exitCode, QProcess::ExitStatus status) {
+        check->deleteLater();
+
+        Master *master = m_masters.value(key);
+        if (!master || master->ready) {
+            return;
+        }
+
+        if (status == QProcess::NormalExit && exitCode == 0) {
+            masterReady(master);
+        } else {
+            QTimer::singleShot(MasterCheckInterval, this, [this, key] {
+                Master *master = m_masters.value(key);
+                if (master && !master->ready) {
+                    checkMaster(master);
+                }
+            });
+        }
+    });
+    check->start(u"ssh"_qs,
+                 baseArgs(master) << u"-O"_qs << u"check"_qs << master->url.host());
+}
+
+void SshTunnels::masterReady(Master *master)
+{
+    qCDebug(V_SSH) << "ssh master ready for" << masterKey(master->url) << "after"
+                   << master->checks << "checks";
+    master->ready = true;
+
+    for (auto it = master->forwards.begin(); it != master->forwards.end(); ++it) {
+        if (!it->waiting.isEmpty() && !it->requesting) {
+            requestForward(master, it.key());
+        }
+    }
+}
+
+void SshTunnels::failMaster(const QString &key, const QString &error)
+{
+    Master *master = m_masters.take(key);
+    if (!master) {
+        return;
+    }
+    qCWarning(V_SSH) << "ssh master for" << key << "exited:" << error;
+
+    for (Forward &fwd : master->forwards) {
+        for (SshTunnelRequest *request : std::as_const(fwd.waiting)) {
+            Q_EMIT request->done(0, error);
+            request->deleteLater();
+        }
+        delete fwd.idle;
+    }
+    delete master->idle;
+    delete master;
+}
+
+void SshTunnels::stopMaster(const QString &key)
+{
+    Master *master = m_masters.value(key);
+    if (!master || !master->forwards.isEmpty()) {
+        return;
+    }
+
+    qCDebug(V_SSH) << "Closing idle ssh master for" << key;
+    // failMaster() cleans up once the process is gone
+    master->process->terminate();
+}
+
+void SshTunnels::requestForward(Master *master, quint16 remotePort)
+{
+    Forward &fwd   = master->forwards[remotePort];
+    fwd.requesting = true;
+    fwd.local      = freeLocalPort();
+
+    const QString key  = masterKey(master->url);
+    const QString spec = forwardSpec(fwd.local, remotePort);
+    qCDebug(V_SSH) << "Adding ssh forward" << spec << "to" << key;
+
+    auto process = new QProcess(this);
+    connect(process,
+            &QProcess::finished,
+            this,
+            [this, key, remotePort, process](int exitCode, QProcess::ExitStatus status) {
+        QString error;
+        if (status != QProcess::NormalExit || exitCode != 0) {
+            error = QString::fromLocal8Bit(process->readAllStandardError()).trimmed();
+            if (error.isEmpty()) {
+                error = QStringLiteral("Cannot create ssh tunnel");
+            }
+        }
+        process->deleteLater();
+
+        Master *master = m_masters.value(key);
+        if (master) {
+            finishForward(master, remotePort, error);
+        }
+    });
+    process->start(u"ssh"_qs,
+                   baseArgs(master) << u"-O"_qs << u"forward"_qs << u"-L"_qs << spec
+                                    << master->url.host());
+}
+
+void SshTunnels::cancelForward(const QString &key, quint16 remotePort)
+{
+    Master *master = m_masters.value(key);
+    if (!master) {
+        return;
+    }
+
+    auto it = master->forwards.find(remotePort);
+    if (it == master->forwards.end() || it->refs > 0 || it->requesting) {
+        return;
+    }
+
+    if (it->ready) {
+        const QString spec = forwardSpec(it->local, remotePort);
+        qCDebug(V_SSH) << "Removing idle ssh forward" << spec << "from" << key;
+
+        auto process = new QProcess(this);
+        connect(process, &QProcess::finished, process, &QObject::deleteLater);
+        process->start(u"ssh"_qs,
+                       baseArgs(master) << u"-O"_qs << u"cancel"_qs << u"-L"_qs << spec
+                                        << master->url.host());
+    }
+
+    delete it->idle;
+    master->forwards.erase(it);
+
+    if (master->forwards.isEmpty()) {
+        master->idle->start(idleTimeout);
+    }
+}
+
+void SshTunnels::finishForward(Master *master, quint16 remotePort, const QString &error)
+{
+    auto it = master->forwards.find(remotePort);
+    if (it == master->forwards.end()) {
+        return;
+    }
+
+    it->requesting = false;
+    it->ready      = error.isEmpty();
+    if (!it->ready) {
+        qCWarning(V_SSH) << "Cannot create ssh tunnel:" << error;
+    }
+
+    const QVector<SshTunnelRequest *> waiting = std::exchange(it->waiting, {});
+    for (SshTunnelRequest *request : waiting) {
+        Q_EMIT request->done(it->ready ? it->local : 0, error);
+        request->deleteLater();
+    }
+
+    if (it->refs == 0) {
+        // Every viewer left while the forward was being added
+        it->idle->start(idleTimeout);
+    }
+}
+
+QStringList SshTunnels::baseArgs(const Master *master) const
+{
+    QStringList args;
+    args << u"-S"_qs << master->controlPath;
+    if (!master->url.userName().isEmpty()) {
+        args << u"-l"_qs << master->url.userName();
+    }
+    if (master->url.port() > 0) {
+        args << u"-p"_qs << QString::number(master->url.port());
+    }
+    return args;
+}
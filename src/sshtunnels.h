@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SSHTUNNELS_H
+#define SSHTUNNELS_H
+
+#include <QHash>
+#include <QObject>
+#include <QUrl>
+
+#include <functional>
+
+class QProcess;
+class QTimer;
+class SshTunnelRequest : public QObject
+{
+    Q_OBJECT
+Q_SIGNALS:
+    void done(quint16 localPort, const QString &error);
+};
+
+class SshTunnels : public QObject
+{
+    Q_OBJECT
+public:
+    // Starts the tunnel thread, only call it after the fork
+    static SshTunnels *instance();
+
+    // Forwards a local port to remotePort on the url host, the callback runs
+    // on the context thread unless context is gone. Each call must be paired
+    // with release() so that idle forwards and masters get closed.
+    void forward(const QUrl &url,
+                 quint16 remotePort,
+                 QObject *context,
+                 const std::function<void(quint16 localPort, const QString &error)> &callback);
+    void release(const QUrl &url, quint16 remotePort);
+
+    // Thread safe and usable before the fork
+    static void setIdleTimeout(int msecs);
+
+private:
+    struct Forward {
+        QVector<SshTunnelRequest *> waiting;
+        QTimer *idle    = nullptr;
+        quint16 local   = 0;
+        int refs        = 0;
+        bool ready      = false;
+        bool requesting = false;
+    };
+
+    struct Master {
+        QUrl url;
+        QString controlPath;
+        QHash<quint16, Forward> forwards;
+        QProcess *process = nullptr;
+        QTimer *idle      = nullptr;
+        int checks        = 0;
+        bool ready        = false;
+    };
+
+    SshTunnels();
+
+    static void shutdown();
+
+    void doForward(const QUrl &url, quint16 remotePort, SshTunnelRequest *request);
+    void doRelease(const QUrl &url, quint16 remotePort);
+
+    void startMaster(Master *master);
+    void checkMaster(Master *master);
+    void masterReady(Master *master);
+    void failMaster(const QString &key, const QString &error);
+    void stopMaster(const QString &key);
+    void requestForward(Master *master, quint16 remotePort);
+    void cancelForward(const QString &key, quint16 remotePort);
+    void finishForward(Master *master, quint16 remotePort, const QString &error);
+
+    QStringList baseArgs(const Master *master) const;
+
+    QHash<QString, Master *> m_masters;
+    int m_lastId = 0;
+};
+
+#endif // SSHTUNNELS_H
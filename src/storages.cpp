@@ -22,6 +22,8 @@
 #include "lib/storagevol.h"
 #include "virtlyst.h"
 
+#include <Cutelyst/Plugins/StatusMessage>
+
 #include <QLoggingCategory>
 
 Storages::Storages(Virtlyst *parent)
@@ -105,6 +107,7 @@ void Storages::storage(Context *c, const QString &hostId, const QString &pool)
     }
 
     if (c->request()->isPost()) {
+        ParamsMultiMap query;
         const ParamsMultiMap params = c->request()->bodyParameters();
         if (params.contains(QStringLiteral("start"))) {
             storage->start();
@@ -150,13 +153,23 @@ void Storages::storage(Context *c, const QString &hostId, const QString &pool)
                     flags = VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA;
                 }
             }
-            StorageVol *vol = storage->getVolume(volName);
+            const StorageVol::CloneMode mode = params.contains(QStringLiteral("reflink"))
+                                                   ? StorageVol::CloneReflink
+                                                   : StorageVol::CloneCopy;
+            StorageVol *vol                  = storage->getVolume(volName);
             if (vol) {
-                vol->clone(imageName, format, flags);
+                StorageVol::CloneStats stats;
+                StorageVol *cloned = vol->clone(imageName, format, flags, mode, &stats);
+                if (cloned) {
+                    query = StatusMessage::statusQuery(
+                        c, StorageVol::cloneSummary(cloned->name(), stats));
+                } else {
+                    query = StatusMessage::errorQuery(c, conn->lastError());
+                }
             }
         }
-        c->response()->redirect(
-            c->uriFor(CActionFor(QStringLiteral("storage")), QStringList{hostId, pool}));
+        c->response()->redirect(c->uriFor(
+            CActionFor(QStringLiteral("storage")), QStringList{hostId, pool}, QStringList(), query));
     }
     c->setStash(QStringLiteral("storage"), QVariant::fromValue(storage));
 }
@@ -17,20 +17,27 @@
 #include "virtlyst.h"
 
 #include "console.h"
+#include "cpuheatmap.h"
 #include "create.h"
+#include "fleet.h"
 #include "info.h"
 #include "infrastructure.h"
 #include "instances.h"
 #include "interfaces.h"
 #include "lib/connection.h"
+#include "lib/eventloop.h"
+#include "metrics.h"
+#include "metricsstore.h"
 #include "networks.h"
 #include "overview.h"
 #include "root.h"
+#include "sampler.h"
 #include "secrets.h"
 #include "server.h"
 #include "sqluserstore.h"
 #include "storages.h"
 #include "users.h"
+#include "warmpool.h"
 #include "ws.h"
 
 #include <Cutelyst/Plugins/Authentication/authenticationrealm.h>
@@ -43,6 +50,7 @@
 
 #include <QCoreApplication>
 #include <QFile>
+#include <QFileInfo>
 #include <QLoggingCategory>
 #include <QMutexLocker>
 #include <QSqlDatabase>
@@ -87,6 +95,7 @@ bool Virtlyst::init()
     new Create(this);
     new Users(this);
     new Ws(this);
+    new Metrics(this);
 
     bool production = config(QStringLiteral("production")).toBool();
     qCDebug(VIRTLYST) << "Production" << production;
@@ -104,6 +113,12 @@ bool Virtlyst::init()
         QSqlDatabase::removeDatabase(QStringLiteral("db"));
     }
 
+    if (!updateDB()) {
+        qDebug() << "Failed to update database" << m_dbPath;
+        return false;
+    }
+    QSqlDatabase::removeDatabase(QStringLiteral("db"));
+
     auto templatePath =
         config(QStringLiteral("TemplatePath"), pathTo(QStringLiteral("root/src"))).toString();
     auto view = new CuteleeView(this);
@@ -125,6 +140,8 @@ bool Virtlyst::init()
 
     new StatusMessage(this);
 
+    m_warmPool = new WarmPool(this);
+
     return true;
 }
 
@@ -132,6 +149,10 @@ bool Virtlyst::postFork()
 {
     QMutexLocker locker(&mutex);
 
+    // A thread started in the master doesn't survive the fork, and
+    // the connections opened below need the loop to be running
+    EventLoop::start();
+
     auto db = QSqlDatabase::addDatabase(
         QStringLiteral("QSQLITE"), Cutelyst::Sql::databaseNameThread(QStringLiteral("virtlyst")));
     db.setDatabaseName(m_dbPath);
@@ -147,8 +168,24 @@ bool Virtlyst::postFork()
 
     qCDebug(VIRTLYST) << "Database ready" << db.connectionName();
 
+    // The sampler creates its thread on first use, nothing may touch it
+    // before the fork. Chart history is kept next to the database.
+    MetricsStore::instance()->open(
+        config(QStringLiteral("MetricsStorePath"),
+               QFileInfo(m_dbPath).absolutePath() + QLatin1String("/virtlyst-metrics.log"))
+            .toString());
+
+    Fleet::instance()->start();
+    CpuHeatmap::instance()->start();
+
+    // Shared by all threads of a worker, each scrape only renders the last snapshot
+    Sampler::instance()->setBalloonPeriod(config(QStringLiteral("BalloonPeriod"), 0).toInt());
+    Sampler::instance()->setInterval(config(QStringLiteral("MetricsInterval"), 15000).toInt());
+
     updateConnections();
 
+    m_warmPool->refillAll();
+
     return true;
 }
 
@@ -183,6 +220,21 @@ Connection *Virtlyst::connection(const QString &id, QObject *parent)
     return nullptr;
 }
 
+ServerConn *Virtlyst::server(const QString &id) const
+{
+    return m_connections.value(id);
+}
+
+WarmPool *Virtlyst::warmPool() const
+{
+    return m_warmPool;
+}
+
+QString Virtlyst::databasePath() const
+{
+    return m_dbPath;
+}
+
 QString Virtlyst::prettyKibiBytes(quint64 kibiBytes)
 {
     QString ret;
@@ -313,6 +365,7 @@ void Virtlyst::updateConnections()
             break;
         }
         server->url = url;
+        Sampler::instance()->setHost(id, name, url);
 
         server->conn = new Connection(url, name, server);
         m_connections.insert(id, server);
@@ -321,6 +374,7 @@ void Virtlyst::updateConnections()
     auto it = m_connections.begin();
     while (it != m_connections.end()) {
         if (!ids.contains(it.key())) {
+            Sampler::instance()->removeHost(it.key());
             it.value()->deleteLater();
             it = m_connections.erase(it);
         } else {
@@ -409,6 +463,40 @@ bool Virtlyst::createDB()
     return true;
 }
 
+bool Virtlyst::updateDB()
+{
+    auto db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), QStringLiteral("db"));
+    db.setDatabaseName(m_dbPath);
+    if (!db.open()) {
+        qCWarning(VIRTLYST) << "Failed to open database" << db.lastError().databaseText();
+        return false;
+    }
+
+    // Tables added after the initial schema, created
+    // here so that existing databases get them too
+    QSqlQuery query(db);
+    if (!query.exec(QStringLiteral("CREATE TABLE IF NOT EXISTS warm_pool "
+                                   "( id integer NOT NULL PRIMARY KEY"
+                                   ", server_id integer NOT NULL"
+                                   ", template TEXT NOT NULL"
+                                   ", pool TEXT NOT NULL"
+                                   ", size integer NOT NULL"
+                                   ", UNIQUE(server_id, template, pool))"))) {
+        qCCritical(VIRTLYST) << "Error updating database" << query.lastError().text();
+        return false;
+    }
+
+    if (!query.exec(QStringLiteral("CREATE TABLE IF NOT EXISTS warm_volumes "
+                                   "( id integer NOT NULL PRIMARY KEY"
+                                   ", warm_pool_id integer NOT NULL"
+                                   ", path TEXT UNIQUE NOT NULL)"))) {
+        qCCritical(VIRTLYST) << "Error updating database" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
 bool ServerConn::alive()
 {
     if (conn) {
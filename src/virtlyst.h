@@ -63,6 +63,7 @@ public:
 };
 
 class QSqlQuery;
+class WarmPool;
 class Virtlyst : public Application
 {
     Q_OBJECT
@@ -78,6 +79,11 @@ public:
     QVector<ServerConn *> servers(QObject *parent);
 
     Connection *connection(const QString &id, QObject *parent);
+    ServerConn *server(const QString &id) const;
+
+    WarmPool *warmPool() const;
+
+    QString databasePath() const;
 
     static QString prettyKibiBytes(quint64 kibiBytes);
 
@@ -90,8 +96,10 @@ public:
 
 private:
     bool createDB();
+    bool updateDB();
 
     QMap<QString, ServerConn *> m_connections;
+    WarmPool *m_warmPool = nullptr;
     QString m_dbPath;
 };
 
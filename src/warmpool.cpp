@@ -0,0 +1,368 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "warmpool.h"
+
+#include "lib/connection.h"
+#include "lib/storagepool.h"
+#include "lib/storagevol.h"
+#include "virtlyst.h"
+
+#include <Cutelyst/Plugins/Utils/Sql>
+
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QSet>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
+#include <QUuid>
+
+using namespace Cutelyst;
+
+Q_LOGGING_CATEGORY(V_WARMPOOL, "virtlyst.warmpool")
+
+namespace {
+
+// Each worker thread has its own Virtlyst instance, the
+// refill state is shared so a host is refilled only once
+QMutex refillMutex;
+QSet<QString> refilling;
+
+QThreadPool *refillPool()
+{
+    static QThreadPool *pool = [] {
+        auto pool = new QThreadPool;
+        pool->setMaxThreadCount(1);
+        // The thread keeps its own database connection
+        pool->setExpiryTimeout(-1);
+        pool->setThreadPriority(QThread::LowestPriority);
+        return pool;
+    }();
+    return pool;
+}
+
+bool openThreadDatabase(const QString &path)
+{
+    QThread::currentThread()->setObjectName(QStringLiteral("warmpool"));
+
+    const QString name = Sql::databaseNameThread(QStringLiteral("virtlyst"));
+    if (QSqlDatabase::contains(name)) {
+        return true;
+    }
+
+    auto db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), name);
+    db.setDatabaseName(path);
+    if (!db.open()) {
+        qCWarning(V_WARMPOOL) << "Failed to open database" << db.lastError().databaseText();
+        return false;
+    }
+    return true;
+}
+
+struct Shortage {
+    int id;
+    QString templatePath;
+    QString pool;
+    int count;
+};
+
+void refillHost(const QString &dbPath,
+                const QString &hostId,
+                const QUrl &url,
+                const QString &hostName)
+{
+    if (!openThreadDatabase(dbPath)) {
+        return;
+    }
+
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(
+        QStringLiteral("SELECT p.id, p.template, p.pool, p.size, "
+                       "(SELECT COUNT(*) FROM warm_volumes v WHERE v.warm_pool_id = p.id) "
+                       "FROM warm_pool p WHERE p.server_id = :server_id"),
+        QStringLiteral("virtlyst"));
+    query.bindValue(QStringLiteral(":server_id"), hostId);
+    if (!query.exec()) {
+        qCWarning(V_WARMPOOL) << "Failed to get warm pools" << query.lastError().databaseText();
+        return;
+    }
+
+    QVector<Shortage> shortages;
+    while (query.next()) {
+        const int count = query.value(3).toInt() - query.value(4).toInt();
+        if (count > 0) {
+            shortages.append({
+                query.value(0).toInt(),
+                query.value(1).toString(),
+                query.value(2).toString(),
+                count,
+            });
+        }
+    }
+
+    if (shortages.isEmpty()) {
+        return;
+    }
+
+    Connection conn(url, hostName);
+    if (!conn.isAlive()) {
+        qCWarning(V_WARMPOOL) << "Host not available for refill" << hostName;
+        return;
+    }
+
+    QSqlQuery insert =
+        CPreparedSqlQueryThreadForDB(QStringLiteral("INSERT INTO warm_volumes "
+                                                    "(warm_pool_id, path) "
+                                                    "VALUES "
+                                                    "(:warm_pool_id, :path)"),
+                                     QStringLiteral("virtlyst"));
+    for (const Shortage &shortage : shortages) {
+        StorageVol *templ = conn.getStorageVolByPath(shortage.templatePath, &conn);
+        StoragePool *pool = conn.getStoragePool(shortage.pool, &conn);
+        if (!templ || !pool) {
+            qCWarning(V_WARMPOOL) << "Template or pool not found" << shortage.templatePath
+                                  << shortage.pool;
+            continue;
+        }
+
+        // Older warm pools could target any pool, nothing claims from those
+        if (templ->pool()->name() != shortage.pool) {
+            qCWarning(V_WARMPOOL) << "Not refilling warm pool outside of the template's pool"
+                                  << shortage.templatePath << shortage.pool;
+            continue;
+        }
+
+        const QString baseName = QFileInfo(templ->name()).completeBaseName();
+        for (int i = 0; i < shortage.count; ++i) {
+            const QString name = baseName + QLatin1String("-warm-") +
+                                 QUuid::createUuid().toString(QUuid::Id128).left(8);
+            StorageVol *vol = templ->clone(
+                name, templ->type(), 0, StorageVol::CloneReflink, nullptr, pool);
+            if (!vol) {
+                qCWarning(V_WARMPOOL) << "Failed to pre-clone" << shortage.templatePath
+                                      << conn.lastError();
+                break;
+            }
+
+            insert.bindValue(QStringLiteral(":warm_pool_id"), shortage.id);
+            insert.bindValue(QStringLiteral(":path"), vol->path());
+            if (!insert.exec()) {
+                qCWarning(V_WARMPOOL)
+                    << "Failed to register warm volume" << insert.lastError().databaseText();
+                vol->undefine();
+                break;
+            }
+            qCDebug(V_WARMPOOL) << "Warm volume ready" << vol->path();
+        }
+    }
+}
+
+} // namespace
+
+WarmPool::WarmPool(Virtlyst *parent)
+    : QObject(parent)
+    , m_virtlyst(parent)
+    , m_timer(new QTimer(this))
+{
+    m_timer->setInterval(parent->config(QStringLiteral("WarmPoolInterval"), 300).toInt() * 1000);
+    connect(m_timer, &QTimer::timeout, this, &WarmPool::refillAll);
+    m_timer->start();
+}
+
+QString WarmPool::claim(const QString &hostId, const QString &templatePath, const QString &pool)
+{
+    QSqlQuery query =
+        CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT v.id, v.path FROM warm_volumes v "
+                                                    "INNER JOIN warm_pool p "
+                                                    "ON p.id = v.warm_pool_id "
+                                                    "WHERE p.server_id = :server_id "
+                                                    "AND p.template = :template "
+                                                    "AND p.pool = :pool "
+                                                    "ORDER BY v.id"),
+                                     QStringLiteral("virtlyst"));
+    query.bindValue(QStringLiteral(":server_id"), hostId);
+    query.bindValue(QStringLiteral(":template"), templatePath);
+    query.bindValue(QStringLiteral(":pool"), pool);
+    if (!query.exec()) {
+        qCWarning(V_WARMPOOL) << "Failed to get warm volumes" << query.lastError().databaseText();
+        return QString();
+    }
+
+    QSqlQuery remove = CPreparedSqlQueryThreadForDB(
+        QStringLiteral("DELETE FROM warm_volumes WHERE id = :id"), QStringLiteral("virtlyst"));
+
+    QString ret;
+    while (query.next()) {
+        // Whoever deletes the row owns the volume, other threads
+        // or processes racing for the same row get no rows back
+        remove.bindValue(QStringLiteral(":id"), query.value(0));
+        if (remove.exec() && remove.numRowsAffected() == 1) {
+            ret = query.value(1).toString();
+            break;
+        }
+    }
+
+    if (!ret.isEmpty()) {
+        qCDebug(V_WARMPOOL) << "Claimed warm volume" << ret;
+        refill(hostId);
+    }
+
+    return ret;
+}
+
+bool WarmPool::release(const QString &hostId,
+                       const QString &templatePath,
+                       const QString &pool,
+                       const QString &path)
+{
+    QSqlQuery query =
+        CPreparedSqlQueryThreadForDB(QStringLiteral("INSERT INTO warm_volumes "
+                                                    "(warm_pool_id, path) "
+                                                    "SELECT id, :path FROM warm_pool "
+                                                    "WHERE server_id = :server_id "
+                                                    "AND template = :template "
+                                                    "AND pool = :pool"),
+                                     QStringLiteral("virtlyst"));
+    query.bindValue(QStringLiteral(":path"), path);
+    query.bindValue(QStringLiteral(":server_id"), hostId);
+    query.bindValue(QStringLiteral(":template"), templatePath);
+    query.bindValue(QStringLiteral(":pool"), pool);
+    if (!query.exec() || query.numRowsAffected() != 1) {
+        // The warm pool was removed meanwhile
+        qCWarning(V_WARMPOOL) << "Failed to release warm volume" << path
+                              << query.lastError().databaseText();
+        return false;
+    }
+
+    qCDebug(V_WARMPOOL) << "Released warm volume" << path;
+    return true;
+}
+
+void WarmPool::refill(const QString &hostId)
+{
+    ServerConn *server = m_virtlyst->server(hostId);
+    if (!server) {
+        return;
+    }
+
+    {
+        QMutexLocker locker(&refillMutex);
+        if (refilling.contains(hostId)) {
+            return;
+        }
+        refilling.insert(hostId);
+    }
+
+    const QString dbPath   = m_virtlyst->databasePath();
+    const QUrl url         = server->url;
+    const QString hostName = server->name;
+    refillPool()->start([dbPath, hostId, url, hostName] {
+        refillHost(dbPath, hostId, url, hostName);
+
+        QMutexLocker locker(&refillMutex);
+        refilling.remove(hostId);
+    });
+}
+
+void WarmPool::refillAll()
+{
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(
+        QStringLiteral("SELECT DISTINCT server_id FROM warm_pool"), QStringLiteral("virtlyst"));
+    if (!query.exec()) {
+        qCWarning(V_WARMPOOL) << "Failed to get warm pools" << query.lastError().databaseText();
+        return;
+    }
+
+    while (query.next()) {
+        refill(query.value(0).toString());
+    }
+}
+
+QVariantList WarmPool::pools(const QString &hostId)
+{
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(
+        QStringLiteral("SELECT p.id, p.template, p.pool, p.size, "
+                       "(SELECT COUNT(*) FROM warm_volumes v WHERE v.warm_pool_id = p.id) AS ready "
+                       "FROM warm_pool p WHERE p.server_id = :server_id"),
+        QStringLiteral("virtlyst"));
+    query.bindValue(QStringLiteral(":server_id"), hostId);
+    if (!query.exec()) {
+        qCWarning(V_WARMPOOL) << "Failed to get warm pools" << query.lastError().databaseText();
+        return QVariantList();
+    }
+    return Sql::queryToHashList(query);
+}
+
+bool WarmPool::addPool(const QString &hostId,
+                       const QString &templatePath,
+                       const QString &pool,
+                       int size)
+{
+    QSqlQuery query =
+        CPreparedSqlQueryThreadForDB(QStringLiteral("INSERT OR REPLACE INTO warm_pool "
+                                                    "(server_id, template, pool, size) "
+                                                    "VALUES "
+                                                    "(:server_id, :template, :pool, :size)"),
+                                     QStringLiteral("virtlyst"));
+    query.bindValue(QStringLiteral(":server_id"), hostId);
+    query.bindValue(QStringLiteral(":template"), templatePath);
+    query.bindValue(QStringLiteral(":pool"), pool);
+    query.bindValue(QStringLiteral(":size"), size);
+    if (!query.exec()) {
+        qCWarning(V_WARMPOOL) << "Failed to add warm pool" << query.lastError().databaseText();
+        return false;
+    }
+    return true;
+}
+
+QStringList WarmPool::removePool(const QString &hostId, const QString &id)
+{
+    QStringList ret;
+
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(
+        QStringLiteral("DELETE FROM warm_pool WHERE id = :id AND server_id = :server_id"),
+        QStringLiteral("virtlyst"));
+    query.bindValue(QStringLiteral(":id"), id);
+    query.bindValue(QStringLiteral(":server_id"), hostId);
+    if (!query.exec() || query.numRowsAffected() != 1) {
+        qCWarning(V_WARMPOOL) << "Failed to remove warm pool" << id
+                              << query.lastError().databaseText();
+        return ret;
+    }
+
+    QSqlQuery volumes = CPreparedSqlQueryThreadForDB(
+        QStringLiteral("SELECT id, path FROM warm_volumes WHERE warm_pool_id = :id"),
+        QStringLiteral("virtlyst"));
+    volumes.bindValue(QStringLiteral(":id"), id);
+    if (!volumes.exec()) {
+        return ret;
+    }
+
+    QSqlQuery remove = CPreparedSqlQueryThreadForDB(
+        QStringLiteral("DELETE FROM warm_volumes WHERE id = :id"), QStringLiteral("virtlyst"));
+    while (volumes.next()) {
+        remove.bindValue(QStringLiteral(":id"), volumes.value(0));
+        if (remove.exec() && remove.numRowsAffected() == 1) {
+            ret.append(volumes.value(1).toString());
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WARMPOOL_H
+#define WARMPOOL_H
+
+#include <QObject>
+#include <QVariant>
+
+class QTimer;
+class Virtlyst;
+class WarmPool : public QObject
+{
+    Q_OBJECT
+public:
+    explicit WarmPool(Virtlyst *parent);
+
+    // Warm volumes are clones in the template's format and pool, made
+    // without flags, callers asking for anything else can't use them
+    QString claim(const QString &hostId, const QString &templatePath, const QString &pool);
+    bool release(const QString &hostId,
+                 const QString &templatePath,
+                 const QString &pool,
+                 const QString &path);
+
+    void refill(const QString &hostId);
+    void refillAll();
+
+    static QVariantList pools(const QString &hostId);
+    // pool must be the one of the template, the only one claimed from
+    static bool
+        addPool(const QString &hostId, const QString &templatePath, const QString &pool, int size);
+    static QStringList removePool(const QString &hostId, const QString &id);
+
+private:
+    Virtlyst *m_virtlyst;
+    QTimer *m_timer;
+};
+
+#endif // WARMPOOL_H
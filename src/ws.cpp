@@ -1,15 +1,21 @@
 #include "ws.h"
 
 #include "lib/connection.h"
+#include "consoleshaper.h"
+#include "consoleviewer.h"
 #include "lib/domain.h"
+#include "rfbbroker.h"
+#include "serialsession.h"
+#include "sshtunnels.h"
 #include "virtlyst.h"
 
 #include <libvirt/libvirt.h>
 
-#include <QBuffer>
+#include <Cutelyst/Request>
+
+#include <QElapsedTimer>
 #include <QLoggingCategory>
-#include <QProcess>
-#include <QTcpSocket>
+#include <QThread>
 
 Q_LOGGING_CATEGORY(V_WS, "virtlyst.ws")
 
@@ -17,6 +23,38 @@ Ws::Ws(Virtlyst *parent)
     : Controller(parent)
     , m_virtlyst(parent)
 {
+    m_limits.highWatermark =
+        parent->config(u"ConsoleHighWatermark"_qs, m_limits.highWatermark).toLongLong();
+    m_limits.lowWatermark =
+        parent->config(u"ConsoleLowWatermark"_qs, m_limits.lowWatermark).toLongLong();
+    m_limits.ackTimeoutMs = parent->config(u"ConsoleAckTimeout"_qs, m_limits.ackTimeoutMs).toInt();
+    m_limits.preconnectLimit =
+        parent->config(u"ConsolePreconnectLimit"_qs, m_limits.preconnectLimit).toLongLong();
+    m_limits.upstreamLimit =
+        parent->config(u"ConsoleUpstreamLimit"_qs, m_limits.upstreamLimit).toLongLong();
+    m_limits.relayThreads =
+        parent->config(u"ConsoleRelayThreads"_qs, qMax(1, QThread::idealThreadCount() / 2))
+            .toInt();
+    m_limits.chunkSize = parent->config(u"ConsoleChunkSize"_qs, m_limits.chunkSize).toLongLong();
+
+    WsDeflate::Options &deflate = m_limits.deflateOptions;
+    deflate.level    = parent->config(u"ConsoleDeflateLevel"_qs, deflate.level).toInt();
+    deflate.takeover = parent->config(u"ConsoleDeflateTakeover"_qs, deflate.takeover).toBool();
+    deflate.budget   = parent->config(u"ConsoleDeflateBudget"_qs, deflate.budget).toInt();
+    m_deflate        = parent->config(u"ConsoleDeflate"_qs, true).toBool();
+
+    ConsoleShaper::Limits shaper;
+    shaper.sessionRate  = parent->config(u"ConsoleSessionRate"_qs, 0).toLongLong();
+    shaper.sessionBurst = parent->config(u"ConsoleSessionBurst"_qs, 0).toLongLong();
+    shaper.globalRate   = parent->config(u"ConsoleGlobalRate"_qs, 0).toLongLong();
+    shaper.globalBurst  = parent->config(u"ConsoleGlobalBurst"_qs, 0).toLongLong();
+    ConsoleShaper::configure(shaper);
+
+    m_graphicsFd       = parent->config(u"ConsoleGraphicsFd"_qs, true).toBool();
+    m_sharing          = parent->config(u"ConsoleSharing"_qs, true).toBool();
+    m_serialInputLimit = parent->config(u"SerialInputLimit"_qs, 64 * 1024).toLongLong();
+
+    SshTunnels::setIdleTimeout(parent->config(u"SshTunnelIdle"_qs, 60 * 1000).toInt());
 }
 
 void Ws::index(Context *c, const QString &hostId, const QString &uuid)
@@ -34,14 +72,49 @@ void Ws::index(Context *c, const QString &hostId, const QString &uuid)
         return;
     }
 
-    if (!c->response()->webSocketHandshake({}, {}, "binary"_qba)) {
+    // Browsers that can inflate offer the deflate subprotocol first
+    ConsoleSession::Limits limits = m_limits;
+    QByteArray protocol           = "binary"_qba;
+    if (m_deflate &&
+        c->request()->header("Sec-WebSocket-Protocol").contains(WsDeflate::Protocol)) {
+        protocol       = WsDeflate::Protocol;
+        limits.deflate = true;
+        if (c->request()->queryParam(u"takeover"_qs) == u"0") {
+            limits.deflateOptions.takeover = false;
+        }
+    }
+
+    if (!c->response()->webSocketHandshake({}, {}, protocol)) {
         qCWarning(V_WS) << "Failed to estabilish websocket handshake";
         return;
     }
 
+    // Further viewers of a VNC console reuse the first session upstream
+    QString shareKey;
+    if (m_sharing && dom->consoleType() == u"vnc") {
+        shareKey = hostId + QLatin1Char('/') + uuid;
+        if (RfbBroker::join(shareKey, [c, hostId, conn, dom, &limits](RfbBroker *broker) {
+                new ConsoleViewer(c, broker, hostId, conn->name(), dom->name(), limits);
+            })) {
+            return;
+        }
+    }
+
+    auto session = new ConsoleSession(c, hostId, conn->name(), dom->name(), limits, shareKey);
+
+    // A local daemon hands us a socket already connected to the graphics
+    // server, no TCP hop and it works even if it doesn't listen on TCP
+    if (m_graphicsFd && conn->isLocal()) {
+        const int fd = dom->openGraphicsFd();
+        if (fd >= 0) {
+            session->openFd(fd);
+            return;
+        }
+        qCDebug(V_WS) << "Falling back to the graphics TCP port for" << dom->name();
+    }
+
     const quint16 port = dom->consolePort();
     QString host       = dom->consoleListenAddress();
-    auto sock          = new QTcpSocket(c);
 
     // if the remote or local domain is listening on
     // all addresses better use the connection hostname
@@ -51,89 +124,65 @@ void Ws::index(Context *c, const QString &hostId, const QString &uuid)
             host = QStringLiteral("0.0.0.0");
         }
     } else if (host == u"127.0.0.1" && conn->uri().contains(u"ssh://")) {
-        createSshTunnel(sock, QUrl(conn->uri()), port);
+        // Consoles of a host share one ssh connection, the
+        // session waits without blocking this worker thread
+        const QUrl url(conn->uri());
+        QElapsedTimer tunnelTimer;
+        tunnelTimer.start();
+        SshTunnels::instance()->forward(
+            url, port, session, [session, tunnelTimer](quint16 localPort, const QString &error) {
+            session->setTunnelTime(tunnelTimer.elapsed());
+            if (localPort) {
+                session->open(QStringLiteral("127.0.0.1"), localPort);
+            } else {
+                session->fail(error);
+            }
+        });
+        connect(session, &QObject::destroyed, [url, port] {
+            SshTunnels::instance()->release(url, port);
+        });
+        return;
     }
 
-    sock->connectToHost(host, port);
-    qCDebug(V_WS) << "Connecting TCP socket to" << host << port;
+    session->open(host, port);
+}
 
-    connect(sock, &QTcpSocket::readyRead, c, [=] {
-        const QByteArray data = sock->readAll();
-        //        qCWarning(V_WS) << "Console Proxy socket data" << data.size();
-        c->response()->webSocketBinaryMessage(data);
-    });
-    connect(sock, &QTcpSocket::errorOccurred, c, [=](QAbstractSocket::SocketError error) {
-        qCWarning(V_WS) << "Console Proxy error:" << error << sock->errorString();
-        c->response()->webSocketClose(Response::CloseCodeAbnormalDisconnection,
-                                      sock->errorString());
-    });
-    connect(sock, &QTcpSocket::disconnected, c, [=] {
-        qCWarning(V_WS) << "Console Proxy socket disconnected";
+void Ws::serial(Context *c, const QString &hostId, const QString &uuid)
+{
+    Connection *conn = m_virtlyst->connection(hostId, c);
+    if (conn == nullptr) {
+        qCWarning(V_WS) << "Host id not found or connection not active";
+        c->response()->redirect(c->uriForAction(QStringLiteral("/index")));
+        return;
+    }
+
+    Domain *dom = conn->getDomainByUuid(uuid, c);
+    if (!dom) {
+        qCDebug(V_WS) << "Domain not found: no domain with matching name '%1'" << uuid;
+        return;
+    }
+
+    if (!c->response()->webSocketHandshake()) {
+        qCWarning(V_WS) << "Failed to estabilish websocket handshake";
+        return;
+    }
+
+    virStreamPtr stream = dom->openSerialConsole();
+    if (!stream) {
         c->response()->webSocketClose(Response::CloseCodeAbnormalDisconnection,
-                                      sock->errorString());
-    });
-
-    auto buf = new QBuffer(c);
-    connect(sock, &QTcpSocket::connected, c, [=] {
-        qCWarning(V_WS) << "Console Proxy socket connected from" << host << port;
-        if (buf->isOpen()) {
-            sock->write(buf->readAll());
-            sock->flush();
-            buf->close();
-        }
-    });
+                                      QStringLiteral("Cannot open serial console"));
+        return;
+    }
 
-    connect(c->request(), &Request::webSocketBinaryFrame, c, [=](const QByteArray &message) {
-        //        qCWarning(V_WS) << "Console Proxy ws data" << message.size();
-        if (sock->state() != QAbstractSocket::ConnectedState) {
-            buf->open(QIODevice::ReadWrite);
-            buf->write(message);
-            return;
-        }
-        sock->write(message);
-        sock->flush();
-    });
+    new SerialSession(c, stream, dom->name(), m_serialInputLimit);
 }
 
-void Ws::createSshTunnel(QAbstractSocket *sock, const QUrl &url, quint16 port)
+void Ws::stats(Context *c)
 {
-    qCDebug(V_WS) << "Create SSH tunnel to" << url.host() << "as" << url.userName();
-
-    QStringList args;
-    args << u"-TCv"_qs;
-    args << u"-L"_qs << QStringLiteral("127.0.0.1:%1:127.0.0.1:%1").arg(port);
-    args << u"-l"_qs << url.userName();
-    args << url.host();
-
-    auto process = new QProcess(sock);
-    connect(sock, &QAbstractSocket::disconnected, process, [process] {
-        if (process->state() == QProcess::Running) {
-            process->terminate();
-            qCDebug(V_WS) << "Shutdown ssh tunnel:" << process->waitForFinished();
-        }
-    });
-
-    process->setProgram(u"ssh"_qs);
-    process->setArguments(args);
-    process->setReadChannel(QProcess::StandardError);
-    process->start();
-
-    if (process->waitForStarted()) {
-        QByteArrayList outputVerbose;
-        if (process->state() == QProcess::Running) {
-            while (process->waitForReadyRead()) {
-                const auto &output = process->readAllStandardError();
-                if (output.contains("Local forwarding listening on")) {
-                    qCDebug(V_WS) << "SSH tunnel established";
-                    return;
-                }
-                outputVerbose << output;
-            }
-            qCWarning(V_WS) << "Cannot create ssh tunnel:" << outputVerbose.join('\n');
-            process->terminate();
-            return;
-        }
-    }
+    c->response()->setJsonArrayBody(ConsoleSession::sessions());
+}
 
-    qCWarning(V_WS) << "Cannot start ssh:" << process->readAllStandardError();
+void Ws::hosts(Context *c)
+{
+    c->response()->setJsonObjectBody(ConsoleSession::hosts());
 }
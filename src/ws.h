@@ -1,9 +1,9 @@
 #ifndef WS_H
 #define WS_H
 
-#include <Cutelyst/Controller>
+#include "consolesession.h"
 
-#include <QAbstractSocket>
+#include <Cutelyst/Controller>
 
 using namespace Cutelyst;
 
@@ -17,13 +17,26 @@ public:
     C_ATTR(index, :Path :AutoArgs)
     void index(Context *c, const QString &hostId, const QString &uuid);
 
+    C_ATTR(serial, :Local :AutoArgs)
+    void serial(Context *c, const QString &hostId, const QString &uuid);
+
+    C_ATTR(stats, :Local :AutoArgs)
+    void stats(Context *c);
+
+    // Console counters aggregated per host
+    C_ATTR(hosts, :Local :AutoArgs)
+    void hosts(Context *c);
+
 private Q_SLOTS:
     void End(Context *c) { Q_UNUSED(c); }
 
 private:
     Virtlyst *m_virtlyst;
-
-    void createSshTunnel(QAbstractSocket *sock, const QUrl &url, quint16 port);
+    ConsoleSession::Limits m_limits;
+    bool m_graphicsFd;
+    bool m_deflate;
+    bool m_sharing;
+    qint64 m_serialInputLimit;
 };
 
 #endif // WS_H
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "wsdeflate.h"
+
+#include <QLoggingCategory>
+
+#include <zlib.h>
+
+Q_LOGGING_CATEGORY(V_DEFLATE, "virtlyst.deflate")
+
+WsDeflate::WsDeflate(const Options &options)
+    : m_options(options)
+{
+    m_stream = new z_stream{};
+    if (deflateInit(m_stream, m_options.level) != Z_OK) {
+        qCWarning(V_DEFLATE) << "Failed to init deflate, sending uncompressed";
+        delete m_stream;
+        m_stream = nullptr;
+    }
+    m_window.start();
+}
+
+WsDeflate::~WsDeflate()
+{
+    if (m_stream) {
+        deflateEnd(m_stream);
+        delete m_stream;
+    }
+}
+
+QByteArray WsDeflate::encode(const QByteArray &data)
+{
+    if (m_window.elapsed() >= 1000) {
+        m_window.restart();
+        m_spentNs = 0;
+    }
+
+    // The browser inflates in the same order, raw
+    // messages don't touch the zlib stream
+    const qint64 budgetNs = qint64(m_options.budget) * 10 * 1000 * 1000;
+    if (!m_stream || data.size() < m_options.minSize || m_spentNs >= budgetNs) {
+        QByteArray ret;
+        ret.reserve(data.size() + 1);
+        ret.append('\0');
+        ret.append(data);
+        return ret;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QByteArray ret(1 + deflateBound(m_stream, data.size()) + 16, Qt::Uninitialized);
+    ret[0] = 1;
+
+    m_stream->next_in  = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData()));
+    m_stream->avail_in = uInt(data.size());
+
+    // Sync flush ends each message on a byte boundary, full flush
+    // also drops the history so no message refers to an earlier one
+    const int flush = m_options.takeover ? Z_SYNC_FLUSH : Z_FULL_FLUSH;
+    qsizetype used  = 1;
+    do {
+        if (used == ret.size()) {
+            ret.resize(ret.size() * 2);
+        }
+        m_stream->next_out  = reinterpret_cast<Bytef *>(ret.data() + used);
+        m_stream->avail_out = uInt(ret.size() - used);
+        if (deflate(m_stream, flush) == Z_STREAM_ERROR) {
+            qCWarning(V_DEFLATE) << "Deflate failed" << m_stream->msg;
+            break;
+        }
+        used = ret.size() - m_stream->avail_out;
+    } while (m_stream->avail_out == 0);
+    ret.resize(used);
+
+    m_spentNs += timer.nsecsElapsed();
+    return ret;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2018 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WSDEFLATE_H
+#define WSDEFLATE_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+
+struct z_stream_s;
+
+// Compresses the binary messages of one WebSocket as a single zlib
+// stream. Each message starts with a flag byte, 1 when deflated and
+// 0 when sent as is, so small messages and sessions over their CPU
+// budget skip the compressor.
+class WsDeflate
+{
+public:
+    static constexpr auto Protocol = "binary.deflate";
+
+    struct Options {
+        int level         = 1;
+        // Keep the window between messages, otherwise every
+        // message is fully flushed and compresses on its own
+        bool takeover     = true;
+        // Percent of each second a session may spend compressing
+        int budget        = 10;
+        qsizetype minSize = 128;
+    };
+
+    explicit WsDeflate(const Options &options);
+    ~WsDeflate();
+
+    QByteArray encode(const QByteArray &data);
+
+private:
+    Q_DISABLE_COPY(WsDeflate)
+
+    struct z_stream_s *m_stream = nullptr;
+    Options m_options;
+    QElapsedTimer m_window;
+    qint64 m_spentNs = 0;
+};
+
+#endif // WSDEFLATE_H